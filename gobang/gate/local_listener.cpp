@@ -33,6 +33,7 @@ local_listener::local_listener(simple::service& s, const simple::toml_table_t& t
 simple::task<> local_listener::start() {
     auto& network = simple::network::instance();
     auto server = co_await network.tcp_listen("127.0.0.1", local_port_, true);
+    network.frame_codec(server, net_frame_codec());
     simple::co_start([this, server] { return accept(server); });
 }
 
@@ -68,7 +68,7 @@ simple::task<> master_connector::run() {
                 co_await simple::sleep_for(std::chrono::milliseconds(interval));
             }
 
-            socket_ = co_await network.tcp_connect(host, port, 10s);
+            socket_ = co_await network.tcp_connect(host, port, 10s, net_frame_codec());
             if (socket_ == 0) {
                 ++cnt_fail;
                 simple::error("[{}] tcp_connect fail", service_.name());
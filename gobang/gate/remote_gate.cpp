@@ -77,7 +77,7 @@ simple::task<> remote_gate::run() {
                 co_await simple::sleep_for(std::chrono::milliseconds(interval));
             }
 
-            socket_ = co_await network.tcp_connect(host, port, 10s);
+            socket_ = co_await network.tcp_connect(host, port, 10s, net_frame_codec());
             if (socket_ == 0) {
                 inc_address_cnt();
                 simple::error("[{}] remote:{} address:{} tcp_connect fail", service_->name(), id_, address);
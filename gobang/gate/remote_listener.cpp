@@ -24,6 +24,7 @@ remote_listener::remote_listener(simple::service& s, const simple::toml_table_t&
 simple::task<> remote_listener::start() {
     auto& network = simple::network::instance();
     auto server = co_await network.tcp_listen("", remote_port_, true);
+    network.frame_codec(server, net_frame_codec());
     simple::co_start([this, server] { return accept(server); });
 }
 
@@ -32,6 +32,7 @@ simple::task<> gate_master::awake() {
     simple::warn("[{}] awake", name());
     auto& network = simple::network::instance();
     auto server = co_await network.tcp_listen("", listen_port_, true);
+    network.frame_codec(server, net_frame_codec());
     simple::co_start([this, server] { return accept(server); });
 }
 
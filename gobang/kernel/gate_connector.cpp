@@ -164,7 +164,7 @@ simple::task<> gate_connector::run() {
                 co_await simple::sleep_for(std::chrono::milliseconds(interval));
             }
 
-            socket_ = co_await network.tcp_connect("localhost", std::to_string(port_), 10s);
+            socket_ = co_await network.tcp_connect("localhost", std::to_string(port_), 10s, net_frame_codec());
             if (socket_ == 0) {
                 ++cnt_fail;
                 simple::error("[{}] connect gate port:{} fail", service_.name(), port_);
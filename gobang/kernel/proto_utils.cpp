@@ -47,37 +47,37 @@ void init_client_buffer(simple::memory_buffer& buf, uint16_t id, uint64_t sessio
     buf.written(len);
 }
 
+simple::socket_frame_codec net_frame_codec() {
+    // 限制一个消息最大10M
+    constexpr uint32_t msg_len_limit = 1024 * 1024 * 10;
+    // len 是帧头第一个 uint32 的高 24 位，小端序时在第 1 到 3 字节
+    simple::socket_frame_codec codec;
+    codec.header_size = sizeof(net_header);
+    codec.length_offset = 1;
+    codec.length_size = 3;
+    codec.max_size = msg_len_limit + sizeof(net_header);
+    return codec;
+}
+
 simple::task<> recv_net_buffer(simple::memory_buffer& buf, net_header& header, uint32_t socket) {
     buf.clear();
     memset(&header, 0, sizeof(header));
     auto& network = simple::network::instance();
-    // 限制一个消息最大10M
-    constexpr uint32_t msg_len_limit = 1024 * 1024 * 10;
-    auto recv_len = co_await network.read_size(socket, reinterpret_cast<char*>(&header), sizeof(header));
-    if (recv_len == 0) {
+    // 网络线程已经按帧头分好了帧，长度超过限制的连接会被断开
+    const auto frame = co_await network.read_frame(socket);
+    if (!frame) {
         throw std::logic_error("recv eof");
     }
 
+    memcpy(&header, frame->begin_read(), sizeof(header));
     if (!header.valid()) {
         network.close(socket);
         auto flag = header.flag;
         throw std::logic_error(fmt::format("header flag:{} is invalid", flag));
     }
 
-    if (const auto len = header.len; len > msg_len_limit) {
-        network.close(socket);
-        throw std::logic_error(fmt::format("header len:{} > msg_len_limit", len));
-    }
-
-    if (header.len > 0) {
-        buf.reserve(header.len);
-        recv_len = co_await network.read_size(socket, reinterpret_cast<char*>(buf.begin_write()), header.len);
-        if (recv_len == 0) {
-            throw std::logic_error("recv eof");
-        }
-
-        buf.written(recv_len);
-    }
+    frame->read(sizeof(header));
+    buf = std::move(*frame);
 }
 
 void proc_ping(uint32_t socket, uint64_t session, const simple::memory_buffer& buffer) {
@@ -19,6 +19,9 @@ KERNEL_API void init_forward_buffer(simple::memory_buffer& buf, uint16_t from, u
 KERNEL_API void init_client_buffer(simple::memory_buffer& buf, uint16_t id, uint64_t session,
                                    const google::protobuf::Message& msg);
 
+// net_header 的分帧规则，监听的 socket 和连接成功的 socket 都要设置之后才能用 recv_net_buffer 接收
+KERNEL_API simple::socket_frame_codec net_frame_codec();
+
 KERNEL_API simple::task<> recv_net_buffer(simple::memory_buffer& buf, net_header& header, uint32_t socket);
 
 KERNEL_API void proc_ping(uint32_t socket, uint64_t session, const simple::memory_buffer& buffer);
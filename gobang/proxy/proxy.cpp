@@ -69,6 +69,8 @@ simple::task<> proxy::awake() {
     gate_connector_->start();
     auto& network = simple::network::instance();
     auto server = co_await network.tcp_listen("", listen_port_, true);
+    // 客户端收得太慢时不再无限堆积棋盘推送，超过上限直接断开
+    network.watermark(server, {.low = 256 * 1024, .high = 1024 * 1024, .max = 16 * 1024 * 1024});
     simple::co_start([this, server] { return accept(server); });
 }
 
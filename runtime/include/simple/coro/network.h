@@ -1,12 +1,20 @@
 ﻿#pragma once
 #include <simple/config.h>
+#include <simple/coro/cancellation_registration.h>
+#include <simple/coro/cancellation_token.h>
 
 #include <atomic>
 #include <chrono>
+#include <coroutine>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <simple/containers/buffer.hpp>
 #include <simple/coro/task.hpp>
+#include <simple/net/socket_types.h>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
 namespace simple {
 
@@ -16,6 +24,67 @@ using network_data_ptr = std::shared_ptr<network_data>;
 
 class network_awaiter;
 
+// 等待 socket 收到足够的数据，满足条件之前网络数据到达不会唤醒协程，已经满足时不挂起
+class network_read_awaiter {
+  public:
+    network_read_awaiter(network_data* data, size_t size, std::string_view end) noexcept
+        : data_(data), size_(size), end_(end) {}
+
+    network_read_awaiter(const network_read_awaiter&) = delete;
+
+    ~network_read_awaiter() noexcept = default;
+
+    network_read_awaiter& operator=(const network_read_awaiter&) = delete;
+
+    [[nodiscard]] SIMPLE_API bool await_ready() const noexcept;
+
+    template <typename Promise>
+    bool await_suspend(std::coroutine_handle<Promise> handle) {
+        handle_ = handle;
+        token_ = handle.promise().get_cancellation_token();
+        return suspend();
+    }
+
+    // 返回等待到的长度，wait 是可读的字节数，wait_until 是到 end 结尾的长度，连接断开时返回 0
+    SIMPLE_API size_t await_resume();
+
+  private:
+    SIMPLE_API bool suspend();
+
+    network_data* data_;
+    size_t size_;
+    std::string_view end_;
+    std::coroutine_handle<> handle_;
+    cancellation_token token_;
+    std::optional<cancellation_registration> registration_;
+};
+
+// socket 的读取器，只在获取时查找一次 socket，之后直接访问接收缓冲区
+// 等待数据时不创建协程帧，数据可以原地查看，用完之后 consume，不需要复制到另外的缓冲区
+// socket 断开之后读取器仍然可以安全使用，等待会返回 0
+class network_reader {
+  public:
+    network_reader() = default;
+
+    explicit network_reader(network_data_ptr data) noexcept : data_(std::move(data)) {}
+
+    // 等待缓冲区中至少有 size 字节
+    [[nodiscard]] network_read_awaiter wait(size_t size) const noexcept { return {data_.get(), size, {}}; }
+
+    // 等待缓冲区中出现 end，end 要在等待期间一直有效
+    [[nodiscard]] network_read_awaiter wait_until(std::string_view end) const noexcept { return {data_.get(), 0, end}; }
+
+    // 缓冲区中还没有读取的数据，下一次等待之后会失效
+    [[nodiscard]] SIMPLE_API std::string_view peek() const noexcept;
+
+    SIMPLE_API void consume(size_t len) noexcept;
+
+    explicit operator bool() const noexcept { return data_ != nullptr; }
+
+  private:
+    network_data_ptr data_;
+};
+
 // 只能协程中使用的网络模块
 
 class network {
@@ -30,23 +99,30 @@ class network {
 
     SIMPLE_API task<uint32_t> tcp_listen(const std::string& host, uint16_t port, bool reuse);
 
+    // workers 大于 0 时连接的加解密分散到 workers 个线程中
     SIMPLE_API task<uint32_t> ssl_listen(const std::string& host, uint16_t port, bool reuse, const std::string& cert,
-                                         const std::string& key, const std::string& dh, const std::string& password);
+                                         const std::string& key, const std::string& dh, const std::string& password,
+                                         uint32_t workers = 0);
 
-    SIMPLE_API task<uint32_t> kcp_listen(const std::string& host, uint16_t port, bool reuse);
+    SIMPLE_API task<uint32_t> kcp_listen(const std::string& host, uint16_t port, bool reuse, const kcp_profile& profile = {});
 
+    // codec 是连接的分帧规则，在开始读取之前设置，连接成功后立即收到的数据也会分帧
     SIMPLE_API task<uint32_t> tcp_connect(const std::string& host, const std::string& service,
-                                          const std::chrono::milliseconds& timeout);
+                                          const std::chrono::milliseconds& timeout, const socket_frame_codec& codec = {});
 
     SIMPLE_API task<uint32_t> ssl_connect(const std::string& host, const std::string& service,
                                           const std::chrono::milliseconds& timeout, const std::string& verify = "",
-                                          bool ignore_cert = true);
+                                          bool ignore_cert = true, const socket_frame_codec& codec = {});
 
     SIMPLE_API task<uint32_t> kcp_connect(const std::string& host, const std::string& service,
-                                          const std::chrono::milliseconds& timeout);
+                                          const std::chrono::milliseconds& timeout, const kcp_profile& profile = {},
+                                          const socket_frame_codec& codec = {});
 
     SIMPLE_API task<uint32_t> accept(uint32_t listen_id);
 
+    // 获取 socket 的读取器，socket 不存在时抛出异常
+    SIMPLE_API network_reader reader(uint32_t socket_id);
+
     SIMPLE_API task<size_t> read(uint32_t socket_id, void* buf, size_t size);
 
     SIMPLE_API task<size_t> read_size(uint32_t socket_id, void* buf, size_t size);
@@ -55,12 +131,52 @@ class network {
 
     SIMPLE_API task<size_t> read_until(uint32_t socket_id, std::string_view end, memory_buffer& buf);
 
+    // 读取一个完整的帧（包含帧头），需要先用 frame_codec 或者 connect 的 codec 设置分帧规则，连接断开时返回空
+    SIMPLE_API task<memory_buffer_ptr> read_frame(uint32_t socket_id);
+
     SIMPLE_API void write(uint32_t socket_id, const memory_buffer_ptr& buf);
 
+    // 按顺序发送多个缓冲区，缓冲区不会被修改，可以同时发给多个 socket
+    SIMPLE_API void write(uint32_t socket_id, std::vector<memory_buffer_ptr> bufs);
+
+    // 给多个 socket 发送相同的缓冲区，只投递一次到网络线程
+    SIMPLE_API void broadcast(std::vector<uint32_t> socket_ids, std::vector<memory_buffer_ptr> bufs);
+
     SIMPLE_API void close(uint32_t socket_id);
 
     SIMPLE_API void no_delay(uint32_t socket_id, bool on);
 
+    // 设置发送合并策略，对监听的 socket 设置时会应用到之后接受的连接上
+    SIMPLE_API void write_policy(uint32_t socket_id, const socket_write_policy& policy);
+
+    using writable_callback = std::function<void(uint32_t, bool)>;
+
+    // 设置发送队列的水位，水位变化时在逻辑线程回调 callback，对监听的 socket 设置时会应用到之后接受的连接上
+    SIMPLE_API void watermark(uint32_t socket_id, const socket_watermark& watermark, writable_callback callback = {});
+
+    // 设置逻辑线程中未读数据（包括分好的帧）的上限，超过时断开连接，为 0 表示不限制
+    // 对监听的 socket 设置时会应用到之后接受的连接上
+    SIMPLE_API void read_limit(uint32_t socket_id, size_t bytes);
+
+    // 设置监听 socket 接受连接的速率和数量限制，在网络线程中检查，被拒绝的连接不会通知到逻辑线程
+    SIMPLE_API void accept_limit(uint32_t listen_id, const socket_accept_limit& limit);
+
+    // 设置分帧规则，在网络线程中按长度前缀分帧，逻辑线程用 read_frame 每次取得一个完整的帧
+    // 设置之前收到的数据不会分帧，对监听的 socket 设置时会应用到之后接受的连接上，客户端在 connect 时传入
+    SIMPLE_API void frame_codec(uint32_t socket_id, const socket_frame_codec& codec);
+
+    // 等待发送队列回落到低水位以下，socket 断开时返回 false
+    SIMPLE_API task<bool> wait_writable(uint32_t socket_id);
+
+    // 所有 socket 待发送的字节数
+    SIMPLE_API int64_t write_queue_bytes();
+
+    // 所有 socket 的统计快照，在网络模块的计数上补充地址和读延迟
+    SIMPLE_API std::vector<socket_stat> socket_stats();
+
+    // kcp 服务器各个分片的统计
+    SIMPLE_API std::vector<kcp_shard_stat> kcp_shard_stats(uint32_t socket_id);
+
     SIMPLE_API std::string local_address(uint32_t socket_id);
 
     SIMPLE_API std::string remote_address(uint32_t socket_id);
@@ -74,10 +190,14 @@ class network {
 
     void hand_stop(uint32_t socket_id, const std::error_code& ec);
 
-    void hand_read(uint32_t socket_id, const memory_buffer& data);
+    void hand_read(uint32_t socket_id, memory_buffer& data, std::chrono::steady_clock::time_point time);
+
+    void hand_frame(uint32_t socket_id, memory_buffer& frame, std::chrono::steady_clock::time_point time);
 
     void hand_accept(uint32_t socket_id, uint32_t accepted, const std::string& local, const std::string& remote);
 
+    void hand_writable(uint32_t socket_id, bool writable);
+
     template <typename Service>
     network_awaiter create_start_awaiter(uint32_t socket_id, const std::string& host, const Service& service);
 
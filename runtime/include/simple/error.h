@@ -14,6 +14,12 @@ enum class socket_errors {
     kcp_protocol_error,
     // 主动断开
     initiative_disconnect,
+    // 发送队列超出上限
+    write_queue_overflow,
+    // 收到的帧超过长度上限
+    frame_too_large,
+    // 逻辑线程中未读的数据超出上限
+    read_buffer_overflow,
 };
 
 enum class coro_errors {
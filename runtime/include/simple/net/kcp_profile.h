@@ -0,0 +1,17 @@
+﻿#pragma once
+#include <simple/config.h>
+#include <simple/net/socket_types.h>
+
+#include <simple/utils/toml_types.hpp>
+
+namespace simple {
+
+// 从配置中读取 kcp 参数，preset 可以是 default、lan、mobile，其他的字段覆盖 preset 中的值
+// [kcp]
+// preset = "lan"
+// mtu = 1200
+// snd_wnd = 512
+// 字段名和 kcp_profile 的成员一致，preset 无效或者字段类型不对时抛出 std::logic_error
+SIMPLE_API kcp_profile load_kcp_profile(const toml_table_t& table);
+
+}  // namespace simple
@@ -19,6 +19,8 @@ namespace simple {
 
 class socket_base;
 
+struct socket_counters;
+
 class socket_system {
     socket_system();
 
@@ -41,29 +43,59 @@ class socket_system {
 
     SIMPLE_API uint32_t tcp_listen(const std::string& host, uint16_t port, bool reuse);
 
+    // workers 大于 0 时连接的加解密分散到 workers 个线程中
     SIMPLE_API uint32_t ssl_listen(const std::string& host, uint16_t port, bool reuse, const std::string& cert,
-                                   const std::string& key, const std::string& dh, const std::string& password);
+                                   const std::string& key, const std::string& dh, const std::string& password,
+                                   uint32_t workers = 0);
 
-    SIMPLE_API uint32_t kcp_listen(const std::string& host, uint16_t port, bool reuse);
+    SIMPLE_API uint32_t kcp_listen(const std::string& host, uint16_t port, bool reuse, const kcp_profile& profile = {});
 
     SIMPLE_API uint32_t tcp_connect(const std::string& host, const std::string& service,
-                                    const std::chrono::milliseconds& timeout);
+                                    const std::chrono::milliseconds& timeout, const socket_frame_codec& codec = {});
 
     SIMPLE_API uint32_t ssl_connect(const std::string& host, const std::string& service,
                                     const std::chrono::milliseconds& timeout, const std::string& verify = "",
-                                    bool ignore_cert = true);
+                                    bool ignore_cert = true, const socket_frame_codec& codec = {});
 
     SIMPLE_API uint32_t kcp_connect(const std::string& host, const std::string& service,
-                                    const std::chrono::milliseconds& timeout);
+                                    const std::chrono::milliseconds& timeout, const kcp_profile& profile = {},
+                                    const socket_frame_codec& codec = {});
 
     SIMPLE_API void send(uint32_t socket_id, const memory_buffer_ptr& buf);
 
+    // 按顺序发送多个缓冲区，写入队列后和其他数据一起聚合发送，缓冲区只读，可以被多个 socket 共享
+    SIMPLE_API void send(uint32_t socket_id, std::vector<memory_buffer_ptr> bufs);
+
+    // 给多个 socket 发送相同的缓冲区，只投递一次到网络线程
+    SIMPLE_API void send(std::vector<uint32_t> socket_ids, std::vector<memory_buffer_ptr> bufs);
+
     SIMPLE_API void accept(uint32_t socket_id);
 
     SIMPLE_API void close(uint32_t socket_id);
 
     SIMPLE_API void no_delay(uint32_t socket_id, bool on);
 
+    SIMPLE_API void write_policy(uint32_t socket_id, const socket_write_policy& policy);
+
+    SIMPLE_API void watermark(uint32_t socket_id, const socket_watermark& watermark);
+
+    SIMPLE_API void accept_limit(uint32_t socket_id, const socket_accept_limit& limit);
+
+    // 设置分帧规则，规则不合法时抛出 std::logic_error
+    SIMPLE_API void frame_codec(uint32_t socket_id, const socket_frame_codec& codec);
+
+    // 所有 socket 待发送的字节数
+    [[nodiscard]] SIMPLE_API int64_t write_queue_bytes() const noexcept;
+
+    // 所有 socket 的统计快照，不会和发送、查找 socket 争用同一把锁，可以在任意线程调用
+    // 地址信息由 network 补充，这里不填
+    SIMPLE_API std::vector<socket_stat> socket_stats();
+
+    SIMPLE_API bool get_socket_stat(uint32_t socket_id, socket_stat& stat);
+
+    // kcp 服务器各个分片的连接数和 cpu 时间，不是 kcp 服务器时返回空
+    SIMPLE_API std::vector<kcp_shard_stat> kcp_shard_stats(uint32_t socket_id);
+
     [[nodiscard]] size_t max_buffers() const noexcept { return max_buffers_; }
 
     asio::io_context& context() noexcept { return context_; }
@@ -74,8 +106,16 @@ class socket_system {
 
     void hand_read(uint32_t socket_id, const uint8_t* data, size_t len) const;
 
+    // 已经放在缓冲区中的数据，直接转交给逻辑线程，不再复制
+    void hand_read(uint32_t socket_id, memory_buffer&& buf) const;
+
+    // 按分帧规则得到的一个完整的帧
+    void hand_frame(uint32_t socket_id, memory_buffer&& frame) const;
+
     void hand_accept(uint32_t socket_id, uint32_t accepted, const std::string& local, const std::string& remote) const;
 
+    void hand_writable(uint32_t socket_id, bool writable) const;
+
     void insert(uint32_t socket_id, const socket_base_ptr& ptr);
 
     void erase(uint32_t socket_id);
@@ -88,14 +128,22 @@ class socket_system {
 
     void register_stop_handle(stop_handle&& handler) { stop_ = std::move(handler); }
 
-    using read_handle = std::function<void(uint32_t, const uint8_t*, size_t)>;
+    using read_handle = std::function<void(uint32_t, memory_buffer&&)>;
 
     void register_read_handle(read_handle&& handler) { read_ = std::move(handler); }
 
+    using frame_handle = std::function<void(uint32_t, memory_buffer&&)>;
+
+    void register_frame_handle(frame_handle&& handler) { frame_ = std::move(handler); }
+
     using accept_handle = std::function<void(uint32_t, uint32_t, const std::string&, const std::string&)>;
 
     void register_accept_handle(accept_handle&& handler) { accept_ = std::move(handler); }
 
+    using writable_handle = std::function<void(uint32_t, bool)>;
+
+    void register_writable_handle(writable_handle&& handler) { writable_ = std::move(handler); }
+
     using signal_callback = std::function<void(int)>;
 
     void register_signal_callback(signal_callback&& handler) {
@@ -106,6 +154,9 @@ class socket_system {
   private:
     socket_base_ptr find(uint32_t socket_id);
 
+    // 在网络线程中调用
+    void write_buffers(uint32_t socket_id, const std::vector<memory_buffer_ptr>& bufs);
+
     asio::io_context context_;
     std::size_t max_buffers_{1};
 
@@ -115,12 +166,24 @@ class socket_system {
     std::unordered_map<uint32_t, socket_base_ptr> sockets_;
     std::mutex mutex_sockets_;
 
+    struct counters_entry {
+        uint32_t listener{0};
+        std::shared_ptr<socket_counters> counters;
+    };
+
+    static void fill_socket_stat(uint32_t socket_id, const counters_entry& entry, socket_stat& stat);
+
+    std::unordered_map<uint32_t, counters_entry> counters_;
+    std::mutex mutex_counters_;
+
     std::atomic_uint32_t socket_ids_[socket_type_mask + 1];
 
     start_handle start_;
     stop_handle stop_;
     read_handle read_;
+    frame_handle frame_;
     accept_handle accept_;
+    writable_handle writable_;
 
     std::vector<signal_callback> single_;
     std::mutex mutex_single_;
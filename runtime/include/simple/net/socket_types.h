@@ -1,5 +1,8 @@
 ﻿#pragma once
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cstdint>
 #include <string>
 #include <string_view>
@@ -78,16 +81,139 @@ constexpr socket_protocol get_socket_protocol(uint32_t id) {
 
 constexpr socket_class get_socket_class(uint32_t id) { return static_cast<socket_class>(id & socket_class_mask); }
 
+// 延迟直方图，单位微秒，第 0 个桶统计小于 1 微秒的，第 i 个桶统计 [2^(i-1), 2^i) 的，最后一个桶统计剩下所有的
+inline constexpr size_t socket_histogram_size = 24;
+
+using socket_histogram = std::array<int64_t, socket_histogram_size>;
+
+constexpr size_t get_socket_histogram_index(int64_t micros) {
+    if (micros <= 0) return 0;
+    return std::min<size_t>(std::bit_width(static_cast<uint64_t>(micros)), socket_histogram_size - 1);
+}
+
+// 第 index 个桶的上限（包含），与 prometheus 的 le 一致，最后一个桶没有上限
+constexpr int64_t get_socket_histogram_bound(size_t index) { return (int64_t{1} << index) - 1; }
+
 struct socket_trace {
     int64_t read{0};
     int64_t write{0};
     int64_t read_time{0};
     int64_t write_time{0};
     int64_t write_queue{0};
+    // 发送的次数（系统调用的分段数）
+    int64_t write_count{0};
+    // 收到数据的次数
+    int64_t read_count{0};
+    // 监听的 socket 接受的连接数
+    int64_t accept{0};
+    // 监听的 socket 因为超过限制拒绝的连接数
+    int64_t reject{0};
+    // ssl 完整握手和复用会话的握手次数，接受的连接同时累加到监听的 socket 上
+    int64_t handshake{0};
+    int64_t handshake_resumed{0};
+    // 收到的数据交给逻辑线程的延迟，由 network::socket_stats 在逻辑线程中填充
+    socket_histogram read_latency{};
+    int64_t read_latency_sum{0};
+    // 逻辑线程的接收缓冲区整理和扩容时搬移的字节数
+    int64_t read_moved{0};
+    // 每次发送的耗时
+    socket_histogram write_latency{};
+    int64_t write_latency_sum{0};
+
+    [[nodiscard]] constexpr int64_t average_write() const noexcept { return write_count > 0 ? write / write_count : 0; }
+};
+
+// 发送合并策略，只对 tcp 和 ssl 生效
+// delay_us 为 0 时有数据就立即发送
+// 否则最多等待 delay_us 微秒，等待期间待发送的数据达到 bytes 字节就立即发送（bytes 为 0 表示只按时间合并）
+struct socket_write_policy {
+    uint32_t delay_us{0};
+    uint32_t bytes{0};
+};
+
+// 监听 socket 接受连接的限制，为 0 表示不限制
+// rate 是整个监听 socket 每秒接受的连接数，超过时暂停 accept，新连接留在系统的 backlog 里（kcp 直接拒绝）
+// 其他的限制超过时直接断开新连接，并记录到 socket_trace::reject
+struct socket_accept_limit {
+    uint32_t rate{0};
+    // 令牌桶的容量，为 0 时等于 rate
+    uint32_t burst{0};
+    // 同时存在的连接数
+    uint32_t max_connections{0};
+    // 同一个远端地址同时存在的连接数
+    uint32_t max_per_address{0};
+    // 同一个远端地址每秒接受的连接数
+    uint32_t rate_per_address{0};
+    // 同一个远端地址的令牌桶容量，为 0 时等于 rate_per_address
+    uint32_t burst_per_address{0};
+};
+
+// 发送队列的水位，单位字节，为 0 表示不限制
+// 待发送的数据达到 high 时通知不可写，回落到 low 以下时通知可写，超过 max 时直接断开连接
+struct socket_watermark {
+    size_t low{0};
+    size_t high{0};
+    size_t max{0};
+};
+
+// 长度前缀的分帧规则，length_size 为 0 表示不分帧
+// 帧头有 header_size 字节，其中从 length_offset 开始的 length_size 字节（1 到 8）是长度字段
+// 长度字段的值不包含帧头时，帧的总长度是长度加上帧头，max_size 是帧总长度的上限，超过时断开连接，为 0 表示不限制
+struct socket_frame_codec {
+    uint32_t header_size{0};
+    uint32_t length_offset{0};
+    uint32_t length_size{0};
+    bool big_endian{false};
+    bool length_includes_header{false};
+    uint32_t max_size{0};
+};
+
+// kcp 的参数，mtu 是 udp 包的大小（包含 kcp 外层 4 字节的包头）
+// 建立连接时双方取较小的 mtu，双方都开启 mtu_probe 时由客户端探测 (mtu, max_mtu] 之间能通过的最大包，成功后双方都改用新的 mtu
+// 双方都设置了 fec_data 和 fec_parity 时使用 fec，分片数量取双方较小的值
+// 每 fec_data 个包（或者一次 kcp update 输出的所有包）附带 fec_parity 个校验包，组内丢失不超过 fec_parity 个包时不需要重传
+// shards 只对监听有效，大于 0 时连接的协议处理分散到 shards 个独立的线程中，为 0 时都在网络线程中处理
+// legacy_connect 只对监听有效，为 true 时接受老版本客户端不带 cookie 的 connect（比 cookie 版本的包短），
+// 这类 connect 直接创建连接，不受 cookie 保护，所有客户端都升级后可以关闭
+struct kcp_profile {
+    uint32_t mtu{470};
+    uint32_t snd_wnd{256};
+    uint32_t rcv_wnd{256};
+    bool nodelay{true};
+    uint32_t interval{10};
+    uint32_t resend{2};
+    bool nc{true};
+    uint32_t min_rto{10};
+    bool mtu_probe{false};
+    uint32_t max_mtu{1400};
+    uint32_t fec_data{0};
+    uint32_t fec_parity{0};
+    uint32_t shards{0};
+    bool legacy_connect{true};
+
+    // 局域网内服务器之间的连接
+    static constexpr kcp_profile lan() {
+        return {.mtu = 1400, .snd_wnd = 1024, .rcv_wnd = 1024, .interval = 5, .min_rto = 5};
+    }
+
+    // 移动网络的客户端，窗口小一些，重传不那么激进，从较小的包开始探测
+    static constexpr kcp_profile mobile() {
+        return {.snd_wnd = 128, .rcv_wnd = 128, .interval = 20, .min_rto = 30, .mtu_probe = true, .max_mtu = 1200};
+    }
+};
+
+// kcp 监听 socket 每个分片的统计
+struct kcp_shard_stat {
+    uint32_t index{0};
+    int64_t sessions{0};
+    // 分片所在线程使用的 cpu 时间，每秒更新一次
+    int64_t cpu_us{0};
 };
 
 struct socket_stat : socket_trace {
     uint32_t id{0};
+    // 接受这个连接的监听 socket，不是接受的连接时为 0
+    uint32_t listener{0};
     socket_type type{socket_type::tcp_server};
     std::string local;
     std::string remote;
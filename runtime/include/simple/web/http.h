@@ -1,10 +1,12 @@
 ﻿#pragma once
 #include <simple/config.h>
 
+#include <cstddef>
 #include <cstdint>
 #include <simple/containers/buffer.hpp>
 #include <simple/coro/task.hpp>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace simple::http {
@@ -49,6 +51,8 @@ struct reply {
         unauthorized = 401,
         forbidden = 403,
         not_found = 404,
+        method_not_allowed = 405,
+        payload_too_large = 413,
         internal_server_error = 500,
         not_implemented = 501,
         bad_gateway = 502,
@@ -69,6 +73,105 @@ struct reply {
     SIMPLE_API static reply stock(status_t status);
 };
 
+// 零拷贝解析的头部，指向解析时的数据
+struct header_view {
+    std::string_view name;
+    std::string_view value;
+};
+
+// 按名字查找头部，不区分大小写，没有时返回空
+SIMPLE_API std::string_view find_header(const std::vector<header_view>& headers, std::string_view name);
+
+// 是否保持连接，HTTP/1.1 默认保持，HTTP/1.0 需要 Connection: keep-alive
+SIMPLE_API bool keep_alive(int32_t version_major, int32_t version_minor, const std::vector<header_view>& headers);
+
+// 零拷贝解析的请求，read 返回后所有的 string_view 都指向 buffer
+struct request_view {
+    std::string_view method;
+    std::string_view uri;
+    int32_t version_major{0};
+    int32_t version_minor{0};
+    std::vector<header_view> headers;
+    std::string_view content;
+    // 整个请求的数据，chunked 的请求体解码后接在请求头后面
+    memory_buffer_ptr buffer;
+
+    void reset() {
+        method = {};
+        uri = {};
+        version_major = 0;
+        version_minor = 0;
+        headers.clear();
+        content = {};
+        buffer.reset();
+    }
+
+    [[nodiscard]] std::string_view find(std::string_view name) const { return find_header(headers, name); }
+
+    [[nodiscard]] bool keep_alive() const { return http::keep_alive(version_major, version_minor, headers); }
+};
+
+// 零拷贝解析的回应，read 返回后所有的 string_view 都指向 buffer
+struct reply_view {
+    int32_t status{0};
+    std::string_view reason;
+    int32_t version_major{0};
+    int32_t version_minor{0};
+    std::vector<header_view> headers;
+    std::string_view content;
+    memory_buffer_ptr buffer;
+
+    void reset() {
+        status = 0;
+        reason = {};
+        version_major = 0;
+        version_minor = 0;
+        headers.clear();
+        content = {};
+        buffer.reset();
+    }
+
+    [[nodiscard]] std::string_view find(std::string_view name) const { return find_header(headers, name); }
+
+    [[nodiscard]] bool keep_alive() const { return http::keep_alive(version_major, version_minor, headers); }
+};
+
+// 从连续的数据中解析请求行和请求头，string_view 都指向 data，不复制数据
+// 返回请求头的长度（包含结尾的空行），数据还不完整时返回 0，格式错误时返回 -1
+SIMPLE_API ptrdiff_t parse(std::string_view data, request_view& req);
+
+// 解析回应行和回应头，返回值和上面一样
+SIMPLE_API ptrdiff_t parse(std::string_view data, reply_view& rep);
+
+// chunked 消息体的解码器，数据可以分多次输入
+class chunked_decoder {
+  public:
+    // 解码 data 中的数据追加到 out，返回用掉的长度，格式错误时返回 -1
+    // 完成之后剩下的数据属于下一个消息
+    SIMPLE_API ptrdiff_t decode(std::string_view data, memory_buffer& out);
+
+    [[nodiscard]] bool done() const noexcept { return state_ == state::done; }
+
+  private:
+    enum class state : uint8_t { size, extension, size_lf, data, data_cr, data_lf, trailer, trailer_line, trailer_lf, done };
+
+    state state_{state::size};
+    size_t remain_{0};
+    uint8_t digits_{0};
+};
+
+// 一个消息（头和体）默认的最大长度
+inline constexpr size_t max_message_size = 4 * 1024 * 1024;
+
+// 从 socket 读取一个完整的请求，请求体按 Content-Length 或者 chunked 读取，后面的数据留给下一个请求
+// 在收到任何数据之前连接断开时返回 false，格式错误时抛出 std::logic_error，超过 max_size 时抛出 std::length_error
+SIMPLE_API simple::task<bool> read(uint32_t socket, request_view& req, size_t max_size = max_message_size);
+
+// 读取一个完整的回应，没有 Content-Length 也不是 chunked 时读到连接断开为止
+// no_body 为 true 时（HEAD 请求的回应）只读取回应头
+SIMPLE_API simple::task<bool> read(uint32_t socket, reply_view& rep, size_t max_size = max_message_size,
+                                   bool no_body = false);
+
 SIMPLE_API simple::task<> parser(request& req, uint32_t socket);
 
 SIMPLE_API simple::task<> parser(reply& req, uint32_t socket);
@@ -0,0 +1,68 @@
+﻿#pragma once
+#include <simple/config.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <simple/coro/task.hpp>
+#include <simple/web/http.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace simple::http {
+
+struct client_options {
+    // 每个 host:service 最多的连接数
+    size_t max_connections{16};
+    // 每个连接上最多同时等待回应的请求数，为 1 时不使用 pipeline，连接都在忙时才会 pipeline
+    size_t max_pipeline{1};
+    std::chrono::milliseconds connect_timeout{std::chrono::seconds(5)};
+    // 从发出请求到收到完整回应的最长时间
+    std::chrono::milliseconds request_timeout{std::chrono::seconds(30)};
+    // 空闲的连接保留的时间，应该比服务器的空闲超时短
+    std::chrono::milliseconds idle_timeout{std::chrono::seconds(30)};
+    // 一个回应（头和体）的最大长度
+    size_t max_reply_size{max_message_size};
+    // 使用 ssl 连接，verify 和 ignore_cert 和 network::ssl_connect 的参数一样
+    bool ssl{false};
+    std::string verify;
+    bool ignore_cert{true};
+};
+
+struct client_state;
+
+// 基于 network 的 HTTP/1.1 客户端，每个 host:service 一个连接池，连接在请求之间保持
+// 一个连接上 pipeline 的请求按发送的顺序读取回应，一个请求失败时连接会被断开，排在后面的请求也会失败
+class client {
+  public:
+    SIMPLE_API explicit client(const client_options& options = {});
+
+    SIMPLE_NON_COPYABLE(client)
+
+    // 断开所有的连接，还没有完成的请求会失败
+    SIMPLE_API ~client() noexcept;
+
+    // 发送请求并等待完整的回应，Host、Content-Length 和 Connection 由 client 设置
+    // 超时抛出 std::errc::timed_out，调用者被取消时抛出 coro_errors::canceled，这两种情况都会断开使用的连接
+    // 复用的连接在收到回应之前被对端断开时（通常是服务器关闭了空闲的连接），幂等的请求会换一个连接重试一次
+    SIMPLE_API simple::task<reply_view> request(const std::string& host, const std::string& service,
+                                                std::string_view method, std::string_view target,
+                                                const std::vector<header>& headers = {}, std::string_view body = {});
+
+    SIMPLE_API simple::task<reply_view> get(const std::string& host, const std::string& service, std::string_view target);
+
+    SIMPLE_API simple::task<reply_view> post(const std::string& host, const std::string& service, std::string_view target,
+                                             std::string_view content_type, std::string_view body);
+
+    // 断开所有空闲的连接
+    SIMPLE_API void close_idle();
+
+    // 所有连接池中的连接数
+    [[nodiscard]] SIMPLE_API size_t connections() const noexcept;
+
+  private:
+    std::shared_ptr<client_state> state_;
+};
+
+}  // namespace simple::http
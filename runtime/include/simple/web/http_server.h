@@ -0,0 +1,124 @@
+﻿#pragma once
+#include <simple/config.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <simple/coro/task.hpp>
+#include <simple/net/socket_types.h>
+#include <simple/web/http.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace simple::http {
+
+// uri 中的路径，去掉查询和片段
+inline std::string_view uri_path(std::string_view uri) { return uri.substr(0, uri.find_first_of("?#")); }
+
+// uri 中 ? 之后的查询，没有时返回空
+inline std::string_view uri_query(std::string_view uri) {
+    const auto pos = uri.find('?');
+    if (pos == std::string_view::npos) return {};
+    uri.remove_prefix(pos + 1);
+    return uri.substr(0, uri.find('#'));
+}
+
+// 回应一个请求，可以用 send 一次发送，也可以用 begin、write、end 分块流式发送
+// Content-Length、Transfer-Encoding 和 Connection 由 response 设置，处理函数设置的会被替换
+class response {
+  public:
+    SIMPLE_API response(uint32_t socket, const request_view& req);
+
+    SIMPLE_NON_COPYABLE(response)
+
+    ~response() noexcept = default;
+
+    // 发送完整的回应
+    SIMPLE_API void send(reply rep);
+
+    SIMPLE_API void send(reply::status_t status, std::string_view content_type, std::string_view content);
+
+    // 开始流式回应，HTTP/1.1 使用 chunked，HTTP/1.0 写完之后断开连接
+    SIMPLE_API void begin(reply::status_t status, std::vector<header> headers = {});
+
+    // 发送一块数据，空的数据会被忽略，data 不会被修改，可以同时发给多个连接
+    SIMPLE_API void write(std::string_view data);
+
+    SIMPLE_API void write(const memory_buffer_ptr& data);
+
+    // 结束流式回应
+    SIMPLE_API void end();
+
+    // 等待发送队列回落到低水位以下，需要给连接设置水位，连接断开时返回 false
+    SIMPLE_API simple::task<bool> drain() const;
+
+    // 回应之后断开连接
+    void close() noexcept { keep_alive_ = false; }
+
+    [[nodiscard]] uint32_t socket() const noexcept { return socket_; }
+
+    [[nodiscard]] bool keep_alive() const noexcept { return keep_alive_; }
+
+    [[nodiscard]] bool started() const noexcept { return state_ != state::idle; }
+
+    [[nodiscard]] bool finished() const noexcept { return state_ == state::finished; }
+
+  private:
+    enum class state : uint8_t { idle, streaming, finished };
+
+    void prepare(std::vector<header>& headers);
+
+    uint32_t socket_;
+    bool http10_;
+    bool head_;
+    bool keep_alive_;
+    bool chunked_{false};
+    state state_{state::idle};
+};
+
+// 处理函数返回之前要回应，流式回应没有 end 时自动结束，没有回应时回应 500
+using handler = std::function<simple::task<>(const request_view& req, response& res)>;
+
+struct server_options {
+    // 一个请求（头和体）的最大长度，超过时回应 413 并断开
+    size_t max_request_size{max_message_size};
+    // 等待下一个请求（包括接收一个完整的请求）的最长时间，超时后断开
+    std::chrono::milliseconds idle_timeout{std::chrono::seconds(60)};
+    // 是否允许一个连接处理多个请求
+    bool keep_alive{true};
+    // serve(host, port) 时给连接设置的发送队列水位，high 为 0 表示不设置，流式回应用 drain 等待
+    socket_watermark watermark;
+};
+
+struct server_state;
+
+// 基于 network 的 http 服务器，每个连接一个协程，按顺序处理连接上的请求（包括 pipeline 的请求）
+// 路由按方法和路径匹配，路径以 * 结尾时按前缀匹配，精确匹配优先，前缀长的优先
+class server {
+  public:
+    SIMPLE_API explicit server(const server_options& options = {});
+
+    SIMPLE_NON_COPYABLE(server)
+
+    SIMPLE_API ~server() noexcept;
+
+    // method 为空时匹配所有的方法，没有 HEAD 的路由时 HEAD 使用 GET 的路由
+    // 连接的协程共享路由表，开始服务之后不要再添加路由
+    SIMPLE_API void route(std::string method, std::string path, handler h);
+
+    // 监听 host:port 并处理连接
+    SIMPLE_API simple::task<> serve(const std::string& host, uint16_t port);
+
+    // 在已经监听的 socket 上接受连接，监听的 socket 关闭时返回，连接的协程不依赖 server 的生命周期
+    SIMPLE_API simple::task<> serve(uint32_t listen_id);
+
+    // 处理一个已经建立的连接，连接断开时返回
+    SIMPLE_API simple::task<> serve_socket(uint32_t socket) const;
+
+  private:
+    std::shared_ptr<server_state> state_;
+};
+
+}  // namespace simple::http
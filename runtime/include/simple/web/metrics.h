@@ -0,0 +1,17 @@
+﻿#pragma once
+#include <simple/config.h>
+
+#include <simple/coro/task.hpp>
+#include <simple/net/socket_types.h>
+#include <string>
+#include <vector>
+
+namespace simple::metrics {
+
+// 把网络统计转成 prometheus 的文本格式
+SIMPLE_API std::string format_socket_stats(const std::vector<socket_stat>& stats, int64_t write_queue_bytes);
+
+// 在 host:port 上通过 http 提供 /metrics，只应该监听本地地址
+SIMPLE_API simple::task<> serve(const std::string& host, uint16_t port);
+
+}  // namespace simple::metrics
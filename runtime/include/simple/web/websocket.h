@@ -4,6 +4,8 @@
 
 #include <simple/containers/buffer.hpp>
 #include <simple/coro/task.hpp>
+#include <memory>
+#include <vector>
 
 namespace simple {
 
@@ -31,10 +33,37 @@ enum class websocket_opcode : uint8_t {
 
 constexpr bool is_websocket_control(websocket_opcode op) { return static_cast<uint8_t>(op) >= 0x8; }
 
+// 用 4 字节的掩码异或 src 写到 dst，dst 和 src 可以是同一块内存
+// 编译时开启了 avx2 或者 sse2 时按 32 或 16 字节处理，剩下的部分按 8 字节和单字节处理
+SIMPLE_API void websocket_mask_copy(void* dst, const void* src, size_t size, const char (&mask)[4]);
+
+// permessage-deflate 压缩扩展的配置（RFC 7692），客户端在握手时请求，服务器同意后双方都按消息压缩
+struct websocket_deflate_options {
+    bool enable{false};
+    // 服务器压缩使用的窗口大小，9-15
+    uint8_t server_max_window_bits{15};
+    // 客户端压缩使用的窗口大小，9-15
+    uint8_t client_max_window_bits{15};
+    // 每个消息压缩完后重置压缩的上下文，每个连接占用的内存少一些，压缩率会降低
+    bool server_no_context_takeover{false};
+    bool client_no_context_takeover{false};
+    // 小于这个长度的消息不压缩
+    size_t threshold{256};
+    // 压缩等级，1-9
+    int level{6};
+    // 解压后的消息的最大长度
+    size_t max_message_size{64 * 1024 * 1024};
+};
+
+class websocket_deflate;
+
 class websocket {
   public:
     SIMPLE_API websocket(websocket_type tp, uint32_t socket);
 
+    // 开启 permessage-deflate，握手时协商，配置不合法时抛出 std::logic_error
+    SIMPLE_API websocket(websocket_type tp, uint32_t socket, const websocket_deflate_options& deflate);
+
     SIMPLE_COPYABLE_DEFAULT(websocket)
 
     ~websocket() noexcept = default;
@@ -54,17 +83,30 @@ class websocket {
     // 握手成功后发送websocket消息, 将要发送的消息拆分成多个帧，payload_max 为单帧最大的消息长度
     SIMPLE_API void write(websocket_opcode op, const void* data, size_t size, size_t payload_max) const;
 
+    // 发送共享的消息，帧头单独生成，和 payload 聚合发送，payload 不会被复制和修改，可以同时发给多个连接
+    // 客户端的帧需要掩码，或者消息需要压缩时，按上面的方式复制发送
+    SIMPLE_API void write(websocket_opcode op, const memory_buffer_ptr& payload) const;
+
+    // 把同一个消息发给多个服务器一端的连接，所有的连接共享一个帧头和 payload，不压缩
+    SIMPLE_API static void broadcast(std::vector<uint32_t> sockets, websocket_opcode op, const memory_buffer_ptr& payload);
+
+    // 握手时是否协商了 permessage-deflate
+    [[nodiscard]] SIMPLE_API bool compressed() const noexcept;
+
     auto& socket() noexcept { return socket_; }
 
     [[nodiscard]] auto& socket() const noexcept { return socket_; }
 
   private:
-    void encode_header(memory_buffer& buf, websocket_opcode op, size_t size, bool fin) const;
+    static void encode_header(memory_buffer& buf, websocket_type tp, websocket_opcode op, size_t size, bool fin,
+                              bool compressed);
 
     void encode_body(memory_buffer& buf, const void* data, size_t size) const;
 
     websocket_type tp_;
     uint32_t socket_;
+    // 复制的对象属于同一个连接，共享压缩的上下文
+    std::shared_ptr<websocket_deflate> deflate_;
 };
 
 }  // namespace simple
@@ -1,6 +1,7 @@
 ﻿#include <fmt/format.h>
 #include <simple/coro/cancellation_registration.h>
 #include <simple/coro/cancellation_token.h>
+#include <simple/coro/condition_variable.h>
 #include <simple/coro/network.h>
 #include <simple/coro/scheduler.h>
 #include <simple/error.h>
@@ -10,6 +11,7 @@
 #include <deque>
 #include <optional>
 #include <simple/containers/buffer.hpp>
+#include <string_view>
 
 namespace simple {
 
@@ -17,12 +19,48 @@ struct network_data {
     uint32_t id{0};
     std::error_code ec;
     memory_buffer buf;
+    // 网络线程分好的帧
+    std::deque<memory_buffer> frames;
     std::deque<uint32_t> accepted;
     std::coroutine_handle<> handle;
     std::string local;
     std::string remote;
+    bool writable{true};
+    socket_histogram read_latency{};
+    int64_t read_latency_sum{0};
+    int64_t read_moved{0};
+    // frames 中的字节数
+    size_t frame_bytes{0};
+    size_t read_limit{0};
+    condition_variable writable_cv;
+    network::writable_callback writable_callback;
+    // network_read_awaiter 等待的条件，满足之前收到数据不唤醒协程
+    size_t wait_size{0};
+    std::string_view wait_end;
+    // 已经查找过没有 wait_end 的长度，找到时是到 wait_end 结尾的长度
+    size_t wait_searched{0};
+    size_t wait_found{0};
 };
 
+// 没有设置等待条件时总是满足
+static bool read_satisfied(network_data& data) {
+    if (data.wait_end.empty()) {
+        return data.buf.readable() >= data.wait_size;
+    }
+
+    const auto strv = std::string_view(data.buf);
+    if (const auto pos = strv.find(data.wait_end, data.wait_searched); pos != std::string_view::npos) {
+        data.wait_found = pos + data.wait_end.size();
+        return true;
+    }
+
+    // 下次只查找新收到的数据
+    if (strv.size() >= data.wait_end.size()) {
+        data.wait_searched = strv.size() - data.wait_end.size() + 1;
+    }
+    return false;
+}
+
 class network_awaiter {
   public:
     explicit network_awaiter(network_data_ptr s) : socket_(std::move(s)) {}
@@ -88,6 +126,73 @@ class network_awaiter {
     std::optional<cancellation_registration> registration_;
 };
 
+bool network_read_awaiter::await_ready() const noexcept {
+    // 其他协程正在等待时在 await_resume 中报错
+    if (!data_ || data_->handle) {
+        return true;
+    }
+
+    data_->wait_size = size_;
+    data_->wait_end = end_;
+    data_->wait_searched = 0;
+    data_->wait_found = 0;
+    return data_->ec || read_satisfied(*data_);
+}
+
+bool network_read_awaiter::suspend() {
+    if (data_->handle || token_.is_cancellation_requested()) {
+        return false;
+    }
+
+    if (token_.can_be_cancelled()) {
+        registration_.emplace(token_, [this]() {
+            network::instance().remove_socket(data_->id);
+            scheduler::instance().wake_up_coroutine(handle_);
+        });
+    }
+
+    data_->handle = handle_;
+    return true;
+}
+
+size_t network_read_awaiter::await_resume() {
+    static const std::error_code eof = asio::error::eof;
+
+    registration_.reset();
+    if (!data_) return 0;
+
+    if (data_->handle && data_->handle != handle_) {
+        throw std::system_error(coro_errors::invalid_action);
+    }
+
+    data_->handle = nullptr;
+    const auto satisfied = read_satisfied(*data_);
+    data_->wait_size = 0;
+    data_->wait_end = {};
+
+    if (token_.is_cancellation_requested()) {
+        throw std::system_error(coro_errors::canceled);
+    }
+
+    if (satisfied) {
+        return end_.empty() ? data_->buf.readable() : data_->wait_found;
+    }
+
+    if (data_->ec && data_->ec != eof) {
+        throw std::system_error(data_->ec);
+    }
+
+    return 0;
+}
+
+std::string_view network_reader::peek() const noexcept { return data_ ? std::string_view(data_->buf) : std::string_view{}; }
+
+void network_reader::consume(size_t len) noexcept {
+    if (data_) {
+        data_->buf.read(len);
+    }
+}
+
 network& network::instance() {
     static network ins;
     return ins;
@@ -127,35 +232,38 @@ task<uint32_t> network::tcp_listen(const std::string& host, uint16_t port, bool
 }
 
 task<uint32_t> network::ssl_listen(const std::string& host, uint16_t port, bool reuse, const std::string& cert,
-                                   const std::string& key, const std::string& dh, const std::string& password) {
-    const auto id = socket_system::instance().ssl_listen(host, port, reuse, cert, key, dh, password);
+                                   const std::string& key, const std::string& dh, const std::string& password,
+                                   uint32_t workers) {
+    const auto id = socket_system::instance().ssl_listen(host, port, reuse, cert, key, dh, password, workers);
     co_await create_start_awaiter(id, host, port);
     co_return id;
 }
 
-task<uint32_t> network::kcp_listen(const std::string& host, uint16_t port, bool reuse) {
-    const auto id = socket_system::instance().kcp_listen(host, port, reuse);
+task<uint32_t> network::kcp_listen(const std::string& host, uint16_t port, bool reuse, const kcp_profile& profile) {
+    const auto id = socket_system::instance().kcp_listen(host, port, reuse, profile);
     co_await create_start_awaiter(id, host, port);
     co_return id;
 }
 
 task<uint32_t> network::tcp_connect(const std::string& host, const std::string& service,
-                                    const std::chrono::milliseconds& timeout) {
-    const auto id = socket_system::instance().tcp_connect(host, service, timeout);
+                                    const std::chrono::milliseconds& timeout, const socket_frame_codec& codec) {
+    const auto id = socket_system::instance().tcp_connect(host, service, timeout, codec);
     co_await create_start_awaiter(id, host, service);
     co_return id;
 }
 
 task<uint32_t> network::ssl_connect(const std::string& host, const std::string& service,
-                                    const std::chrono::milliseconds& timeout, const std::string& verify, bool ignore_cert) {
-    const auto id = socket_system::instance().ssl_connect(host, service, timeout, verify, ignore_cert);
+                                    const std::chrono::milliseconds& timeout, const std::string& verify, bool ignore_cert,
+                                    const socket_frame_codec& codec) {
+    const auto id = socket_system::instance().ssl_connect(host, service, timeout, verify, ignore_cert, codec);
     co_await create_start_awaiter(id, host, service);
     co_return id;
 }
 
 task<uint32_t> network::kcp_connect(const std::string& host, const std::string& service,
-                                    const std::chrono::milliseconds& timeout) {
-    const auto id = socket_system::instance().kcp_connect(host, service, timeout);
+                                    const std::chrono::milliseconds& timeout, const kcp_profile& profile,
+                                    const socket_frame_codec& codec) {
+    const auto id = socket_system::instance().kcp_connect(host, service, timeout, profile, codec);
     co_await create_start_awaiter(id, host, service);
     co_return id;
 }
@@ -187,7 +295,7 @@ task<uint32_t> network::accept(uint32_t listen_id) {
     co_return accepted;
 }
 
-task<size_t> network::read(uint32_t socket_id, void* buf, size_t size) {
+network_reader network::reader(uint32_t socket_id) {
     if (get_socket_class(socket_id) == socket_class::server) {
         throw std::system_error(coro_errors::invalid_action);
     }
@@ -197,42 +305,30 @@ task<size_t> network::read(uint32_t socket_id, void* buf, size_t size) {
         throw std::system_error(coro_errors::invalid_action);
     }
 
-    const auto ptr = it->second;
-    if (ptr->buf.readable() == 0) {
-        co_await network_awaiter(ptr);
-        if (ptr->ec) {
-            co_return 0;
-        }
+    return network_reader(it->second);
+}
+
+task<size_t> network::read(uint32_t socket_id, void* buf, size_t size) {
+    auto stream = reader(socket_id);
+    const auto readable = co_await stream.wait(1);
+    if (readable == 0) {
+        co_return 0;
     }
 
-    auto len = std::min(ptr->buf.readable(), size);
-    memcpy(buf, ptr->buf.begin_read(), len);
-    ptr->buf.read(len);
+    const auto len = std::min(readable, size);
+    memcpy(buf, stream.peek().data(), len);
+    stream.consume(len);
     co_return len;
 }
 
 task<size_t> network::read_size(uint32_t socket_id, void* buf, size_t size) {
-    if (get_socket_class(socket_id) == socket_class::server) {
-        throw std::system_error(coro_errors::invalid_action);
-    }
-
-    const auto it = sockets_.find(socket_id);
-    if (it == sockets_.end()) {
-        throw std::system_error(coro_errors::invalid_action);
-    }
-
-    const auto ptr = it->second;
-    auto readable = ptr->buf.readable();
-    while (readable < size) {
-        co_await network_awaiter(ptr);
-        if (ptr->ec) {
-            co_return 0;
-        }
-        readable = ptr->buf.readable();
+    auto stream = reader(socket_id);
+    if (co_await stream.wait(size) == 0) {
+        co_return 0;
     }
 
-    memcpy(buf, ptr->buf.begin_read(), size);
-    ptr->buf.read(size);
+    memcpy(buf, stream.peek().data(), size);
+    stream.consume(size);
     co_return size;
 }
 
@@ -250,6 +346,18 @@ task<size_t> network::read_until(uint32_t socket_id, std::string_view end, memor
         throw std::system_error(coro_errors::invalid_action);
     }
 
+    auto stream = reader(socket_id);
+    const auto len = co_await stream.wait_until(end);
+    if (len == 0) {
+        co_return 0;
+    }
+
+    buf.append(stream.peek().data(), len);
+    stream.consume(len);
+    co_return buf.readable();
+}
+
+task<memory_buffer_ptr> network::read_frame(uint32_t socket_id) {
     if (get_socket_class(socket_id) == socket_class::server) {
         throw std::system_error(coro_errors::invalid_action);
     }
@@ -260,35 +368,32 @@ task<size_t> network::read_until(uint32_t socket_id, std::string_view end, memor
     }
 
     const auto ptr = it->second;
-    const auto end_size = end.size();
-
-    for (;;) {
-        auto strv = std::string_view(ptr->buf);
-        if (const auto pos = strv.find(end); pos != std::string_view::npos) {
-            const auto len = pos + end_size;
-            buf.append(strv.data(), len);
-            ptr->buf.read(len);
-            break;
-        }
-
-        if (strv.size() >= end_size) {
-            const auto len = strv.size() - end_size + 1;
-            buf.append(strv.data(), len);
-            ptr->buf.read(len);
-        }
-
+    while (ptr->frames.empty()) {
         co_await network_awaiter(ptr);
         if (ptr->ec) {
-            co_return 0;
+            co_return memory_buffer_ptr{};
         }
     }
 
-    co_return buf.readable();
+    auto result = std::make_shared<memory_buffer>(std::move(ptr->frames.front()));
+    ptr->frames.pop_front();
+    ptr->frame_bytes -= result->readable();
+    co_return result;
 }
 
 // ReSharper disable once CppMemberFunctionMayBeStatic
 void network::write(uint32_t socket_id, const memory_buffer_ptr& buf) { socket_system::instance().send(socket_id, buf); }
 
+// ReSharper disable once CppMemberFunctionMayBeStatic
+void network::write(uint32_t socket_id, std::vector<memory_buffer_ptr> bufs) {
+    socket_system::instance().send(socket_id, std::move(bufs));
+}
+
+// ReSharper disable once CppMemberFunctionMayBeStatic
+void network::broadcast(std::vector<uint32_t> socket_ids, std::vector<memory_buffer_ptr> bufs) {
+    socket_system::instance().send(std::move(socket_ids), std::move(bufs));
+}
+
 void network::close(uint32_t socket_id) {
     socket_system::instance().close(socket_id);
     hand_stop(socket_id, socket_errors::initiative_disconnect);
@@ -297,6 +402,76 @@ void network::close(uint32_t socket_id) {
 // ReSharper disable once CppMemberFunctionMayBeStatic
 void network::no_delay(uint32_t socket_id, bool on) { socket_system::instance().no_delay(socket_id, on); }
 
+void network::write_policy(uint32_t socket_id, const socket_write_policy& policy) {
+    socket_system::instance().write_policy(socket_id, policy);
+}
+
+void network::read_limit(uint32_t socket_id, size_t bytes) {
+    if (const auto it = sockets_.find(socket_id); it != sockets_.end()) {
+        it->second->read_limit = bytes;
+    }
+}
+
+// ReSharper disable once CppMemberFunctionMayBeStatic
+void network::frame_codec(uint32_t socket_id, const socket_frame_codec& codec) {
+    socket_system::instance().frame_codec(socket_id, codec);
+}
+
+void network::watermark(uint32_t socket_id, const socket_watermark& watermark, writable_callback callback) {
+    if (const auto it = sockets_.find(socket_id); it != sockets_.end()) {
+        it->second->writable_callback = std::move(callback);
+    }
+
+    socket_system::instance().watermark(socket_id, watermark);
+}
+
+// ReSharper disable once CppMemberFunctionMayBeStatic
+void network::accept_limit(uint32_t listen_id, const socket_accept_limit& limit) {
+    socket_system::instance().accept_limit(listen_id, limit);
+}
+
+task<bool> network::wait_writable(uint32_t socket_id) {
+    if (get_socket_class(socket_id) == socket_class::server) {
+        throw std::system_error(coro_errors::invalid_action);
+    }
+
+    const auto it = sockets_.find(socket_id);
+    if (it == sockets_.end()) {
+        throw std::system_error(coro_errors::invalid_action);
+    }
+
+    const auto ptr = it->second;
+    while (!ptr->writable && !ptr->ec) {
+        co_await ptr->writable_cv.wait();
+    }
+
+    co_return !ptr->ec;
+}
+
+// ReSharper disable once CppMemberFunctionMayBeStatic
+int64_t network::write_queue_bytes() { return socket_system::instance().write_queue_bytes(); }
+
+std::vector<socket_stat> network::socket_stats() {
+    auto stats = socket_system::instance().socket_stats();
+    for (auto& stat : stats) {
+        if (const auto it = sockets_.find(stat.id); it != sockets_.end()) {
+            const auto& ptr = it->second;
+            stat.local = ptr->local;
+            stat.remote = ptr->remote;
+            stat.read_latency = ptr->read_latency;
+            stat.read_latency_sum = ptr->read_latency_sum;
+            stat.read_moved = ptr->read_moved;
+        }
+    }
+
+    return stats;
+}
+
+// ReSharper disable once CppMemberFunctionMayBeStatic
+std::vector<kcp_shard_stat> network::kcp_shard_stats(uint32_t socket_id) {
+    return socket_system::instance().kcp_shard_stats(socket_id);
+}
+
 std::string network::local_address(uint32_t socket_id) {
     if (const auto it = sockets_.find(socket_id); it != sockets_.end()) {
         return it->second->local;
@@ -330,8 +505,22 @@ void network::init() {
         return scheduler.post([this, socket_id, ec] { return hand_stop(socket_id, ec); });
     });
 
-    system.register_read_handle([this, &scheduler](uint32_t socket_id, const uint8_t* data, size_t len) {
-        return scheduler.post([this, socket_id, buf = memory_buffer(data, len)] { return hand_read(socket_id, buf); });
+    system.register_read_handle([this, &scheduler](uint32_t socket_id, memory_buffer&& data) {
+        return scheduler.post(
+            [this, socket_id, buf = std::move(data), time = std::chrono::steady_clock::now()]() mutable {
+                return hand_read(socket_id, buf, time);
+            });
+    });
+
+    system.register_frame_handle([this, &scheduler](uint32_t socket_id, memory_buffer&& frame) {
+        return scheduler.post(
+            [this, socket_id, buf = std::move(frame), time = std::chrono::steady_clock::now()]() mutable {
+                return hand_frame(socket_id, buf, time);
+            });
+    });
+
+    system.register_writable_handle([this, &scheduler](uint32_t socket_id, bool writable) {
+        return scheduler.post([this, socket_id, writable] { return hand_writable(socket_id, writable); });
     });
 }
 
@@ -356,24 +545,84 @@ void network::hand_stop(uint32_t socket_id, const std::error_code& ec) {
     const auto ptr = std::move(it->second);
     sockets_.erase(it);
     ptr->ec = ec;
+    ptr->writable_cv.notify_all();
     if (ptr->handle) {
         ptr->handle.resume();
     }
 }
 
-void network::hand_read(uint32_t socket_id, const memory_buffer& data) {
+static void record_read_latency(network_data& data, std::chrono::steady_clock::time_point time) {
+    const auto latency = std::chrono::steady_clock::now() - time;
+    const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    ++data.read_latency[get_socket_histogram_index(micros)];
+    data.read_latency_sum += micros;
+}
+
+// 未读的数据加上 size 字节是否超过上限
+static bool read_overflow(const network_data& data, size_t size) {
+    return data.read_limit > 0 && data.buf.readable() + data.frame_bytes + size > data.read_limit;
+}
+
+// 追加到接收缓冲区，空间不够时只有已读的部分不少于未读的部分才整理到头部，否则直接扩容
+// 每次整理搬移的字节数不超过上次整理之后读走的字节数，扩容按倍数增长，每个字节均摊只搬移常数次
+static void append_read(network_data& data, memory_buffer& input) {
+    auto& buf = data.buf;
+    if (buf.readable() == 0) {
+        if (input.capacity() >= buf.capacity()) {
+            // 没有未读的数据时直接接管网络线程中申请的缓冲区，大的消息不需要再复制一次
+            buf = std::move(input);
+            return;
+        }
+        buf.clear();
+    }
+
+    const auto len = input.readable();
+    if (buf.writable() < len && buf.prependable() >= buf.readable()) {
+        data.read_moved += static_cast<int64_t>(buf.readable());
+        buf.shrink();
+    }
+    if (buf.writable() < len) {
+        // 扩容会复制已读和未读的部分
+        data.read_moved += static_cast<int64_t>(buf.prependable() + buf.readable());
+        buf.make_sure_writable(len);
+    }
+    buf.append(input.begin_read(), len);
+}
+
+void network::hand_read(uint32_t socket_id, memory_buffer& data, std::chrono::steady_clock::time_point time) {
     const auto it = sockets_.find(socket_id);
     if (it == sockets_.end()) {
         return;
     }
 
-    if (it->second->buf.prependable() >= it->second->buf.capacity() / 4) {
-        // 如果已读的长度超过4分之1则进行收缩
-        it->second->buf.shrink();
+    record_read_latency(*it->second, time);
+    if (read_overflow(*it->second, data.readable())) {
+        // 逻辑线程处理不过来，断开连接，等待的协程收到 read_buffer_overflow
+        socket_system::instance().close(socket_id);
+        return hand_stop(socket_id, socket_errors::read_buffer_overflow);
     }
 
-    it->second->buf.append(data.begin_read(), data.readable());
-    if (it->second->handle) {
+    append_read(*it->second, data);
+    if (it->second->handle && read_satisfied(*it->second)) {
+        it->second->handle.resume();
+    }
+}
+
+void network::hand_frame(uint32_t socket_id, memory_buffer& frame, std::chrono::steady_clock::time_point time) {
+    const auto it = sockets_.find(socket_id);
+    if (it == sockets_.end()) {
+        return;
+    }
+
+    record_read_latency(*it->second, time);
+    if (read_overflow(*it->second, frame.readable())) {
+        socket_system::instance().close(socket_id);
+        return hand_stop(socket_id, socket_errors::read_buffer_overflow);
+    }
+
+    it->second->frame_bytes += frame.readable();
+    it->second->frames.emplace_back(std::move(frame));
+    if (it->second->handle && read_satisfied(*it->second)) {
         it->second->handle.resume();
     }
 }
@@ -389,6 +638,9 @@ void network::hand_accept(uint32_t socket_id, uint32_t accepted, const std::stri
     ptr->id = accepted;
     ptr->local = local;
     ptr->remote = remote;
+    // 监听上设置的水位回调也应用到接受的连接上
+    ptr->writable_callback = it->second->writable_callback;
+    ptr->read_limit = it->second->read_limit;
     sockets_.emplace(accepted, std::move(ptr));
 
     it->second->accepted.emplace_back(accepted);
@@ -397,4 +649,21 @@ void network::hand_accept(uint32_t socket_id, uint32_t accepted, const std::stri
     }
 }
 
+void network::hand_writable(uint32_t socket_id, bool writable) {
+    const auto it = sockets_.find(socket_id);
+    if (it == sockets_.end()) {
+        return;
+    }
+
+    const auto ptr = it->second;
+    ptr->writable = writable;
+    if (writable) {
+        ptr->writable_cv.notify_all();
+    }
+
+    if (ptr->writable_callback) {
+        ptr->writable_callback(socket_id, writable);
+    }
+}
+
 }  // namespace simple
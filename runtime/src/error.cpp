@@ -18,6 +18,12 @@ class socket_category final : public std::error_category {
                 return "kcp protocol error";
             case socket_errors::initiative_disconnect:
                 return "application initiative to disconnect";
+            case socket_errors::write_queue_overflow:
+                return "socket write queue overflow";
+            case socket_errors::frame_too_large:
+                return "socket frame too large";
+            case socket_errors::read_buffer_overflow:
+                return "socket read buffer overflow";
             default:  // NOLINT(clang-diagnostic-covered-switch-default)
                 return "simple.socket error";
         }
@@ -0,0 +1,132 @@
+﻿#include "accept_limiter.h"
+
+#include <algorithm>
+#include <functional>
+#include <string_view>
+
+namespace simple {
+
+size_t accept_limiter::address_hash::operator()(const address& addr) const noexcept {
+    if (addr.is_v4()) {
+        return std::hash<uint32_t>{}(addr.to_v4().to_uint());
+    }
+
+    const auto bytes = addr.to_v6().to_bytes();
+    return std::hash<std::string_view>{}(std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size()));
+}
+
+accept_limiter::accept_limiter(const socket_accept_limit& limit) : limit_(limit) {
+    bucket_.tokens = static_cast<double>(burst());
+    bucket_.last = clock_type::now();
+}
+
+void accept_limiter::limit(const socket_accept_limit& limit) {
+    std::scoped_lock lock(mutex_);
+    limit_ = limit;
+    bucket_.tokens = (std::min)(bucket_.tokens, static_cast<double>(burst()));
+}
+
+void accept_limiter::bucket::refill(uint32_t rate, uint32_t burst, clock_type::time_point now) {
+    const std::chrono::duration<double> elapsed = now - last;
+    last = now;
+    tokens = (std::min)(tokens + elapsed.count() * rate, static_cast<double>(burst));
+}
+
+accept_limiter::clock_type::duration accept_limiter::throttle() {
+    std::scoped_lock lock(mutex_);
+    if (limit_.rate == 0) {
+        return clock_type::duration::zero();
+    }
+
+    bucket_.refill(limit_.rate, burst(), clock_type::now());
+    if (bucket_.tokens >= 1.0) {
+        bucket_.tokens -= 1.0;
+        return clock_type::duration::zero();
+    }
+
+    // 等到攒够一个令牌
+    const std::chrono::duration<double> wait((1.0 - bucket_.tokens) / limit_.rate);
+    return (std::max)(std::chrono::duration_cast<clock_type::duration>(wait), clock_type::duration(1));
+}
+
+bool accept_limiter::acquire(const address& addr) {
+    std::scoped_lock lock(mutex_);
+    if (limit_.max_connections > 0 && connections_ >= limit_.max_connections) {
+        return false;
+    }
+
+    if (limit_.max_per_address == 0 && limit_.rate_per_address == 0) {
+        ++connections_;
+        return true;
+    }
+
+    const auto now = clock_type::now();
+    auto [it, inserted] = addresses_.try_emplace(addr);
+    auto& entry = it->second;
+    if (inserted) {
+        entry.tokens.tokens = static_cast<double>(burst_per_address());
+        entry.tokens.last = now;
+    }
+
+    if (limit_.max_per_address > 0 && entry.connections >= limit_.max_per_address) {
+        return false;
+    }
+
+    if (limit_.rate_per_address > 0) {
+        entry.tokens.refill(limit_.rate_per_address, burst_per_address(), now);
+        if (entry.tokens.tokens < 1.0) {
+            return false;
+        }
+        entry.tokens.tokens -= 1.0;
+    }
+
+    ++entry.connections;
+    ++connections_;
+
+    if (addresses_.size() >= sweep_size_) {
+        sweep(now);
+    }
+
+    return true;
+}
+
+void accept_limiter::release(const address& addr) {
+    std::scoped_lock lock(mutex_);
+    if (connections_ > 0) {
+        --connections_;
+    }
+
+    const auto it = addresses_.find(addr);
+    if (it == addresses_.end()) {
+        return;
+    }
+
+    if (it->second.connections > 0) {
+        --it->second.connections;
+    }
+
+    if (it->second.connections == 0 && limit_.rate_per_address == 0) {
+        addresses_.erase(it);
+    }
+}
+
+void accept_limiter::sweep(clock_type::time_point now) {
+    const auto rate = limit_.rate_per_address;
+    const auto burst = burst_per_address();
+    for (auto it = addresses_.begin(); it != addresses_.end();) {
+        auto& entry = it->second;
+        if (entry.connections == 0) {
+            entry.tokens.refill(rate, burst, now);
+            if (entry.tokens.full(burst)) {
+                it = addresses_.erase(it);
+                continue;
+            }
+        }
+        ++it;
+    }
+
+    // 清理之后还很多，说明活跃的地址本来就多，放宽下一次清理的时机
+    sweep_size_ = (std::max)(sweep_size_, addresses_.size() * 2);
+}
+
+}  // namespace simple
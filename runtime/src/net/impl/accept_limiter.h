@@ -0,0 +1,71 @@
+﻿#pragma once
+#include <simple/config.h>
+#include <simple/net/socket_types.h>
+
+#include <asio/ip/address.hpp>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+
+namespace simple {
+
+// 监听 socket 接受连接的限制，在网络线程中使用
+class accept_limiter {
+  public:
+    using clock_type = std::chrono::steady_clock;
+    using address = asio::ip::address;
+
+    explicit accept_limiter(const socket_accept_limit& limit);
+
+    SIMPLE_NON_COPYABLE(accept_limiter)
+
+    ~accept_limiter() noexcept = default;
+
+    void limit(const socket_accept_limit& limit);
+
+    // 监听 socket 的令牌桶，返回还需要等多久才能接受下一个连接，为 0 时已经拿到令牌
+    clock_type::duration throttle();
+
+    // 检查连接总数和远端地址的限制，通过时占用一个连接数
+    bool acquire(const address& addr);
+
+    // 连接断开时归还占用的连接数
+    void release(const address& addr);
+
+  private:
+    struct bucket {
+        double tokens{0};
+        clock_type::time_point last;
+
+        void refill(uint32_t rate, uint32_t burst, clock_type::time_point now);
+
+        [[nodiscard]] bool full(uint32_t burst) const noexcept { return tokens >= static_cast<double>(burst); }
+    };
+
+    struct address_hash {
+        size_t operator()(const address& addr) const noexcept;
+    };
+
+    struct address_entry {
+        uint32_t connections{0};
+        bucket tokens;
+    };
+
+    [[nodiscard]] uint32_t burst() const noexcept { return limit_.burst > 0 ? limit_.burst : limit_.rate; }
+
+    [[nodiscard]] uint32_t burst_per_address() const noexcept {
+        return limit_.burst_per_address > 0 ? limit_.burst_per_address : limit_.rate_per_address;
+    }
+
+    // 清理已经没有连接、令牌也恢复满了的地址
+    void sweep(clock_type::time_point now);
+
+    std::mutex mutex_;
+    socket_accept_limit limit_;
+    bucket bucket_;
+    uint32_t connections_{0};
+    std::unordered_map<address, address_entry, address_hash> addresses_;
+    size_t sweep_size_{1024};
+};
+
+}  // namespace simple
@@ -7,18 +7,35 @@
 #include <asio/connect.hpp>
 #include <asio/detached.hpp>
 #include <asio/experimental/awaitable_operators.hpp>
+#include <asio/post.hpp>
 
 #include "kcp_config.h"
 
 namespace simple {
 
-kcp_client_impl::kcp_client_impl(uint32_t socket_id)  // NOLINT(cppcoreguidelines-pro-type-member-init)
+// 所有的 kcp client 共用一个 kcp update 驱动，没有 client 时释放
+static std::shared_ptr<kcp_driver> client_driver() {
+    static std::weak_ptr<kcp_driver> driver;
+    auto ptr = driver.lock();
+    if (!ptr) {
+        ptr = std::make_shared<kcp_driver>(socket_system::instance().context().get_executor());
+        driver = ptr;
+    }
+    return ptr;
+}
+
+kcp_client_impl::kcp_client_impl(uint32_t socket_id, const kcp_profile& profile)  // NOLINT
     : socket_base(socket_id),
+      profile_(kcp_check_profile(profile)),
       socket_(socket_system::instance().context()),
-      kcp_update_(socket_.get_executor()),
+      batch_(kcp_client_batch_size, profile_.max_mtu),
+      probe_timer_(socket_.get_executor()),
       deadline_(socket_.get_executor()) {}
 
 kcp_client_impl::~kcp_client_impl() noexcept {
+    if (driver_) {
+        driver_->remove(update_node_);
+    }
     if (kcp_) {
         ikcp_release(kcp_);
     }
@@ -44,11 +61,19 @@ void kcp_client_impl::stop(const std::error_code& ec) {
     if (state_ == state::closed) return;
     info("kcp client {} stop", socket_id_);
     state_ = state::closed;
+    // 关闭之前把 disconnect 等控制包发出去
+    if (socket_.is_open()) {
+        batch_.send(socket_);
+    }
     std::error_code ignore;
     socket_.close(ignore);
 
+    if (driver_) {
+        driver_->remove(update_node_);
+    }
+
     try {
-        kcp_update_.cancel();
+        probe_timer_.cancel();
         deadline_.cancel();
     } catch (...) {
     }
@@ -65,19 +90,20 @@ void kcp_client_impl::write(const memory_buffer_ptr& ptr) {
     }
 
     if (write_base(ptr)) {
-        force_update_ = true;
+        driver_->wake(update_node_);
     }
 }
 
 void kcp_client_impl::no_delay(bool on) {
     if (kcp_) {
-        kcp_no_delay(kcp_, on);
+        kcp_no_delay(kcp_, profile_, on);
     }
 }
 
 constexpr kcp_client_impl::asio_token use_awaitable_as_tuple;
 
 asio::awaitable<void> kcp_client_impl::co_connect(const std::string& host, const std::string& service) {
+    using namespace asio::experimental::awaitable_operators;
     using udp_resolver = asio_token::as_default_on_t<udp::resolver>;
     auto& system = socket_system::instance();
     auto& context = system.context();
@@ -99,24 +125,57 @@ asio::awaitable<void> kcp_client_impl::co_connect(const std::string& host, const
     }
 
     info("kcp client {} udp connect", socket_id_);
-
-    // 发送connect
-    auto msg = make_kcp_ctrl(kcp_code::connect, 0);
-    std::tie(ec, std::ignore) = co_await socket_.async_send(asio::buffer(msg.data(), msg.size()), use_awaitable_as_tuple);
+    socket_.non_blocking(true, ec);
     if (ec) {
         stop(ec);
         co_return;
     }
 
+    // 发送connect，带上期望的包大小和 fec 参数
+    const kcp_connect_option option{profile_.mtu, profile_.max_mtu, profile_.fec_data, profile_.fec_parity};
+    auto msg = make_kcp_connect(kcp_code::connect, 0, option);
+    uint64_t cookie = 0;
     info("kcp client {} kcp connect", socket_id_);
 
-    // 接收connect ack
+    // 接收connect ack，udp 会丢包，没有回复时重发，直到 co_timeout 结束连接
     uint8_t data[udp_mtu];
     size_t len;
-    std::tie(ec, len) = co_await socket_.async_receive(asio::buffer(data), use_awaitable_as_tuple);
-    if (ec) {
-        stop(ec);
-        co_return;
+    for (bool resend = true;;) {
+        if (resend) {
+            std::tie(ec, std::ignore) =
+                co_await socket_.async_send(asio::buffer(msg.data(), msg.size()), use_awaitable_as_tuple);
+            if (ec) {
+                stop(ec);
+                co_return;
+            }
+        }
+
+        probe_timer_.expires_after(kcp_connect_resend);
+        auto result = co_await (socket_.async_receive(asio::buffer(data), use_awaitable_as_tuple) ||
+                                probe_timer_.async_wait());
+        if (state_ == state::closed) {
+            co_return;
+        }
+        if (result.index() == 1) {
+            resend = true;
+            continue;
+        }
+
+        std::tie(ec, len) = std::get<0>(result);
+        if (ec) {
+            stop(ec);
+            co_return;
+        }
+
+        // 服务器要求带上 cookie 重新发送 connect，重发的 connect 可能收到重复的 cookie，不用再发
+        if (len >= kcp_head_size && reinterpret_cast<kcp_head*>(data)->code == kcp_code::connect_cookie) {
+            const auto value = read_kcp_connect_cookie(data, len);
+            resend = value != cookie;
+            cookie = value;
+            msg = make_kcp_connect(kcp_code::connect, 0, option, cookie);
+            continue;
+        }
+        break;
     }
 
     if (const auto* head = reinterpret_cast<kcp_head*>(data); head->magic1 != kcp_magic1 || head->magic2 != kcp_magic2 ||
@@ -136,14 +195,36 @@ asio::awaitable<void> kcp_client_impl::co_connect(const std::string& host, const
     uint32_t conv;
     memcpy(&conv, data + kcp_head_size, sizeof(conv));
     conv = ntohl(conv);
-    kcp_ = kcp_create_default(conv, this);
+    // 服务器回复的是协商后的值，老版本的服务器不支持 fec
+    option_ = read_kcp_connect(data, len);
+    token_ = read_kcp_connect_cookie(data, len);
+    option_.mtu = std::min(option_.mtu, profile_.mtu);
+    option_.max_mtu = std::max(option_.mtu, std::min(option_.max_mtu, profile_.max_mtu));
+    if (profile_.fec_data == 0) {
+        option_.fec_data = 0;
+        option_.fec_parity = 0;
+    }
+    kcp_ = kcp_create(conv, this, profile_, option_);
     state_ = state::connected;
     ikcp_setoutput(kcp_, [](const char* buf, int len, ikcpcb* kcp, void* user) {
         auto* client = static_cast<kcp_client_impl*>(user);
         client->last_write_ = asio_timer::clock_type::now();
-        client->write_to(make_kcp_data(buf, len));
+        client->write_data(buf, static_cast<size_t>(len));
         return 0;
     });
+    driver_ = client_driver();
+    update_node_.kcp = kcp_;
+    if (option_.fec_data > 0) {
+        fec_encoder_ = std::make_unique<kcp_fec_encoder>(conv, option_.fec_data, option_.fec_parity, option_.max_mtu);
+        fec_decoder_ = std::make_unique<kcp_fec_decoder>(option_.fec_data, option_.fec_parity, option_.max_mtu);
+        // 每次 update 之后结束当前的分组
+        update_node_.user = this;
+        update_node_.updated = [](void* user) {
+            auto* client = static_cast<kcp_client_impl*>(user);
+            client->fec_encoder_->flush([client](const uint8_t* data, size_t len) { client->write_to(data, len); });
+        };
+        info("kcp client {} fec data:{} parity:{}", socket_id_, option_.fec_data, option_.fec_parity);
+    }
 
     auto self = shared_from_this();
     std::error_code ec_ignore;
@@ -157,8 +238,8 @@ asio::awaitable<void> kcp_client_impl::co_connect(const std::string& host, const
             }
         }
         write_deque_.clear();
-        force_update_ = true;
     }
+    driver_->wake(update_node_);
 
     last_read_ = asio_timer::clock_type::now();
     last_write_ = last_read_;
@@ -181,14 +262,16 @@ asio::awaitable<void> kcp_client_impl::co_connect(const std::string& host, const
         },
         asio::detached);
 
-    // kcp update协程
-    co_spawn(
-        context,
-        [self, this]() {
-            std::ignore = self;
-            return co_kcp_update();
-        },
-        asio::detached);
+    if (option_.max_mtu > option_.mtu) {
+        udp_batch::dont_fragment(socket_);
+        co_spawn(
+            context,
+            [self, this]() {
+                std::ignore = self;
+                return co_mtu_probe();
+            },
+            asio::detached);
+    }
 }
 
 asio::awaitable<void> kcp_client_impl::co_timeout(const asio_timer::duration& timeout) {
@@ -200,58 +283,149 @@ asio::awaitable<void> kcp_client_impl::co_timeout(const asio_timer::duration& ti
 
 asio::awaitable<void> kcp_client_impl::co_read() {
     auto self = shared_from_this();
-    uint8_t data[udp_mtu];
     for (;;) {
-        auto [ec, len] = co_await socket_.async_receive(asio::buffer(data), use_awaitable_as_tuple);
+        auto [ec] = co_await socket_.async_wait(udp::socket::wait_read, use_awaitable_as_tuple);
         if (state_ != state::connected) {
             co_return;
         }
 
-        if (ec || len < kcp_head_size) {
-            disconnect(ec);
-            co_return;
+        // socket 被 rebind 换成了新的
+        if (ec == asio::error::operation_aborted && socket_.is_open()) {
+            continue;
         }
 
-        const auto* head = reinterpret_cast<kcp_head*>(data);
-        if (head->magic1 != kcp_magic1 || head->magic2 != kcp_magic2 || head->magic3 != kcp_magic3) {
-            disconnect(socket_errors::kcp_check_failed);
+        if (ec) {
+            disconnect(ec);
             co_return;
         }
 
-        trace_read(len);
-        switch (head->code) {  // NOLINT(clang-diagnostic-switch-enum)
-            case kcp_code::disconnect: {
-                if (len < kcp_head_size + sizeof(uint32_t)) {
-                    continue;
+        // 一次唤醒把已经到达的包全部读完
+        size_t count;
+        do {
+            count = batch_.receive(socket_, ec);
+            if (ec) {
+                disconnect(ec);
+                co_return;
+            }
+
+            for (size_t i = 0; i < count; ++i) {
+                if (!hand_read(batch_.data(i), batch_.size(i))) {
+                    co_return;
                 }
+            }
+        } while (count == batch_.capacity());
+    }
+}
+
+bool kcp_client_impl::hand_read(uint8_t* data, size_t len) {
+    if (len < kcp_head_size) {
+        disconnect(std::error_code{});
+        return false;
+    }
+
+    const auto* head = reinterpret_cast<kcp_head*>(data);
+    if (head->magic1 != kcp_magic1 || head->magic2 != kcp_magic2 || head->magic3 != kcp_magic3) {
+        disconnect(socket_errors::kcp_check_failed);
+        return false;
+    }
+
+    trace_read(len);
+    switch (head->code) {  // NOLINT(clang-diagnostic-switch-enum)
+        case kcp_code::disconnect: {
+            if (len < kcp_head_size + sizeof(uint32_t)) {
+                return true;
+            }
+
+            uint32_t conv = 0;
+            memcpy(&conv, data + kcp_head_size, sizeof(conv));
+            conv = ntohl(conv);
+            if (conv != kcp_->conv) {
+                return true;
+            }
 
-                uint32_t conv = 0;
-                memcpy(&conv, data + kcp_head_size, sizeof(conv));
-                conv = ntohl(conv);
-                if (conv != kcp_->conv) {
-                    continue;
+            disconnect(asio::error::eof);
+            return false;
+        }
+        case kcp_code::heartbeat:
+            last_write_ = asio_timer::clock_type::now();
+            write_to(make_kcp_ctrl(kcp_code::heartbeat_ack, kcp_->conv));
+            break;
+        case kcp_code::heartbeat_ack:
+            break;
+        case kcp_code::migrate:
+            // 服务器从新的地址收到了这个连接的包，用 token 对 nonce 签名确认
+            if (uint32_t conv; token_ != 0 && read_kcp_conv(data, len, conv) && conv == kcp_->conv) {
+                if (const auto nonce = read_kcp_migrate(data, len); nonce != 0) {
+                    const auto msg = make_kcp_migrate(conv, kcp_migrate_proof(token_, nonce));
+                    write_to(msg.data(), msg.size());
                 }
+            }
+            break;
+        case kcp_code::mtu_probe_ack:
+            if (const auto [size, confirmed] = read_kcp_mtu_probe(data, len); size == len) {
+                probe_acked_ = size;
+            }
+            break;
+        case kcp_code::data:
+            if (!hand_read_data(data + kcp_head_size, len - kcp_head_size)) {
+                return false;
+            }
+            break;
+        case kcp_code::fec:
+            if (!fec_decoder_) {
+                return true;
+            }
+            if (!fec_decoder_->decode(data, len, [this](const uint8_t* d, size_t l) { return hand_read_data(d, l); })) {
+                return false;
+            }
+            break;
+        default:
+            return true;
+    }
+
+    last_read_ = asio_timer::clock_type::now();
+    return state_ == state::connected;
+}
 
-                disconnect(asio::error::eof);
+asio::awaitable<void> kcp_client_impl::co_mtu_probe() {
+    auto self = shared_from_this();
+    std::vector<uint8_t> probe(option_.max_mtu);
+    const auto initial = option_.mtu;
+    auto low = option_.mtu;
+    auto high = option_.max_mtu;
+    // 先试上限，局域网里一般一次就能成功，失败后再二分
+    auto size = high;
+    while (high >= low + kcp_mtu_probe_step) {
+        make_kcp_mtu_probe(probe.data(), kcp_->conv, size, low);
+        bool acked = false;
+        for (int32_t i = 0; i < kcp_mtu_probe_retry && !acked; ++i) {
+            batch_.push(probe.data(), size);
+            post_flush();
+
+            probe_timer_.expires_after(kcp_mtu_probe_timeout);
+            if (auto [ec] = co_await probe_timer_.async_wait(); ec || state_ != state::connected) {
                 co_return;
             }
-            case kcp_code::heartbeat:
-                last_write_ = asio_timer::clock_type::now();
-                write_to(make_kcp_ctrl(kcp_code::heartbeat_ack, kcp_->conv));
-                break;
-            case kcp_code::heartbeat_ack:
-                break;
-            case kcp_code::data:
-                if (!hand_read_data(data + kcp_head_size, len - kcp_head_size)) {
-                    co_return;
-                }
-                break;
-            default:
-                continue;
+            acked = probe_acked_ == size;
         }
 
-        last_read_ = asio_timer::clock_type::now();
+        if (acked) {
+            low = size;
+            option_.mtu = size;
+            kcp_set_mtu(kcp_, option_.mtu, fec_encoder_ != nullptr);
+        } else {
+            high = size - 1;
+        }
+        size = (low + high + 1) / 2;
+    }
+
+    if (low > initial) {
+        // 通知服务器最终确认的大小
+        make_kcp_mtu_probe(probe.data(), kcp_->conv, kcp_mtu_probe_size, low);
+        batch_.push(probe.data(), kcp_mtu_probe_size);
+        post_flush();
     }
+    info("kcp client {} mtu {}", socket_id_, option_.mtu);
 }
 
 asio::awaitable<void> kcp_client_impl::co_watchdog() {
@@ -260,7 +434,7 @@ asio::awaitable<void> kcp_client_impl::co_watchdog() {
     auto deadline_point = last_read_ + kcp_alive_timeout;
     auto heartbeat_point = last_write_ + kcp_heartbeat_timeout;
     while (now < deadline_point) {
-        deadline_.expires_at(std::min(heartbeat_point, deadline_point));
+        deadline_.expires_at(std::min({heartbeat_point, deadline_point, now + kcp_rebind_interval}));
         if (auto [ec] = co_await deadline_.async_wait(); ec) {
             co_return;
         }
@@ -273,6 +447,10 @@ asio::awaitable<void> kcp_client_impl::co_watchdog() {
         heartbeat_point = last_write_ + kcp_heartbeat_timeout;
 
         now = std::chrono::steady_clock::now();
+        if (now - last_read_ >= kcp_rebind_interval && token_ != 0 && rebind()) {
+            heartbeat_point = now;
+        }
+
         if (now >= heartbeat_point) {
             write_to(make_kcp_ctrl(kcp_code::heartbeat, kcp_->conv));
             last_write_ = now;
@@ -283,29 +461,28 @@ asio::awaitable<void> kcp_client_impl::co_watchdog() {
     disconnect(socket_errors::kcp_heartbeat_timeout);
 }
 
-asio::awaitable<void> kcp_client_impl::co_kcp_update() {
-    using namespace std::chrono;
-    auto now = asio_timer::clock_type::now();
-    auto cur = static_cast<uint32_t>(duration_cast<milliseconds>(now.time_since_epoch()).count());
-    auto next = ikcp_check(kcp_, cur);
-    auto next_update = now + milliseconds(next - cur);
-
-    while (state_ == state::connected) {
-        kcp_update_.expires_after(milliseconds(5));
-        if (auto [ec] = co_await kcp_update_.async_wait(); ec) {
-            co_return;
-        }
-
-        now = asio_timer::clock_type::now();
-        if (now >= next_update || force_update_) {
-            force_update_ = false;
-            ikcp_update(kcp_, static_cast<uint32_t>(duration_cast<milliseconds>(now.time_since_epoch()).count()));
-            now = asio_timer::clock_type::now();
-            cur = static_cast<uint32_t>(duration_cast<milliseconds>(now.time_since_epoch()).count());
-            next = ikcp_check(kcp_, cur);
-            next_update = now + milliseconds(next - cur);
-        }
-    }
+bool kcp_client_impl::rebind() {
+    std::error_code ec;
+    const auto remote = socket_.remote_endpoint(ec);
+    if (ec) return false;
+    const auto local = socket_.local_endpoint(ec);
+    if (ec) return false;
+
+    // 用新的 socket 连接服务器，由系统按照当前的路由选择本地地址
+    udp::socket next(socket_.get_executor());
+    next.connect(remote, ec);
+    if (ec) return false;
+    const auto next_local = next.local_endpoint(ec);
+    if (ec || next_local.address() == local.address()) return false;
+    // 新的路径没有探测过 mtu，不设置 dont_fragment，超过路径 mtu 的包可以分片发送
+    next.non_blocking(true, ec);
+    if (ec) return false;
+
+    info("kcp client {} rebind {} -> {}", socket_id_, to_string(local), to_string(next_local));
+    // 关闭旧的 socket 时等待中的操作会被取消，接收和发送都继续使用新的 socket
+    socket_.close(ec);
+    socket_ = std::move(next);
+    return true;
 }
 
 bool kcp_client_impl::write_base(const memory_buffer_ptr& ptr) {
@@ -329,12 +506,45 @@ bool kcp_client_impl::write_base(const memory_buffer_ptr& ptr) {
     return true;
 }
 
-void kcp_client_impl::write_to(std::vector<uint8_t> data) {
-    auto self = shared_from_this();
-    const auto msg = std::make_shared<std::vector<uint8_t>>(std::move(data));
-    socket_.async_send(asio::buffer(msg->data(), msg->size()), [self, msg](const std::error_code&, size_t) {
-        std::ignore = self;
-        std::ignore = msg;
+void kcp_client_impl::write_to(const kcp_ctrl_packet& ctrl) {
+    batch_.push(ctrl.data(), ctrl.size());
+    post_flush();
+}
+
+void kcp_client_impl::write_to(const void* data, size_t len) {
+    batch_.push(data, len);
+    post_flush();
+}
+
+void kcp_client_impl::write_data(const char* data, size_t len) {
+    if (fec_encoder_) {
+        return fec_encoder_->encode(data, len, [this](const uint8_t* packet, size_t size) { write_to(packet, size); });
+    }
+
+    batch_.push(&kcp_data_head, sizeof(kcp_data_head), data, len);
+    post_flush();
+}
+
+void kcp_client_impl::post_flush() {
+    if (flushing_) return;
+
+    flushing_ = true;
+    asio::post(socket_.get_executor(), [self = shared_from_this()]() { self->flush(); });
+}
+
+void kcp_client_impl::flush() {
+    if (!socket_.is_open()) return;
+
+    if (batch_.send(socket_)) {
+        flushing_ = false;
+        return;
+    }
+
+    // 发送缓冲区满了，等待可写，rebind 取消等待时在新的 socket 上继续发送
+    socket_.async_wait(udp::socket::wait_write, [self = shared_from_this()](const std::error_code& ec) {
+        if (!ec || ec == asio::error::operation_aborted) {
+            self->flush();
+        }
     });
 }
 
@@ -349,18 +559,27 @@ bool kcp_client_impl::hand_read_data(const uint8_t* data, size_t len) {
         return false;
     }
 
-    force_update_ = true;
+    driver_->wake(update_node_);
 
-    uint8_t temp[kcp_recv_capacity];  // NOLINT(clang-diagnostic-vla-extension)
-    const auto& system = socket_system::instance();
+    // 先取得完整消息的大小，直接接收到交给逻辑线程的缓冲区中
     for (;;) {
-        const auto recv_bytes = ikcp_recv(kcp_, reinterpret_cast<char*>(temp), kcp_recv_capacity);
+        const auto size = ikcp_peeksize(kcp_);
+        if (size <= 0) {
+            break;
+        }
+
+        memory_buffer buf;
+        buf.make_sure_writable(static_cast<size_t>(size));
+        const auto recv_bytes = ikcp_recv(kcp_, reinterpret_cast<char*>(buf.begin_write()), size);
         if (recv_bytes <= 0) {
             break;
         }
-        system.hand_read(socket_id_, temp, recv_bytes);
+        buf.written(static_cast<size_t>(recv_bytes));
+        if (!hand_data(std::move(buf))) {
+            disconnect(socket_errors::frame_too_large);
+            return false;
+        }
     }
-    std::ignore = temp;
 
     return true;
 }
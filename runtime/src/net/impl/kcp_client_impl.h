@@ -7,7 +7,11 @@
 #include <asio/use_awaitable.hpp>
 #include <deque>
 
+#include "kcp_config.h"
+#include "kcp_driver.h"
+#include "kcp_fec.h"
 #include "socket_impl.hpp"
+#include "udp_batch.h"
 
 // ReSharper disable once IdentifierTypo
 // ReSharper disable once CppInconsistentNaming
@@ -21,7 +25,7 @@ class kcp_client_impl final : public socket_base, public std::enable_shared_from
     using udp = asio::ip::udp;
     using asio_timer = asio_token::as_default_on_t<asio::steady_timer>;
 
-    explicit kcp_client_impl(uint32_t socket_id);
+    kcp_client_impl(uint32_t socket_id, const kcp_profile& profile);
 
     ~kcp_client_impl() noexcept override;
 
@@ -44,21 +48,51 @@ class kcp_client_impl final : public socket_base, public std::enable_shared_from
 
     asio::awaitable<void> co_watchdog();
 
-    asio::awaitable<void> co_kcp_update();
+    // 探测 (mtu, max_mtu] 之间能通过的最大包
+    asio::awaitable<void> co_mtu_probe();
+
+    // 处理一个包，返回 false 时停止接收
+    bool hand_read(uint8_t* data, size_t len);
+
+    // 本地地址变化后（比如 wifi 切换到移动网络）换一个 socket 连接服务器，服务器通过 migrate 迁移连接
+    // 返回 false 表示地址没有变化或者新的地址还不能使用
+    bool rebind();
 
     bool write_base(const memory_buffer_ptr& ptr);
 
-    void write_to(std::vector<uint8_t> data);
+    // 发送控制包
+    void write_to(const kcp_ctrl_packet& ctrl);
+
+    void write_to(const void* data, size_t len);
+
+    // 给 kcp 输出的数据加上包头发送，使用 fec 时经过 fec 编码
+    void write_data(const char* data, size_t len);
+
+    void post_flush();
+
+    // 发送队列中的包，一轮事件中产生的包合并到一次发送
+    void flush();
 
     bool hand_read_data(const uint8_t* data, size_t len);
 
     void disconnect(const std::error_code& ec);
 
+    kcp_profile profile_;
     udp::socket socket_;
+    udp_batch batch_;
+    bool flushing_{false};
 
     IKCPCB* kcp_{nullptr};
-    asio_timer kcp_update_;
-    bool force_update_{false};
+    // 服务器在 connect_ack 中下发，地址变化后用来迁移连接
+    uint64_t token_{0};
+    // 协商后的包大小、允许探测的上限和 fec 参数
+    kcp_connect_option option_;
+    std::unique_ptr<kcp_fec_encoder> fec_encoder_;
+    std::unique_ptr<kcp_fec_decoder> fec_decoder_;
+    uint32_t probe_acked_{0};
+    asio_timer probe_timer_;
+    std::shared_ptr<kcp_driver> driver_;
+    kcp_driver::node update_node_;
 
     asio_timer::time_point last_read_;
     asio_timer::time_point last_write_;
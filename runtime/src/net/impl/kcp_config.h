@@ -1,9 +1,14 @@
 ﻿#pragma once
 #include <ikcp.h>
+#include <simple/net/socket_types.h>
+#include <simple/utils/crypt.h>
 
+#include <algorithm>
+#include <array>
 #include <chrono>
 #include <cstdint>
-#include <vector>
+#include <cstring>
+#include <utility>
 
 #if defined(_WIN32)
 #include <WinSock2.h>
@@ -15,6 +20,14 @@ namespace simple {
 
 inline constexpr std::chrono::seconds kcp_alive_timeout(20);
 inline constexpr std::chrono::seconds kcp_heartbeat_timeout(10);
+// connect cookie 的有效期，服务器接受当前和上一个周期的 cookie
+inline constexpr std::chrono::seconds kcp_cookie_interval(10);
+// 客户端没有收到 connect 的回复时重发的间隔，直到连接超时
+inline constexpr std::chrono::milliseconds kcp_connect_resend(500);
+// 收到新地址的包时发送迁移请求的最小间隔
+inline constexpr std::chrono::milliseconds kcp_migrate_interval(100);
+// 客户端一段时间没有收到包时检查本地地址是否变化
+inline constexpr std::chrono::seconds kcp_rebind_interval(2);
 
 inline constexpr uint8_t kcp_op_connect = 1;
 inline constexpr uint8_t kcp_op_connect_ack = 2;
@@ -22,6 +35,11 @@ inline constexpr uint8_t kcp_op_disconnect = 3;
 inline constexpr uint8_t kcp_op_heartbeat = 4;
 inline constexpr uint8_t kcp_op_heartbeat_ack = 5;
 inline constexpr uint8_t kcp_op_data = 6;
+inline constexpr uint8_t kcp_op_mtu_probe = 7;
+inline constexpr uint8_t kcp_op_mtu_probe_ack = 8;
+inline constexpr uint8_t kcp_op_fec = 9;
+inline constexpr uint8_t kcp_op_connect_cookie = 10;
+inline constexpr uint8_t kcp_op_migrate = 11;
 
 enum class kcp_code : uint8_t {
     connect = kcp_op_connect,
@@ -30,6 +48,11 @@ enum class kcp_code : uint8_t {
     heartbeat = kcp_op_heartbeat,
     heartbeat_ack = kcp_op_heartbeat_ack,
     data = kcp_op_data,
+    mtu_probe = kcp_op_mtu_probe,
+    mtu_probe_ack = kcp_op_mtu_probe_ack,
+    fec = kcp_op_fec,
+    connect_cookie = kcp_op_connect_cookie,
+    migrate = kcp_op_migrate,
 };
 
 inline constexpr uint8_t kcp_magic1 = 0x62;
@@ -43,49 +66,244 @@ struct kcp_head {
     kcp_code code{kcp_code::connect};
 };
 
+// 默认的 udp 包大小，对端没有协商 mtu 时使用
 inline constexpr int32_t udp_mtu = 470;
+// kcp_profile 中 mtu 的范围，1472 = 1500 - ipv4 头 - udp 头
+inline constexpr uint32_t udp_min_mtu = 128;
+inline constexpr uint32_t udp_max_mtu = 1472;
 
 inline constexpr int32_t kcp_head_size = sizeof(kcp_head);
 
-inline constexpr int32_t kcp_mtu = udp_mtu - kcp_head_size;
+// fec 包在 kcp_head 之后的包头（conv、组序号、分片序号、分片数量）和数据分片的长度
+inline constexpr int32_t kcp_fec_head_size = 12;
+inline constexpr int32_t kcp_fec_overhead = kcp_fec_head_size + sizeof(uint16_t);
+// fec 分片数量的上限
+inline constexpr uint32_t kcp_fec_max_data = 32;
+inline constexpr uint32_t kcp_fec_max_parity = 16;
+// 一个监听最多的分片数量
+inline constexpr uint32_t kcp_max_shards = 64;
 
+// mtu 探测，每次等待 ack 的时间、重试次数和停止二分的精度
+inline constexpr std::chrono::milliseconds kcp_mtu_probe_timeout(200);
+inline constexpr int32_t kcp_mtu_probe_retry = 3;
+inline constexpr uint32_t kcp_mtu_probe_step = 16;
+
+// 发送时大的消息按这个大小拆分，兼容只能接收这么大消息的老版本
 inline constexpr int32_t kcp_recv_capacity = 1024;
 
-inline auto make_kcp_ctrl(kcp_code code, uint32_t conv) {
-    std::vector<uint8_t> msg;
-    msg.resize(kcp_head_size + sizeof(conv));
+// 一次系统调用批量收发的包数量
+inline constexpr size_t kcp_server_batch_size = 64;
+inline constexpr size_t kcp_client_batch_size = 8;
+
+inline constexpr int32_t kcp_ctrl_size = kcp_head_size + sizeof(uint32_t);
+
+using kcp_ctrl_packet = std::array<uint8_t, kcp_ctrl_size>;
+
+inline constexpr kcp_head make_kcp_head(kcp_code code) {
     kcp_head head;
     head.code = code;
+    return head;
+}
+
+// 预先格式化好的包头，发送时直接复制
+inline constexpr kcp_head kcp_data_head = make_kcp_head(kcp_code::data);
+
+// 读取包中的 conv，数据包在 kcp 的包头中，其他的包跟在 kcp_head 后面
+inline bool read_kcp_conv(const uint8_t* data, size_t len, uint32_t& conv) {
+    if (len < kcp_head_size + sizeof(uint32_t)) {
+        return false;
+    }
+
+    if (reinterpret_cast<const kcp_head*>(data)->code == kcp_code::data) {
+        conv = ikcp_getconv(data + kcp_head_size);
+    } else {
+        memcpy(&conv, data + kcp_head_size, sizeof(conv));
+        conv = ntohl(conv);
+    }
+    return true;
+}
+
+// 控制包直接在栈上构造，不需要申请内存
+inline kcp_ctrl_packet make_kcp_ctrl(kcp_code code, uint32_t conv) {
+    kcp_ctrl_packet msg;
+    const auto head = make_kcp_head(code);
     memcpy(msg.data(), &head, sizeof(head));
     conv = htonl(conv);
     memcpy(msg.data() + sizeof(head), &conv, sizeof(conv));
     return msg;
 }
 
-inline auto make_kcp_data(const void* data, size_t len) {
-    std::vector<uint8_t> msg;
-    msg.resize(kcp_head_size + len);
-    kcp_head head;
-    head.code = kcp_code::data;
-    memcpy(msg.data(), &head, sizeof(head));
-    memcpy(msg.data() + sizeof(head), data, len);
+// connect 和 connect_ack 在 conv 之后带上的协商参数，最后是 connect cookie
+// 客户端发送期望的值，服务器回复双方都能接受的值，老版本的包没有这部分时使用默认值
+// 服务器收到不带 cookie 的 connect 时不创建连接，只用 connect_cookie 回复一个根据地址计算的 cookie，
+// 客户端带上 cookie 重新发送 connect 后才创建连接，伪造地址的 connect 不会占用服务器的内存
+// 老版本客户端的 connect 比 kcp_connect_size 短，监听开启 legacy_connect 时直接创建连接
+// connect_ack 的 cookie 位置是迁移连接用的 token
+struct kcp_connect_option {
+    uint32_t mtu{udp_mtu};
+    uint32_t max_mtu{udp_mtu};
+    // fec 的数据分片和校验分片数量，为 0 表示不使用 fec
+    uint32_t fec_data{0};
+    uint32_t fec_parity{0};
+};
+
+inline constexpr int32_t kcp_connect_option_size = kcp_ctrl_size + 2 * sizeof(uint16_t) + 2 * sizeof(uint8_t);
+inline constexpr int32_t kcp_connect_size = kcp_connect_option_size + sizeof(uint64_t);
+
+using kcp_connect_packet = std::array<uint8_t, kcp_connect_size>;
+
+inline kcp_connect_packet make_kcp_connect(kcp_code code, uint32_t conv, const kcp_connect_option& option,
+                                           uint64_t cookie = 0) {
+    kcp_connect_packet msg;
+    const auto ctrl = make_kcp_ctrl(code, conv);
+    memcpy(msg.data(), ctrl.data(), ctrl.size());
+    const uint16_t values[2]{htons(static_cast<uint16_t>(option.mtu)), htons(static_cast<uint16_t>(option.max_mtu))};
+    memcpy(msg.data() + ctrl.size(), values, sizeof(values));
+    msg[ctrl.size() + sizeof(values)] = static_cast<uint8_t>(option.fec_data);
+    msg[ctrl.size() + sizeof(values) + 1] = static_cast<uint8_t>(option.fec_parity);
+    const uint32_t parts[2]{htonl(static_cast<uint32_t>(cookie >> 32)), htonl(static_cast<uint32_t>(cookie))};
+    memcpy(msg.data() + kcp_connect_option_size, parts, sizeof(parts));
+    return msg;
+}
+
+// 没有 cookie 时返回 0
+inline uint64_t read_kcp_connect_cookie(const uint8_t* data, size_t len) {
+    if (len < kcp_connect_size) {
+        return 0;
+    }
+
+    uint32_t parts[2];
+    memcpy(parts, data + kcp_connect_option_size, sizeof(parts));
+    return static_cast<uint64_t>(ntohl(parts[0])) << 32 | ntohl(parts[1]);
+}
+
+// 客户端的地址变化后（比如 nat 重新映射端口，或者 wifi 切换到移动网络）继续使用原来的连接
+// 服务器收到已有 conv 但是地址不同的包时丢弃，向新地址发送带随机 nonce 的 migrate，
+// 客户端回复 HMAC(token, nonce)，服务器只接受从发送 nonce 的地址回复的正确结果，然后把连接的地址改为新地址，kcp 的状态不变
+// token 只在 connect_ack 中出现一次，之后的 migrate 包被截获也不能在其他地址重放
+inline constexpr int32_t kcp_migrate_size = kcp_ctrl_size + sizeof(uint64_t);
+
+using kcp_migrate_packet = std::array<uint8_t, kcp_migrate_size>;
+
+// value 在服务器发送的包中是 nonce，在客户端回复的包中是 kcp_migrate_proof 的结果
+inline kcp_migrate_packet make_kcp_migrate(uint32_t conv, uint64_t value) {
+    kcp_migrate_packet msg;
+    const auto ctrl = make_kcp_ctrl(kcp_code::migrate, conv);
+    memcpy(msg.data(), ctrl.data(), ctrl.size());
+    const uint32_t parts[2]{htonl(static_cast<uint32_t>(value >> 32)), htonl(static_cast<uint32_t>(value))};
+    memcpy(msg.data() + kcp_ctrl_size, parts, sizeof(parts));
     return msg;
 }
 
-inline void kcp_no_delay(IKCPCB* kcp, bool on) {
+inline uint64_t kcp_migrate_proof(uint64_t token, uint64_t nonce) {
+    sha1_data digest;
+    hmac_sha1(digest, {reinterpret_cast<const char*>(&nonce), sizeof(nonce)},
+              {reinterpret_cast<const char*>(&token), sizeof(token)});
+    uint64_t proof;
+    memcpy(&proof, digest.data(), sizeof(proof));
+    return proof;
+}
+
+// 包太短时返回 0
+inline uint64_t read_kcp_migrate(const uint8_t* data, size_t len) {
+    if (len < kcp_migrate_size) {
+        return 0;
+    }
+
+    uint32_t parts[2];
+    memcpy(parts, data + kcp_ctrl_size, sizeof(parts));
+    return static_cast<uint64_t>(ntohl(parts[0])) << 32 | ntohl(parts[1]);
+}
+
+inline kcp_connect_option read_kcp_connect(const uint8_t* data, size_t len) {
+    kcp_connect_option option;
+    if (len < kcp_connect_option_size) {
+        return option;
+    }
+
+    uint16_t values[2];
+    memcpy(values, data + kcp_ctrl_size, sizeof(values));
+    option.mtu = std::clamp<uint32_t>(ntohs(values[0]), udp_min_mtu, udp_max_mtu);
+    option.max_mtu = std::clamp<uint32_t>(ntohs(values[1]), option.mtu, udp_max_mtu);
+    option.fec_data = std::min<uint32_t>(data[kcp_ctrl_size + sizeof(values)], kcp_fec_max_data);
+    option.fec_parity = std::min<uint32_t>(data[kcp_ctrl_size + sizeof(values) + 1], kcp_fec_max_parity);
+    if (option.fec_data == 0 || option.fec_parity == 0) {
+        option.fec_data = 0;
+        option.fec_parity = 0;
+    }
+    return option;
+}
+
+// 服务器按照双方的参数决定连接使用的值
+inline kcp_connect_option kcp_negotiate(const kcp_connect_option& remote, const kcp_profile& local) {
+    kcp_connect_option option;
+    option.mtu = std::min(remote.mtu, local.mtu);
+    option.max_mtu = std::max(option.mtu, std::min(remote.max_mtu, local.max_mtu));
+    if (remote.fec_data > 0 && local.fec_data > 0) {
+        option.fec_data = std::min(remote.fec_data, local.fec_data);
+        option.fec_parity = std::min(remote.fec_parity, local.fec_parity);
+    }
+    return option;
+}
+
+// mtu 探测包，conv 之后是探测的大小和已经确认可以使用的 mtu，后面填充到探测的大小
+// 对端原样回复 mtu_probe_ack，收到同样大小的回复说明这个大小的包双向都能通过
+inline constexpr int32_t kcp_mtu_probe_size = kcp_ctrl_size + 2 * sizeof(uint16_t);
+
+inline void make_kcp_mtu_probe(uint8_t* data, uint32_t conv, uint32_t size, uint32_t confirmed) {
+    const auto ctrl = make_kcp_ctrl(kcp_code::mtu_probe, conv);
+    memcpy(data, ctrl.data(), ctrl.size());
+    const uint16_t values[2]{htons(static_cast<uint16_t>(size)), htons(static_cast<uint16_t>(confirmed))};
+    memcpy(data + ctrl.size(), values, sizeof(values));
+}
+
+// 返回探测的大小和已经确认的 mtu
+inline std::pair<uint32_t, uint32_t> read_kcp_mtu_probe(const uint8_t* data, size_t len) {
+    if (len < kcp_mtu_probe_size) {
+        return {0, 0};
+    }
+
+    uint16_t values[2];
+    memcpy(values, data + kcp_ctrl_size, sizeof(values));
+    return {ntohs(values[0]), ntohs(values[1])};
+}
+
+// 检查配置的范围
+inline kcp_profile kcp_check_profile(kcp_profile profile) {
+    profile.mtu = std::clamp(profile.mtu, udp_min_mtu, udp_max_mtu);
+    profile.max_mtu = profile.mtu_probe ? std::clamp(profile.max_mtu, profile.mtu, udp_max_mtu) : profile.mtu;
+    profile.snd_wnd = std::max(profile.snd_wnd, 1u);
+    profile.rcv_wnd = std::max(profile.rcv_wnd, 1u);
+    profile.interval = std::clamp(profile.interval, 1u, 5000u);
+    profile.fec_data = std::min(profile.fec_data, kcp_fec_max_data);
+    profile.fec_parity = std::min(profile.fec_parity, kcp_fec_max_parity);
+    if (profile.fec_data == 0 || profile.fec_parity == 0) {
+        profile.fec_data = 0;
+        profile.fec_parity = 0;
+    }
+    profile.shards = std::min(profile.shards, kcp_max_shards);
+    return profile;
+}
+
+inline void kcp_no_delay(IKCPCB* kcp, const kcp_profile& profile, bool on) {
     if (on) {
-        ikcp_nodelay(kcp, 1, 10, 2, 1);
-        kcp->rx_minrto = 10;
+        ikcp_nodelay(kcp, 1, static_cast<int>(profile.interval), static_cast<int>(profile.resend), profile.nc ? 1 : 0);
+        kcp->rx_minrto = static_cast<int>(profile.min_rto);
     } else {
         ikcp_nodelay(kcp, 0, 40, 0, 0);
     }
 }
 
-inline IKCPCB* kcp_create_default(uint32_t conv, void* user) {
+// mtu 是 udp 包的大小，使用 fec 时还要留出 fec 的包头
+inline void kcp_set_mtu(IKCPCB* kcp, uint32_t mtu, bool fec) {
+    ikcp_setmtu(kcp, static_cast<int>(mtu) - kcp_head_size - (fec ? kcp_fec_overhead : 0));
+}
+
+inline IKCPCB* kcp_create(uint32_t conv, void* user, const kcp_profile& profile, const kcp_connect_option& option) {
     auto* kcp = ikcp_create(conv, user);
-    ikcp_wndsize(kcp, 256, 256);
-    ikcp_setmtu(kcp, kcp_mtu);
-    kcp_no_delay(kcp, true);
+    ikcp_wndsize(kcp, static_cast<int>(profile.snd_wnd), static_cast<int>(profile.rcv_wnd));
+    kcp_set_mtu(kcp, option.mtu, option.fec_data > 0);
+    kcp_no_delay(kcp, profile, profile.nodelay);
     return kcp;
 }
 
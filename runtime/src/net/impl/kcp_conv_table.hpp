@@ -0,0 +1,99 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace simple {
+
+// kcp 服务器中 conv 到连接的映射，收到的包按 conv 直接定位到数组中的槽位
+// conv 的低位是槽位下标，高位是槽位的代数，槽位复用时代数加一，旧连接的包不会查到新的连接
+// 只在网络线程中使用，不需要加锁
+template <typename T>
+class kcp_conv_table {
+  public:
+    static constexpr uint32_t index_bits = 20;
+    static constexpr uint32_t index_mask = (1u << index_bits) - 1;
+    static constexpr uint32_t generation_mask = (1u << (32 - index_bits)) - 1;
+
+    // 返回分配的 conv，槽位用完时返回 0
+    uint32_t insert(T* value) {
+        uint32_t index;
+        if (!free_.empty()) {
+            index = free_.back();
+            free_.pop_back();
+        } else {
+            if (slots_.size() > index_mask) {
+                return 0;
+            }
+            index = static_cast<uint32_t>(slots_.size());
+            slots_.emplace_back();
+        }
+
+        auto& slot = slots_[index];
+        slot.value = value;
+        ++size_;
+        return slot.generation << index_bits | index;
+    }
+
+    [[nodiscard]] T* find(uint32_t conv) const {
+        const auto index = conv & index_mask;
+        if (index >= slots_.size()) {
+            return nullptr;
+        }
+
+        const auto& slot = slots_[index];
+        return slot.generation == conv >> index_bits ? slot.value : nullptr;
+    }
+
+    void erase(uint32_t conv) {
+        const auto index = conv & index_mask;
+        if (index >= slots_.size()) {
+            return;
+        }
+
+        auto& slot = slots_[index];
+        if (!slot.value || slot.generation != conv >> index_bits) {
+            return;
+        }
+
+        release(slot, index);
+    }
+
+    // 取出所有的值并清空
+    std::vector<T*> take_all() {
+        std::vector<T*> values;
+        values.reserve(size_);
+        for (uint32_t i = 0; i < slots_.size(); ++i) {
+            if (auto& slot = slots_[i]; slot.value) {
+                values.emplace_back(slot.value);
+                release(slot, i);
+            }
+        }
+        return values;
+    }
+
+    [[nodiscard]] size_t size() const { return size_; }
+
+  private:
+    struct slot {
+        T* value{nullptr};
+        // 从 1 开始，分配的 conv 不会是 0
+        uint32_t generation{1};
+    };
+
+    void release(slot& s, uint32_t index) {
+        s.value = nullptr;
+        s.generation = (s.generation + 1) & generation_mask;
+        if (s.generation == 0) {
+            s.generation = 1;
+        }
+        free_.emplace_back(index);
+        --size_;
+    }
+
+    std::vector<slot> slots_;
+    std::vector<uint32_t> free_;
+    size_t size_{0};
+};
+
+}  // namespace simple
@@ -0,0 +1,213 @@
+﻿#include "kcp_driver.h"
+
+#include <ikcp.h>
+
+#include <algorithm>
+#include <asio/post.hpp>
+#include <bit>
+
+namespace simple {
+
+kcp_driver::kcp_driver(const asio::any_io_executor& executor)
+    : executor_(executor), timer_(executor), idle_check_(clock_type::now() + idle_interval), tick_(now_ms()) {}
+
+uint32_t kcp_driver::now_ms() {
+    using namespace std::chrono;
+    return static_cast<uint32_t>(duration_cast<milliseconds>(clock_type::now().time_since_epoch()).count());
+}
+
+void kcp_driver::wake(node& n) {
+    // 已经在等待 update 的节点不需要再处理
+    if (stopped_ || n.slot_ == ready_slot || n.slot_ == due_slot) return;
+
+    if (n.linked()) {
+        unlink(n);
+    }
+    link(n, ready_slot);
+
+    // 同一轮事件中的多次唤醒合并成一次 update
+    if (!ready_posted_) {
+        ready_posted_ = true;
+        asio::post(executor_, [self = shared_from_this()]() { self->run_ready(); });
+    }
+}
+
+void kcp_driver::remove(node& n) {
+    if (n.linked()) {
+        unlink(n);
+    }
+}
+
+void kcp_driver::stop() {
+    if (stopped_) return;
+    stopped_ = true;
+
+    for (auto& slot : slots_) {
+        for (auto* n : slot) {
+            n->slot_ = no_slot;
+        }
+        slot.clear();
+    }
+    for (auto* n : due_) {
+        if (n) n->slot_ = no_slot;
+    }
+    due_.clear();
+    bitmap_.fill(0);
+    count_ = 0;
+
+    try {
+        timer_.cancel();
+    } catch (...) {
+    }
+}
+
+void kcp_driver::link(node& n, uint32_t slot) {
+    auto& nodes = slots_[slot];
+    n.slot_ = slot;
+    n.index_ = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back(&n);
+    if (slot < wheel_size) {
+        bitmap_[slot / 64] |= uint64_t{1} << (slot % 64);
+    }
+    ++count_;
+}
+
+void kcp_driver::unlink(node& n) {
+    --count_;
+    if (n.slot_ == due_slot) {
+        // 正在处理的节点，置空即可
+        due_[n.index_] = nullptr;
+        n.slot_ = no_slot;
+        return;
+    }
+
+    auto& nodes = slots_[n.slot_];
+    auto* back = nodes.back();
+    nodes[n.index_] = back;
+    back->index_ = n.index_;
+    nodes.pop_back();
+    if (nodes.empty() && n.slot_ < wheel_size) {
+        bitmap_[n.slot_ / 64] &= ~(uint64_t{1} << (n.slot_ % 64));
+    }
+    n.slot_ = no_slot;
+}
+
+void kcp_driver::take(uint32_t slot) {
+    auto& nodes = slots_[slot];
+    for (auto* n : nodes) {
+        n->slot_ = due_slot;
+        n->index_ = static_cast<uint32_t>(due_.size());
+        due_.emplace_back(n);
+    }
+    nodes.clear();
+    if (slot < wheel_size) {
+        bitmap_[slot / 64] &= ~(uint64_t{1} << (slot % 64));
+    }
+}
+
+void kcp_driver::run_due(uint32_t current) {
+    // update 过程中可能会移除其他的节点，所以不能使用迭代器
+    for (size_t i = 0; i < due_.size(); ++i) {
+        if (auto* n = due_[i]) {
+            --count_;
+            n->slot_ = no_slot;
+            drive(*n, current);
+        }
+    }
+    due_.clear();
+}
+
+void kcp_driver::drive(node& n, uint32_t current) {
+    auto* kcp = n.kcp;
+    ikcp_update(kcp, current);
+    if (n.updated) {
+        n.updated(n.user);
+    }
+
+    // 没有待发送的数据、待回复的 ack 和窗口探测，放入空闲桶，有数据收发时会被唤醒
+    if (ikcp_waitsnd(kcp) == 0 && kcp->ackcount == 0 && kcp->probe == 0) {
+        link(n, idle_slot);
+        return;
+    }
+
+    const auto delta = static_cast<int32_t>(ikcp_check(kcp, current) - tick_);
+    const auto clamped = static_cast<uint32_t>(std::clamp(delta, 1, static_cast<int32_t>(wheel_size - 1)));
+    link(n, (tick_ + clamped) & wheel_mask);
+}
+
+void kcp_driver::advance(uint32_t current) {
+    // 先取出所有到期的节点再 update，重新放入时间轮时不会落到本轮要处理的槽中
+    const auto steps = std::min(current - tick_, wheel_size);
+    for (uint32_t i = 1; i <= steps; ++i) {
+        if (const auto slot = (tick_ + i) & wheel_mask; bitmap_[slot / 64] & (uint64_t{1} << (slot % 64))) {
+            take(slot);
+        }
+    }
+    tick_ = current;
+}
+
+void kcp_driver::run_ready() {
+    ready_posted_ = false;
+    if (stopped_) return;
+
+    const auto current = now_ms();
+    take(ready_slot);
+    advance(current);
+    run_due(current);
+    arm();
+}
+
+void kcp_driver::run_timer() {
+    armed_ = clock_type::time_point::max();
+    if (stopped_) return;
+
+    const auto current = now_ms();
+    advance(current);
+    if (const auto now = clock_type::now(); now >= idle_check_) {
+        take(idle_slot);
+        idle_check_ = now + idle_interval;
+    }
+
+    run_due(current);
+    arm();
+}
+
+uint32_t kcp_driver::next_delta() const {
+    uint32_t delta = 1;
+    while (delta < wheel_size) {
+        const auto slot = (tick_ + delta) & wheel_mask;
+        if (const auto bits = bitmap_[slot / 64] >> (slot % 64); bits != 0) {
+            delta += static_cast<uint32_t>(std::countr_zero(bits));
+            return delta < wheel_size ? delta : 0;
+        }
+        delta += 64 - slot % 64;
+    }
+    return 0;
+}
+
+void kcp_driver::arm() {
+    if (stopped_) return;
+
+    auto at = clock_type::time_point::max();
+    if (const auto delta = next_delta(); delta > 0) {
+        const auto wait = std::max(static_cast<int32_t>(tick_ + delta - now_ms()), 0);
+        at = clock_type::now() + std::chrono::milliseconds(wait);
+    }
+
+    if (!slots_[idle_slot].empty()) {
+        at = std::min(at, idle_check_);
+    }
+
+    // 已经有更早的唤醒
+    if (at == clock_type::time_point::max() || at >= armed_) return;
+
+    armed_ = at;
+    timer_.expires_at(at);
+    timer_.async_wait([self = shared_from_this()](const std::error_code& ec) {
+        if (!ec) {
+            self->run_timer();
+        }
+    });
+}
+
+}  // namespace simple
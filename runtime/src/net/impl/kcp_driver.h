@@ -0,0 +1,120 @@
+﻿#pragma once
+#include <simple/config.h>
+
+#include <array>
+#include <asio/any_io_executor.hpp>
+#include <asio/steady_timer.hpp>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <system_error>
+#include <vector>
+
+// ReSharper disable once IdentifierTypo
+// ReSharper disable once CppInconsistentNaming
+struct IKCPCB;
+
+namespace simple {
+
+// 集中驱动 kcp 的 update，替代每个连接一个 5ms 轮询的定时器
+// 按 ikcp_check 的结果把 kcp 放入 1ms 精度的时间轮，定时器只在最近的到期时间唤醒，只 update 到期的 kcp
+// 没有待发送数据和待回复 ack 的 kcp 放入空闲桶，只做低频的检查，有数据收发时通过 wake 立即 update
+// 只能在所属 io_context 的线程中使用
+class kcp_driver : public std::enable_shared_from_this<kcp_driver> {
+  public:
+    using clock_type = std::chrono::steady_clock;
+
+    // 时间轮的槽数量，每个槽 1ms
+    static constexpr uint32_t wheel_size = 1024;
+    // 空闲 kcp 的检查间隔
+    static constexpr auto idle_interval = std::chrono::milliseconds(1000);
+
+    // 嵌入到连接中的调度节点
+    class node {
+      public:
+        explicit node(IKCPCB* kcp = nullptr) : kcp(kcp) {}
+
+        SIMPLE_NON_COPYABLE(node)
+
+        ~node() noexcept = default;
+
+        [[nodiscard]] bool linked() const { return slot_ != no_slot; }
+
+        IKCPCB* kcp;
+        // 每次 ikcp_update 之后调用，用来结束 fec 分组等
+        void (*updated)(void* user){nullptr};
+        void* user{nullptr};
+
+      private:
+        friend class kcp_driver;
+        uint32_t slot_{no_slot};
+        uint32_t index_{0};
+    };
+
+    explicit kcp_driver(const asio::any_io_executor& executor);
+
+    SIMPLE_NON_COPYABLE(kcp_driver)
+
+    ~kcp_driver() noexcept = default;
+
+    // 有新的数据收发，尽快 update，未加入调度的节点会被加入
+    void wake(node& n);
+
+    // 移除节点，连接关闭或者释放 kcp 之前调用
+    void remove(node& n);
+
+    void stop();
+
+    [[nodiscard]] size_t size() const { return count_; }
+
+    // 当前时间，和 ikcp 使用的毫秒时钟一致
+    static uint32_t now_ms();
+
+  private:
+    static constexpr uint32_t no_slot = UINT32_MAX;
+    static constexpr uint32_t ready_slot = wheel_size;
+    static constexpr uint32_t idle_slot = wheel_size + 1;
+    // 已经从槽中取出，正在等待 update
+    static constexpr uint32_t due_slot = wheel_size + 2;
+    static constexpr uint32_t wheel_mask = wheel_size - 1;
+
+    void link(node& n, uint32_t slot);
+
+    void unlink(node& n);
+
+    // 把槽中的节点全部取出到 due_
+    void take(uint32_t slot);
+
+    void run_due(uint32_t current);
+
+    // 时间轮推进到 current，取出到期的节点
+    void advance(uint32_t current);
+
+    // update 一次，然后按照下一次需要 update 的时间重新放入时间轮或者空闲桶
+    void drive(node& n, uint32_t current);
+
+    void run_ready();
+
+    void run_timer();
+
+    // 找到时间轮中最近的非空槽，返回距离 tick_ 的毫秒数，没有时返回 0
+    [[nodiscard]] uint32_t next_delta() const;
+
+    void arm();
+
+    asio::any_io_executor executor_;
+    asio::steady_timer timer_;
+    clock_type::time_point armed_{clock_type::time_point::max()};
+    clock_type::time_point idle_check_;
+    std::array<std::vector<node*>, wheel_size + 2> slots_;
+    std::array<uint64_t, wheel_size / 64> bitmap_{};
+    // 时间轮已经处理到的时间，时间轮中的节点到期时间都在 (tick_, tick_ + wheel_size) 之间
+    uint32_t tick_;
+    size_t count_{0};
+    bool ready_posted_{false};
+    bool stopped_{false};
+    // 本轮需要 update 的节点，update 过程中被移除的节点置空
+    std::vector<node*> due_;
+};
+
+}  // namespace simple
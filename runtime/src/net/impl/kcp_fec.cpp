@@ -0,0 +1,314 @@
+﻿#include "kcp_fec.h"
+
+#include <algorithm>
+#include <bit>
+#include <utility>
+
+namespace simple {
+
+struct gf_tables {
+    std::array<uint8_t, 512> exp{};
+    std::array<uint8_t, 256> log{};
+};
+
+// 本原多项式 x^8 + x^4 + x^3 + x^2 + 1
+static constexpr gf_tables make_gf_tables() {
+    gf_tables tables;
+    uint32_t x = 1;
+    for (uint32_t i = 0; i < 255; ++i) {
+        tables.exp[i] = static_cast<uint8_t>(x);
+        tables.log[x] = static_cast<uint8_t>(i);
+        x <<= 1;
+        if (x & 0x100) {
+            x ^= 0x11d;
+        }
+    }
+    for (uint32_t i = 255; i < tables.exp.size(); ++i) {
+        tables.exp[i] = tables.exp[i - 255];
+    }
+    return tables;
+}
+
+static constexpr gf_tables gf = make_gf_tables();
+
+static uint8_t gf_mul(uint8_t a, uint8_t b) {
+    if (a == 0 || b == 0) return 0;
+    return gf.exp[gf.log[a] + gf.log[b]];
+}
+
+static uint8_t gf_inv(uint8_t a) { return gf.exp[255 - gf.log[a]]; }
+
+// Cauchy 矩阵 1 / (x_row + y_col)，x_row = 255 - row，y_col = col，分片数量不超过 256 时 x 和 y 不会相同
+static uint8_t cauchy(size_t row, size_t col) { return gf_inv(static_cast<uint8_t>((255 - row) ^ col)); }
+
+// dst += c * src
+static void mul_add(uint8_t* dst, const uint8_t* src, uint8_t c, size_t size) {
+    if (c == 0) return;
+    if (c == 1) {
+        for (size_t i = 0; i < size; ++i) {
+            dst[i] ^= src[i];
+        }
+        return;
+    }
+
+    const auto lc = gf.log[c];
+    for (size_t i = 0; i < size; ++i) {
+        if (src[i]) {
+            dst[i] ^= gf.exp[lc + gf.log[src[i]]];
+        }
+    }
+}
+
+void reed_solomon::encode(const uint8_t* const* data, size_t data_count, uint8_t* const* parity, size_t parity_count,
+                          size_t size) {
+    for (size_t row = 0; row < parity_count; ++row) {
+        memset(parity[row], 0, size);
+        for (size_t col = 0; col < data_count; ++col) {
+            mul_add(parity[row], data[col], cauchy(row, col), size);
+        }
+    }
+}
+
+bool reed_solomon::reconstruct(uint8_t* const* shards, size_t data_count, size_t parity_count, uint64_t present,
+                               size_t size) {
+    constexpr size_t max_count = kcp_fec_max_data;
+    if (data_count == 0 || data_count > max_count) return false;
+
+    // 选出 data_count 个收到的分片，组成编码矩阵中对应的行
+    uint8_t matrix[max_count][max_count * 2]{};
+    const uint8_t* sources[max_count]{};
+    size_t rows = 0;
+    for (size_t i = 0; i < data_count && rows < data_count; ++i) {
+        if (present & (uint64_t{1} << i)) {
+            matrix[rows][i] = 1;
+            sources[rows++] = shards[i];
+        }
+    }
+    for (size_t i = 0; i < parity_count && rows < data_count; ++i) {
+        if (present & (uint64_t{1} << (data_count + i))) {
+            for (size_t col = 0; col < data_count; ++col) {
+                matrix[rows][col] = cauchy(i, col);
+            }
+            sources[rows++] = shards[data_count + i];
+        }
+    }
+
+    if (rows < data_count) return false;
+
+    // 高斯-约旦消元求逆矩阵，右半边是结果
+    const auto n = data_count;
+    for (size_t i = 0; i < n; ++i) {
+        matrix[i][n + i] = 1;
+    }
+    for (size_t col = 0; col < n; ++col) {
+        size_t pivot = col;
+        while (pivot < n && matrix[pivot][col] == 0) {
+            ++pivot;
+        }
+        if (pivot == n) return false;
+        if (pivot != col) {
+            std::swap_ranges(matrix[col], matrix[col] + n * 2, matrix[pivot]);
+        }
+
+        if (const auto inv = gf_inv(matrix[col][col]); inv != 1) {
+            for (size_t k = 0; k < n * 2; ++k) {
+                matrix[col][k] = gf_mul(matrix[col][k], inv);
+            }
+        }
+
+        for (size_t row = 0; row < n; ++row) {
+            if (row == col || matrix[row][col] == 0) continue;
+            const auto factor = matrix[row][col];
+            for (size_t k = 0; k < n * 2; ++k) {
+                matrix[row][k] ^= gf_mul(factor, matrix[col][k]);
+            }
+        }
+    }
+
+    // 只计算缺失的数据分片
+    for (size_t i = 0; i < data_count; ++i) {
+        if (present & (uint64_t{1} << i)) continue;
+        memset(shards[i], 0, size);
+        for (size_t row = 0; row < n; ++row) {
+            mul_add(shards[i], sources[row], matrix[i][n + row], size);
+        }
+    }
+    return true;
+}
+
+static void write_fec_head(uint8_t* packet, uint32_t conv, uint32_t seq, uint32_t index, uint32_t data_count,
+                           uint32_t parity_count) {
+    constexpr auto head = make_kcp_head(kcp_code::fec);
+    memcpy(packet, &head, sizeof(head));
+    auto* fec_head = packet + kcp_head_size;
+    const uint32_t values[2]{htonl(conv), htonl(seq)};
+    memcpy(fec_head, values, sizeof(values));
+    fec_head[8] = static_cast<uint8_t>(index);
+    fec_head[9] = static_cast<uint8_t>(data_count);
+    fec_head[10] = static_cast<uint8_t>(parity_count);
+    fec_head[11] = 0;
+}
+
+kcp_fec_encoder::kcp_fec_encoder(uint32_t conv, uint32_t data_shards, uint32_t parity_shards, uint32_t max_mtu)
+    : conv_(conv),
+      data_shards_(data_shards),
+      parity_shards_(parity_shards),
+      packet_size_(max_mtu),
+      buffer_(static_cast<size_t>(data_shards + parity_shards) * max_mtu) {}
+
+size_t kcp_fec_encoder::write_data_shard(uint8_t* packet, const char* data, size_t len) {
+    // 数据分片的组内数据分片数还不确定，写 0
+    write_fec_head(packet, conv_, seq_, count_, 0, parity_shards_);
+    auto* shard = packet + kcp_head_size + kcp_fec_head_size;
+    len = std::min(len, packet_size_ - kcp_head_size - kcp_fec_overhead);
+    const auto n = htons(static_cast<uint16_t>(len));
+    memcpy(shard, &n, sizeof(n));
+    memcpy(shard + sizeof(n), data, len);
+
+    const auto shard_len = sizeof(n) + len;
+    shard_size_ = std::max(shard_size_, shard_len);
+    return shard_len;
+}
+
+uint32_t kcp_fec_encoder::make_parity() {
+    const uint8_t* data[kcp_fec_max_data];
+    uint8_t* parity[kcp_fec_max_parity];
+    for (uint32_t i = 0; i < count_; ++i) {
+        // 短的数据分片补 0 到同样的长度
+        auto* shard = packet_at(i) + kcp_head_size + kcp_fec_head_size;
+        uint16_t n;
+        memcpy(&n, shard, sizeof(n));
+        const auto shard_len = sizeof(n) + ntohs(n);
+        memset(shard + shard_len, 0, shard_size_ - shard_len);
+        data[i] = shard;
+    }
+
+    for (uint32_t i = 0; i < parity_shards_; ++i) {
+        auto* packet = packet_at(data_shards_ + i);
+        write_fec_head(packet, conv_, seq_, data_shards_ + i, count_, parity_shards_);
+        parity[i] = packet + kcp_head_size + kcp_fec_head_size;
+    }
+
+    reed_solomon::encode(data, count_, parity, parity_shards_, shard_size_);
+    return parity_shards_;
+}
+
+kcp_fec_decoder::kcp_fec_decoder(uint32_t data_shards, uint32_t parity_shards, uint32_t max_mtu)
+    : data_shards_(data_shards), parity_shards_(parity_shards), shard_capacity_(max_mtu - kcp_head_size - kcp_fec_head_size) {}
+
+kcp_fec_decoder::group* kcp_fec_decoder::store(const uint8_t* packet, size_t len, const uint8_t*& payload,
+                                               size_t& payload_len) {
+    if (len < kcp_head_size + kcp_fec_head_size) {
+        return nullptr;
+    }
+
+    const auto* fec_head = packet + kcp_head_size;
+    uint32_t seq;
+    memcpy(&seq, fec_head + sizeof(uint32_t), sizeof(seq));
+    seq = ntohl(seq);
+    const uint32_t index = fec_head[8];
+    const uint32_t data_count = fec_head[9];
+    const auto* shard = fec_head + kcp_fec_head_size;
+    const auto shard_len = len - kcp_head_size - kcp_fec_head_size;
+    if (index >= data_shards_ + parity_shards_ || shard_len > shard_capacity_) {
+        return nullptr;
+    }
+
+    const auto is_data = index < data_shards_;
+    if (is_data && !read_data_shard(shard, shard_len, payload, payload_len)) {
+        return nullptr;
+    }
+
+    if (!is_data && (data_count == 0 || data_count > data_shards_)) {
+        return nullptr;
+    }
+
+    auto& g = groups_[seq % window_size];
+    if (!g.used || static_cast<int32_t>(seq - g.seq) > 0) {
+        g.seq = seq;
+        g.used = true;
+        g.done = false;
+        g.data_count = 0;
+        g.shard_size = 0;
+        g.present = 0;
+        g.recovered = 0;
+    } else if (g.seq != seq) {
+        // 已经过期的组，数据分片照常交给 kcp
+        return nullptr;
+    }
+
+    const auto bit = uint64_t{1} << index;
+    if (g.done || (g.present & bit)) {
+        return nullptr;
+    }
+
+    if (g.buffer.empty()) {
+        g.buffer.resize((data_shards_ + parity_shards_) * shard_capacity_);
+    }
+
+    auto* dest = shard_at(g, index);
+    memcpy(dest, shard, shard_len);
+    if (is_data) {
+        memset(dest + shard_len, 0, shard_capacity_ - shard_len);
+    } else {
+        g.data_count = data_count;
+        g.shard_size = shard_len;
+    }
+    g.present |= bit;
+    return &g;
+}
+
+bool kcp_fec_decoder::recover(group& g) {
+    if (g.done || g.data_count == 0) {
+        return false;
+    }
+
+    const auto data_mask = (uint64_t{1} << g.data_count) - 1;
+    const auto data_present = g.present & data_mask;
+    if (data_present == data_mask) {
+        g.done = true;
+        return false;
+    }
+
+    const auto parity_present = (g.present >> data_shards_) & ((uint64_t{1} << parity_shards_) - 1);
+    if (static_cast<uint32_t>(std::popcount(data_present) + std::popcount(parity_present)) < g.data_count) {
+        return false;
+    }
+
+    uint8_t* shards[kcp_fec_max_data + kcp_fec_max_parity];
+    for (uint32_t i = 0; i < g.data_count; ++i) {
+        shards[i] = shard_at(g, i);
+    }
+    for (uint32_t i = 0; i < parity_shards_; ++i) {
+        shards[g.data_count + i] = shard_at(g, data_shards_ + i);
+    }
+
+    const auto present = data_present | parity_present << g.data_count;
+    if (!reed_solomon::reconstruct(shards, g.data_count, parity_shards_, present, g.shard_size)) {
+        return false;
+    }
+
+    g.recovered = data_mask & ~data_present;
+    g.done = true;
+    return true;
+}
+
+bool kcp_fec_decoder::read_data_shard(const uint8_t* shard, size_t shard_len, const uint8_t*& payload,
+                                      size_t& payload_len) {
+    uint16_t n;
+    if (shard_len < sizeof(n)) {
+        return false;
+    }
+
+    memcpy(&n, shard, sizeof(n));
+    n = ntohs(n);
+    if (sizeof(n) + n > shard_len) {
+        return false;
+    }
+
+    payload = shard + sizeof(n);
+    payload_len = n;
+    return true;
+}
+
+}  // namespace simple
@@ -0,0 +1,143 @@
+﻿#pragma once
+#include <simple/config.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "kcp_config.h"
+
+namespace simple {
+
+// GF(2^8) 上的 Reed-Solomon 编码，校验部分使用 Cauchy 矩阵，收到任意数据分片数量个分片就能恢复出全部数据
+class reed_solomon {
+  public:
+    // 根据 data_count 个长度为 size 的数据分片计算 parity_count 个校验分片
+    static void encode(const uint8_t* const* data, size_t data_count, uint8_t* const* parity, size_t parity_count,
+                       size_t size);
+
+    // shards 前 data_count 个是数据分片，之后是校验分片，present 按位标记收到的分片
+    // 恢复缺失的数据分片，收到的分片不够时返回 false
+    static bool reconstruct(uint8_t* const* shards, size_t data_count, size_t parity_count, uint64_t present,
+                            size_t size);
+};
+
+// kcp 的 fec 层，放在 ikcp 的输出和 udp 之间
+// fec 包: kcp_head + conv(4) + 组序号(4) + 分片序号(1) + 组内数据分片数(1) + 校验分片数(1) + 保留(1) + 分片
+// 数据分片是 2 字节长度加上 ikcp 输出的数据，立即发送；校验分片按组内最长的数据分片计算，组满或者 flush 时发送
+// 分片序号小于配置的数据分片数的是数据分片，否则是校验分片
+class kcp_fec_encoder {
+  public:
+    kcp_fec_encoder(uint32_t conv, uint32_t data_shards, uint32_t parity_shards, uint32_t max_mtu);
+
+    SIMPLE_NON_COPYABLE(kcp_fec_encoder)
+
+    ~kcp_fec_encoder() noexcept = default;
+
+    // output(const uint8_t* data, size_t len) 发送一个 udp 包
+    template <typename Output>
+    void encode(const char* data, size_t len, Output&& output) {
+        auto* packet = packet_at(count_);
+        const auto shard_len = write_data_shard(packet, data, len);
+        output(packet, kcp_head_size + kcp_fec_head_size + shard_len);
+        if (++count_ == data_shards_) {
+            flush(output);
+        }
+    }
+
+    // 一次 kcp update 结束后调用，组内还有数据分片时提前结束这一组，发送校验分片
+    template <typename Output>
+    void flush(Output&& output) {
+        if (count_ == 0) return;
+
+        const auto parity_count = make_parity();
+        for (uint32_t i = 0; i < parity_count; ++i) {
+            output(packet_at(data_shards_ + i), kcp_head_size + kcp_fec_head_size + shard_size_);
+        }
+        ++seq_;
+        count_ = 0;
+        shard_size_ = 0;
+    }
+
+  private:
+    uint8_t* packet_at(uint32_t index) { return buffer_.data() + static_cast<size_t>(index) * packet_size_; }
+
+    size_t write_data_shard(uint8_t* packet, const char* data, size_t len);
+
+    uint32_t make_parity();
+
+    uint32_t conv_;
+    uint32_t data_shards_;
+    uint32_t parity_shards_;
+    size_t packet_size_;
+    std::vector<uint8_t> buffer_;
+    uint32_t seq_{0};
+    uint32_t count_{0};
+    size_t shard_size_{0};
+};
+
+// 接收 fec 包，数据分片直接交给 kcp，同一组收到足够的分片后恢复丢失的数据分片
+class kcp_fec_decoder {
+  public:
+    kcp_fec_decoder(uint32_t data_shards, uint32_t parity_shards, uint32_t max_mtu);
+
+    SIMPLE_NON_COPYABLE(kcp_fec_decoder)
+
+    ~kcp_fec_decoder() noexcept = default;
+
+    // deliver(const uint8_t* data, size_t len) 收到或者恢复出来的 kcp 数据，返回 false 时停止处理
+    template <typename Deliver>
+    bool decode(const uint8_t* packet, size_t len, Deliver&& deliver) {
+        const uint8_t* payload = nullptr;
+        size_t payload_len = 0;
+        auto* group = store(packet, len, payload, payload_len);
+        if (payload && !deliver(payload, payload_len)) {
+            return false;
+        }
+
+        if (group && recover(*group)) {
+            for (uint32_t i = 0; i < group->data_count; ++i) {
+                if (group->recovered & (uint64_t{1} << i)) {
+                    if (read_data_shard(shard_at(*group, i), group->shard_size, payload, payload_len) &&
+                        !deliver(payload, payload_len)) {
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+  private:
+    struct group {
+        uint32_t seq{0};
+        bool used{false};
+        bool done{false};
+        // 组内数据分片的数量，收到校验分片后才知道
+        uint32_t data_count{0};
+        size_t shard_size{0};
+        uint64_t present{0};
+        uint64_t recovered{0};
+        std::vector<uint8_t> buffer;
+    };
+
+    // 最近的几组
+    static constexpr size_t window_size = 4;
+
+    uint8_t* shard_at(group& g, uint32_t index) const { return g.buffer.data() + index * shard_capacity_; }
+
+    // 保存分片，返回需要检查恢复的组，数据分片通过 payload 返回
+    group* store(const uint8_t* packet, size_t len, const uint8_t*& payload, size_t& payload_len);
+
+    bool recover(group& g);
+
+    static bool read_data_shard(const uint8_t* shard, size_t shard_len, const uint8_t*& payload, size_t& payload_len);
+
+    uint32_t data_shards_;
+    uint32_t parity_shards_;
+    size_t shard_capacity_;
+    std::array<group, window_size> groups_;
+};
+
+}  // namespace simple
@@ -3,17 +3,36 @@
 #include <simple/error.h>
 #include <simple/log/log.h>
 #include <simple/net/socket_system.h>
+#include <simple/utils/crypt.h>
 
 #include <asio/co_spawn.hpp>
 #include <asio/detached.hpp>
-#include <ranges>
+#include <asio/dispatch.hpp>
+#include <asio/post.hpp>
+#include <random>
 
 #include "kcp_config.h"
 #include "kcp_session_impl.h"
 
 namespace simple {
 
-kcp_server_impl::kcp_server_impl(uint32_t socket_id) : socket_base(socket_id), listen_(socket_system::instance().context()) {}
+kcp_server_impl::kcp_server_impl(uint32_t socket_id, const kcp_profile& profile)
+    : socket_base(socket_id),
+      profile_(kcp_check_profile(profile)),
+      listen_(socket_system::instance().context()),
+      batch_(kcp_server_batch_size, profile_.max_mtu) {
+    std::random_device rd;
+    for (auto& v : cookie_secret_) {
+        v = static_cast<uint8_t>(rd());
+    }
+
+    const auto threaded = profile_.shards > 0;
+    const auto count = std::max(profile_.shards, 1u);
+    auto& context = socket_system::instance().context();
+    for (uint32_t i = 0; i < count; ++i) {
+        shards_.emplace_back(std::make_shared<kcp_shard>(i, listen_, profile_.max_mtu, context, threaded));
+    }
+}
 
 void kcp_server_impl::start(const udp::endpoint& endpoint, bool reuse) {
     info("kcp server {} start", socket_id_);
@@ -24,6 +43,18 @@ void kcp_server_impl::start(const udp::endpoint& endpoint, bool reuse) {
     if (ec) return stop(ec);
     listen_.set_option(udp::socket::reuse_address{reuse}, ec);
     if (ec) return stop(ec);
+    listen_.non_blocking(true, ec);
+    if (ec) return stop(ec);
+    if (profile_.mtu_probe) {
+        udp_batch::dont_fragment(listen_);
+    }
+
+    for (const auto& shard : shards_) {
+        shard->start();
+    }
+    if (profile_.shards > 0) {
+        info("kcp server {} shards {}", socket_id_, profile_.shards);
+    }
 
     auto self = shared_from_this();
     auto& system = socket_system::instance();
@@ -46,9 +77,14 @@ void kcp_server_impl::stop(const std::error_code& ec) {
 
     info("kcp server {} stop", socket_id_);
 
-    for (auto sessions = std::move(sessions_); const auto& session : sessions | std::views::values) {
-        session->stop(ec);
+    // 每个分片停止自己的连接，多线程时等待分片的线程退出
+    for (const auto& shard : shards_) {
+        shard->stop(ec);
     }
+    std::ignore = convs_.take_all();
+
+    // 关闭之前把 disconnect 等控制包发出去
+    batch_.send(listen_);
 
     std::error_code ignore;
     listen_.close(ignore);
@@ -57,73 +93,213 @@ void kcp_server_impl::stop(const std::error_code& ec) {
     system.erase(socket_id_);
 }
 
-void kcp_server_impl::erase(uint32_t session) { sessions_.erase(session); }
+void kcp_server_impl::erase(uint32_t conv) {
+    if (auto& context = socket_system::instance().context(); !context.get_executor().running_in_this_thread()) {
+        asio::post(context, [self = shared_from_this(), conv]() { self->erase(conv); });
+        return;
+    }
 
-void kcp_server_impl::write_to(const udp::endpoint& dest, std::vector<uint8_t> data) {
-    auto self = shared_from_this();
-    const auto msg = std::make_shared<std::vector<uint8_t>>(std::move(data));
-    listen_.async_send_to(asio::buffer(msg->data(), msg->size()), dest, [self, msg](const std::error_code&, size_t) {
-        std::ignore = self;
-        std::ignore = msg;
+    convs_.erase(conv);
+}
+
+std::vector<kcp_shard_stat> kcp_server_impl::shard_stats() const {
+    std::vector<kcp_shard_stat> stats;
+    stats.reserve(shards_.size());
+    for (const auto& shard : shards_) {
+        stats.emplace_back(shard->stat());
+    }
+    return stats;
+}
+
+void kcp_server_impl::write_to(const udp::endpoint& dest, const kcp_ctrl_packet& ctrl) {
+    batch_.push(dest, ctrl.data(), ctrl.size());
+    post_flush();
+}
+
+void kcp_server_impl::write_to(const udp::endpoint& dest, const void* data, size_t len) {
+    batch_.push(dest, data, len);
+    post_flush();
+}
+
+void kcp_server_impl::post_flush() {
+    if (flushing_) return;
+
+    flushing_ = true;
+    asio::post(listen_.get_executor(), [self = shared_from_this()]() { self->flush(); });
+}
+
+void kcp_server_impl::flush() {
+    if (!listen_.is_open()) return;
+
+    if (batch_.send(listen_)) {
+        flushing_ = false;
+        return;
+    }
+
+    // 发送缓冲区满了，等待可写
+    listen_.async_wait(udp::socket::wait_write, [self = shared_from_this()](const std::error_code& ec) {
+        if (!ec) {
+            self->flush();
+        }
     });
 }
 
 asio::awaitable<void> kcp_server_impl::co_read() {
     auto self = shared_from_this();
-    uint8_t data[udp_mtu];
     for (;;) {
-        udp::endpoint remote_endpoint;
-        auto [ec, len] = co_await listen_.async_receive_from(asio::buffer(data), remote_endpoint, use_awaitable_as_tuple);
+        auto [ec] = co_await listen_.async_wait(udp::socket::wait_read, use_awaitable_as_tuple);
         if (ec) {
             stop(ec);
             co_return;
         }
 
-        if (len < kcp_head_size) {
-            continue;
-        }
+        // 一次唤醒把已经到达的包全部读完
+        size_t count;
+        do {
+            count = batch_.receive(listen_, ec);
+            if (ec) {
+                stop(ec);
+                co_return;
+            }
 
-        const auto* head = reinterpret_cast<kcp_head*>(data);
-        if (head->magic1 != kcp_magic1 || head->magic2 != kcp_magic2 || head->magic3 != kcp_magic3) {
-            continue;
-        }
+            for (size_t i = 0; i < count; ++i) {
+                hand_read(batch_.data(i), batch_.size(i), batch_.remote(i));
+            }
+            for (const auto& shard : shards_) {
+                shard->commit();
+            }
+        } while (count == batch_.capacity());
+    }
+}
 
-        // hand data
-        if (head->code == kcp_code::connect) {
-            hand_accept(std::move(remote_endpoint));
-            continue;
-        }
+void kcp_server_impl::hand_read(uint8_t* data, size_t len, const udp::endpoint& remote) {
+    if (len < kcp_head_size) {
+        return;
+    }
 
-        uint32_t conv;
-        if (head->code == kcp_code::data) {
-            conv = ikcp_getconv(data + kcp_head_size);
-        } else {
-            if (len < kcp_head_size + sizeof(uint32_t)) {
-                continue;
-            }
-            memcpy(&conv, data + kcp_head_size, sizeof(conv));
-            conv = ntohl(conv);
-        }
+    const auto* head = reinterpret_cast<kcp_head*>(data);
+    if (head->magic1 != kcp_magic1 || head->magic2 != kcp_magic2 || head->magic3 != kcp_magic3) {
+        return;
+    }
 
-        if (const auto it = sessions_.find(conv); it != sessions_.end()) {
-            it->second->read(data, len);
+    // hand data
+    if (head->code == kcp_code::connect) {
+        return hand_accept(remote, data, len);
+    }
+
+    if (uint32_t conv; read_kcp_conv(data, len, conv)) {
+        if (auto* shard = convs_.find(conv)) {
+            shard->dispatch(conv, data, len, remote);
         }
     }
 }
 
-void kcp_server_impl::hand_accept(udp::endpoint remote) {
+void kcp_server_impl::hand_accept(const udp::endpoint& remote, const uint8_t* data, size_t len) {
+    // 老版本的客户端不认识 cookie，只能直接创建连接
+    const auto remote_option = read_kcp_connect(data, len);
+    const auto legacy = len < kcp_connect_size;
+    if (legacy && !profile_.legacy_connect) {
+        trace_reject();
+        return;
+    }
+
+    // 第一次 connect 只回复 cookie，回复和请求一样大，不会被用来放大流量
+    const auto cookie = read_kcp_connect_cookie(data, len);
+    if (!legacy && cookie == 0) {
+        const auto period = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch() / kcp_cookie_interval);
+        const auto challenge = make_kcp_connect(kcp_code::connect_cookie, 0, remote_option, make_cookie(remote, period));
+        write_to(remote, challenge.data(), challenge.size());
+        return;
+    }
+
+    if (!legacy && !check_cookie(remote, cookie)) {
+        trace_reject();
+        return;
+    }
+
+    // udp 没有 backlog，超过速率直接拒绝
+    if (accept_limiter_ && (accept_limiter_->throttle() > accept_limiter::clock_type::duration::zero() ||
+                            !accept_limiter_->acquire(remote.address()))) {
+        trace_reject();
+        write_to(remote, make_kcp_ctrl(kcp_code::disconnect, 0));
+        return;
+    }
+
     auto& system = socket_system::instance();
     const auto id = system.new_socket_id(socket_type::kcp_session);
     if (id == 0) {
         warn("kcp server {} accept fail, no new socket id", socket_id_);
+        if (accept_limiter_) {
+            accept_limiter_->release(remote.address());
+        }
+        write_to(remote, make_kcp_ctrl(kcp_code::disconnect, 0));
+        return;
+    }
+
+    // 双方都能接受的包大小和 fec 参数
+    const auto option = kcp_negotiate(remote_option, profile_);
+
+    // 新连接轮流分配到各个分片
+    const auto address = remote.address();
+    auto& shard = *shards_[next_shard_++ % shards_.size()];
+    const auto conv = convs_.insert(&shard);
+    if (conv == 0) {
+        warn("kcp server {} accept fail, no free conv", socket_id_);
+        if (accept_limiter_) {
+            accept_limiter_->release(address);
+        }
         write_to(remote, make_kcp_ctrl(kcp_code::disconnect, 0));
         return;
     }
 
-    trace_read(1);
-    const auto session = std::make_shared<kcp_session_impl>(id, std::move(remote), *this);
-    sessions_[id] = session.get();
-    session->start(socket_id_);
+    trace_accept();
+    const auto session = std::make_shared<kcp_session_impl>(id, remote, *this, shard, option);
+    session->inherit(*this, address);
+    asio::dispatch(shard.executor(), [session, conv, acceptor_id = socket_id_]() { session->start(acceptor_id, conv); });
+}
+
+uint64_t kcp_server_impl::make_cookie(const udp::endpoint& remote, uint64_t period) const {
+    // 地址、端口和时间周期
+    uint8_t input[16 + sizeof(uint16_t) + sizeof(uint64_t)]{};
+    size_t size = 0;
+    if (const auto address = remote.address(); address.is_v4()) {
+        const auto bytes = address.to_v4().to_bytes();
+        memcpy(input, bytes.data(), bytes.size());
+        size = bytes.size();
+    } else {
+        const auto bytes = address.to_v6().to_bytes();
+        memcpy(input, bytes.data(), bytes.size());
+        size = bytes.size();
+    }
+    const auto port = remote.port();
+    memcpy(input + size, &port, sizeof(port));
+    size += sizeof(port);
+    memcpy(input + size, &period, sizeof(period));
+    size += sizeof(period);
+
+    sha1_data digest;
+    hmac_sha1(digest, {reinterpret_cast<const char*>(input), size},
+              {reinterpret_cast<const char*>(cookie_secret_.data()), cookie_secret_.size()});
+    uint64_t cookie;
+    memcpy(&cookie, digest.data(), sizeof(cookie));
+    // 0 表示没有 cookie
+    return cookie == 0 ? 1 : cookie;
+}
+
+uint64_t kcp_server_impl::make_token(uint32_t socket_id, uint32_t conv) const {
+    const uint32_t input[2]{socket_id, conv};
+    sha1_data digest;
+    hmac_sha1(digest, {reinterpret_cast<const char*>(input), sizeof(input)},
+              {reinterpret_cast<const char*>(cookie_secret_.data()), cookie_secret_.size()});
+    uint64_t token;
+    memcpy(&token, digest.data(), sizeof(token));
+    // 0 表示没有 token
+    return token == 0 ? 1 : token;
+}
+
+bool kcp_server_impl::check_cookie(const udp::endpoint& remote, uint64_t cookie) const {
+    const auto period = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch() / kcp_cookie_interval);
+    return cookie == make_cookie(remote, period) || cookie == make_cookie(remote, period - 1);
 }
 
 }  // namespace simple
@@ -4,20 +4,22 @@
 #include <asio/awaitable.hpp>
 #include <asio/ip/udp.hpp>
 #include <asio/use_awaitable.hpp>
-#include <unordered_map>
+#include <array>
 
+#include "kcp_config.h"
+#include "kcp_conv_table.hpp"
+#include "kcp_shard.h"
 #include "socket_impl.hpp"
+#include "udp_batch.h"
 
 namespace simple {
 
-class kcp_session_impl;
-
 class kcp_server_impl final : public socket_base, public std::enable_shared_from_this<kcp_server_impl> {
   public:
     using asio_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
     using udp = asio::ip::udp;
 
-    explicit kcp_server_impl(uint32_t socket_id);
+    kcp_server_impl(uint32_t socket_id, const kcp_profile& profile);
 
     ~kcp_server_impl() noexcept override = default;
 
@@ -27,19 +29,52 @@ class kcp_server_impl final : public socket_base, public std::enable_shared_from
 
     void stop(const std::error_code& ec) override;
 
-    void erase(uint32_t session);
+    // 任何线程都可以调用，释放连接占用的 conv
+    void erase(uint32_t conv);
 
     auto& socket() { return listen_; }
 
-    void write_to(const udp::endpoint& dest, std::vector<uint8_t> data);
+    [[nodiscard]] const auto& profile() const { return profile_; }
+
+    // 发送控制包，连接的数据由所在的分片发送
+    void write_to(const udp::endpoint& dest, const kcp_ctrl_packet& ctrl);
+
+    void write_to(const udp::endpoint& dest, const void* data, size_t len);
+
+    // 任何线程都可以调用
+    [[nodiscard]] std::vector<kcp_shard_stat> shard_stats() const;
+
+    // 连接迁移地址时验证的 token，在 connect_ack 中下发，任何线程都可以调用
+    [[nodiscard]] uint64_t make_token(uint32_t socket_id, uint32_t conv) const;
 
   private:
     asio::awaitable<void> co_read();
 
-    void hand_accept(udp::endpoint remote);
+    void hand_read(uint8_t* data, size_t len, const udp::endpoint& remote);
+
+    void hand_accept(const udp::endpoint& remote, const uint8_t* data, size_t len);
+
+    // 根据地址和时间周期计算 connect cookie，不保存任何状态
+    [[nodiscard]] uint64_t make_cookie(const udp::endpoint& remote, uint64_t period) const;
+
+    [[nodiscard]] bool check_cookie(const udp::endpoint& remote, uint64_t cookie) const;
+
+    void post_flush();
+
+    // 发送队列中的包，一轮事件中产生的包合并到一次发送
+    void flush();
 
+    kcp_profile profile_;
     udp::socket listen_;
-    std::unordered_map<uint32_t, kcp_session_impl*> sessions_;
+    // conv 到连接所在分片的映射，分片中再按 conv 找到连接
+    kcp_conv_table<kcp_shard> convs_;
+    // 计算 cookie 和 token 的密钥，每个服务器启动时随机生成
+    std::array<uint8_t, 20> cookie_secret_{};
+    // 构造之后不再改变，统计可以在其他线程中读取
+    std::vector<std::shared_ptr<kcp_shard>> shards_;
+    size_t next_shard_{0};
+    udp_batch batch_;
+    bool flushing_{false};
 };
 
 }  // namespace simple
@@ -6,85 +6,110 @@
 
 #include <asio/co_spawn.hpp>
 #include <asio/detached.hpp>
+#include <asio/post.hpp>
+#include <random>
 
 #include "kcp_config.h"
 #include "kcp_server_impl.h"
+#include "kcp_shard.h"
 
 namespace simple {
 
 constexpr kcp_session_impl::asio_token use_awaitable_as_tuple;
 
-kcp_session_impl::kcp_session_impl(uint32_t socket_id, udp::endpoint remote, kcp_server_impl& server)  // NOLINT
+kcp_session_impl::kcp_session_impl(uint32_t socket_id, udp::endpoint remote, kcp_server_impl& server,  // NOLINT
+                                   kcp_shard& shard, const kcp_connect_option& option)
     : socket_base(socket_id),
       remote_(std::move(remote)),
       server_(server),
-      kcp_update_(socket_system::instance().context()),
-      deadline_(socket_system::instance().context()) {}
+      shard_(shard),
+      option_(option),
+      driver_(shard.driver()),
+      deadline_(shard.executor()) {}
 
 kcp_session_impl::~kcp_session_impl() noexcept {
+    driver_->remove(update_node_);
     if (kcp_) {
         ikcp_release(kcp_);
     }
 }
 
-void kcp_session_impl::start(uint32_t acceptor_id) {
-    info("kcp session {} acceptor:{} start", socket_id_, acceptor_id);
+void kcp_session_impl::start(uint32_t acceptor_id, uint32_t conv) {
+    info("kcp session {} acceptor:{} conv:{} start", socket_id_, acceptor_id, conv);
+    conv_ = conv;
     auto& system = socket_system::instance();
     const auto self = shared_from_this();
     system.insert(socket_id_, self);
+    shard_.insert(conv_, this);
 
     std::error_code ignore;
     auto local = server_.socket().local_endpoint(ignore);
     system.hand_accept(acceptor_id, socket_id_, to_string(local), to_string(remote_));
 
-    kcp_ = kcp_create_default(socket_id_, this);
+    kcp_ = kcp_create(conv_, this, server_.profile(), option_);
     ikcp_setoutput(kcp_, [](const char* buf, int len, ikcpcb* kcp, void* user) {
         auto* client = static_cast<kcp_session_impl*>(user);
-        auto output = std::make_shared<std::vector<uint8_t>>();
         client->last_write_ = asio_timer::clock_type::now();
-        client->server_.write_to(client->remote_, make_kcp_data(buf, len));
+        client->write_kcp_output(buf, static_cast<size_t>(len));
         return 0;
     });
+    update_node_.kcp = kcp_;
+
+    if (option_.fec_data > 0) {
+        fec_encoder_ = std::make_unique<kcp_fec_encoder>(conv_, option_.fec_data, option_.fec_parity, option_.max_mtu);
+        fec_decoder_ = std::make_unique<kcp_fec_decoder>(option_.fec_data, option_.fec_parity, option_.max_mtu);
+        // 每次 update 之后结束当前的分组，校验分片不会等到组满才发送
+        update_node_.user = this;
+        update_node_.updated = [](void* user) {
+            auto* session = static_cast<kcp_session_impl*>(user);
+            session->fec_encoder_->flush(
+                [session](const uint8_t* data, size_t len) { session->shard_.write_to(session->remote_, data, len); });
+        };
+        info("kcp session {} fec data:{} parity:{}", socket_id_, option_.fec_data, option_.fec_parity);
+    }
 
     last_read_ = asio_timer::clock_type::now();
     last_write_ = last_read_;
-    server_.write_to(remote_, make_kcp_ctrl(kcp_code::connect_ack, socket_id_));
+    token_ = server_.make_token(socket_id_, conv_);
+    const auto ack = make_kcp_connect(kcp_code::connect_ack, conv_, option_, token_);
+    shard_.write_to(remote_, ack.data(), ack.size());
 }
 
 void kcp_session_impl::accept() {
-    auto& system = socket_system::instance();
     auto self = shared_from_this();
-    auto& context = system.context();
+    if (!shard_.running_in_this_thread()) {
+        asio::post(shard_.executor(), [self]() { self->accept(); });
+        return;
+    }
 
     // 检查协程
     co_spawn(
-        context,
+        shard_.executor(),
         [self, this]() {
             std::ignore = self;
             return co_watchdog();
         },
         asio::detached);
 
-    // kcp update协程
-    co_spawn(
-        context,
-        [self, this]() {
-            std::ignore = self;
-            return co_kcp_update();
-        },
-        asio::detached);
+    driver_->wake(update_node_);
 }
 
 void kcp_session_impl::stop(const std::error_code& ec) {
+    if (!shard_.running_in_this_thread()) {
+        asio::post(shard_.executor(), [self = shared_from_this(), ec]() { self->stop(ec); });
+        return;
+    }
+
     if (!enable_) return;
 
     enable_ = false;
     info("kcp session {} stop", socket_id_);
-    server_.write_to(remote_, make_kcp_ctrl(kcp_code::disconnect, socket_id_));
-    server_.erase(socket_id_);
+    shard_.write_to(remote_, make_kcp_ctrl(kcp_code::disconnect, conv_));
+    shard_.erase(conv_);
+    server_.erase(conv_);
+    driver_->remove(update_node_);
 
     try {
-        kcp_update_.cancel();
         deadline_.cancel();
     } catch (...) {
     }
@@ -95,6 +120,13 @@ void kcp_session_impl::stop(const std::error_code& ec) {
 }
 
 void kcp_session_impl::write(const memory_buffer_ptr& ptr) {
+    if (!shard_.running_in_this_thread()) {
+        asio::post(shard_.executor(), [self = shared_from_this(), ptr]() { self->write(ptr); });
+        return;
+    }
+
+    if (!enable_) return;
+
     auto* data = reinterpret_cast<const char*>(ptr->begin_read());
     auto len = static_cast<int>(ptr->readable());
 
@@ -110,32 +142,68 @@ void kcp_session_impl::write(const memory_buffer_ptr& ptr) {
         return stop(socket_errors::kcp_protocol_error);
     }
 
-    force_update_ = true;
+    driver_->wake(update_node_);
 }
 
 void kcp_session_impl::no_delay(bool on) {
+    if (!shard_.running_in_this_thread()) {
+        asio::post(shard_.executor(), [self = shared_from_this(), on]() { self->no_delay(on); });
+        return;
+    }
+
     if (kcp_) {
-        kcp_no_delay(kcp_, on);
+        kcp_no_delay(kcp_, server_.profile(), on);
+    }
+}
+
+void kcp_session_impl::sync_listener(const listener_settings& listener) {
+    if (!shard_.running_in_this_thread()) {
+        asio::post(shard_.executor(), [self = shared_from_this(), listener]() { self->sync_listener(listener); });
+        return;
     }
+
+    socket_base::sync_listener(listener);
 }
 
-void kcp_session_impl::read(uint8_t* data, size_t len) {
+void kcp_session_impl::frame_codec(const socket_frame_codec& codec) {
+    if (!shard_.running_in_this_thread()) {
+        asio::post(shard_.executor(), [self = shared_from_this(), codec]() { self->frame_codec(codec); });
+        return;
+    }
+
+    socket_base::frame_codec(codec);
+}
+
+void kcp_session_impl::read(uint8_t* data, size_t len, const udp::endpoint& from) {
     const auto* head = reinterpret_cast<kcp_head*>(data);
     trace_read(len);
+    if (from != remote_) {
+        return hand_migrate(data, len, from);
+    }
+
     switch (head->code) {  // NOLINT(clang-diagnostic-switch-enum)
         case kcp_code::disconnect:
             return stop(asio::error::eof);
         case kcp_code::heartbeat:
             last_write_ = asio_timer::clock_type::now();
-            server_.write_to(remote_, make_kcp_ctrl(kcp_code::heartbeat_ack, socket_id_));
+            shard_.write_to(remote_, make_kcp_ctrl(kcp_code::heartbeat_ack, conv_));
             break;
         case kcp_code::heartbeat_ack:
             break;
+        case kcp_code::mtu_probe:
+            hand_mtu_probe(data, len);
+            break;
         case kcp_code::data:
             if (!hand_read_data(data + kcp_head_size, len - kcp_head_size)) {
                 return;
             }
             break;
+        case kcp_code::fec:
+            if (!fec_decoder_ ||
+                !fec_decoder_->decode(data, len, [this](const uint8_t* d, size_t l) { return hand_read_data(d, l); })) {
+                return;
+            }
+            break;
         default:
             return;
     }
@@ -163,7 +231,7 @@ asio::awaitable<void> kcp_session_impl::co_watchdog() {
 
         now = std::chrono::steady_clock::now();
         if (now >= heartbeat_point) {
-            server_.write_to(remote_, make_kcp_ctrl(kcp_code::heartbeat, socket_id_));
+            shard_.write_to(remote_, make_kcp_ctrl(kcp_code::heartbeat, conv_));
             last_write_ = now;
             heartbeat_point = last_write_ + kcp_heartbeat_timeout;
         }
@@ -172,31 +240,6 @@ asio::awaitable<void> kcp_session_impl::co_watchdog() {
     stop(socket_errors::kcp_heartbeat_timeout);
 }
 
-asio::awaitable<void> kcp_session_impl::co_kcp_update() {
-    using namespace std::chrono;
-    auto now = asio_timer::clock_type::now();
-    auto cur = static_cast<uint32_t>(duration_cast<milliseconds>(now.time_since_epoch()).count());
-    auto next = ikcp_check(kcp_, cur);
-    auto next_update = now + milliseconds(next - cur);
-
-    while (enable_) {
-        kcp_update_.expires_after(milliseconds(5));
-        if (auto [ec] = co_await kcp_update_.async_wait(); ec) {
-            co_return;
-        }
-
-        now = asio_timer::clock_type::now();
-        if (now >= next_update || force_update_) {
-            force_update_ = false;
-            ikcp_update(kcp_, static_cast<uint32_t>(duration_cast<milliseconds>(now.time_since_epoch()).count()));
-            now = asio_timer::clock_type::now();
-            cur = static_cast<uint32_t>(duration_cast<milliseconds>(now.time_since_epoch()).count());
-            next = ikcp_check(kcp_, cur);
-            next_update = now + milliseconds(next - cur);
-        }
-    }
-}
-
 bool kcp_session_impl::hand_read_data(const uint8_t* data, size_t len) {
     if (ikcp_getconv(data) != kcp_->conv) {
         stop(socket_errors::kcp_check_failed);
@@ -208,20 +251,85 @@ bool kcp_session_impl::hand_read_data(const uint8_t* data, size_t len) {
         return false;
     }
 
-    force_update_ = true;
+    driver_->wake(update_node_);
 
-    uint8_t temp[kcp_recv_capacity];  // NOLINT(clang-diagnostic-vla-extension)
-    const auto& system = socket_system::instance();
+    // 先取得完整消息的大小，直接接收到交给逻辑线程的缓冲区中
     for (;;) {
-        const auto recv_bytes = ikcp_recv(kcp_, reinterpret_cast<char*>(temp), kcp_recv_capacity);
+        const auto size = ikcp_peeksize(kcp_);
+        if (size <= 0) {
+            break;
+        }
+
+        memory_buffer buf;
+        buf.make_sure_writable(static_cast<size_t>(size));
+        const auto recv_bytes = ikcp_recv(kcp_, reinterpret_cast<char*>(buf.begin_write()), size);
         if (recv_bytes <= 0) {
             break;
         }
-        system.hand_read(socket_id_, temp, recv_bytes);
+        buf.written(static_cast<size_t>(recv_bytes));
+        if (!hand_data(std::move(buf))) {
+            stop(socket_errors::frame_too_large);
+            return false;
+        }
     }
-    std::ignore = temp;
 
     return true;
 }
 
+void kcp_session_impl::hand_mtu_probe(uint8_t* data, size_t len) {
+    const auto [size, confirmed] = read_kcp_mtu_probe(data, len);
+    // 客户端确认过双向都能通过的大小
+    if (confirmed > option_.mtu && confirmed <= option_.max_mtu) {
+        option_.mtu = confirmed;
+        kcp_set_mtu(kcp_, option_.mtu, fec_encoder_ != nullptr);
+        info("kcp session {} mtu {}", socket_id_, option_.mtu);
+    }
+
+    // 原样回复
+    if (size == len && size <= option_.max_mtu) {
+        reinterpret_cast<kcp_head*>(data)->code = kcp_code::mtu_probe_ack;
+        shard_.write_to(remote_, data, len);
+    }
+}
+
+void kcp_session_impl::hand_migrate(const uint8_t* data, size_t len, const udp::endpoint& from) {
+    const auto now = asio_timer::clock_type::now();
+    if (reinterpret_cast<const kcp_head*>(data)->code == kcp_code::migrate) {
+        // 只接受发送 nonce 的地址的回复，每个 nonce 只能用一次
+        if (!enable_ || migrate_nonce_ == 0 || from != migrate_from_ ||
+            read_kcp_migrate(data, len) != kcp_migrate_proof(token_, migrate_nonce_)) {
+            return;
+        }
+
+        // 只改变发送的地址，kcp 的状态不变，没有确认的数据会重传到新地址
+        info("kcp session {} migrate {} -> {}", socket_id_, to_string(remote_), to_string(from));
+        migrate_nonce_ = 0;
+        remote_ = from;
+        last_read_ = now;
+        driver_->wake(update_node_);
+        return;
+    }
+
+    // 不处理其他地址的包，让对端用 token 对随机的 nonce 签名，证明自己是这个连接
+    if (now - last_migrate_ < kcp_migrate_interval) {
+        return;
+    }
+    last_migrate_ = now;
+    thread_local std::mt19937_64 random{std::random_device{}()};
+    do {
+        migrate_nonce_ = random();
+    } while (migrate_nonce_ == 0);
+    migrate_from_ = from;
+    const auto msg = make_kcp_migrate(conv_, migrate_nonce_);
+    shard_.write_to(from, msg.data(), msg.size());
+}
+
+void kcp_session_impl::write_kcp_output(const char* data, size_t len) {
+    if (!fec_encoder_) {
+        return shard_.write_data(remote_, data, len);
+    }
+
+    fec_encoder_->encode(data, len, [this](const uint8_t* packet, size_t size) { shard_.write_to(remote_, packet, size); });
+}
+
 }  // namespace simple
@@ -6,6 +6,9 @@
 #include <asio/use_awaitable.hpp>
 #include <deque>
 
+#include "kcp_config.h"
+#include "kcp_driver.h"
+#include "kcp_fec.h"
 #include "socket_impl.hpp"
 
 // ReSharper disable once IdentifierTypo
@@ -15,6 +18,7 @@ struct IKCPCB;
 namespace simple {
 
 class kcp_server_impl;
+class kcp_shard;
 
 class kcp_session_impl final : public socket_base, public std::enable_shared_from_this<kcp_session_impl> {
   public:
@@ -22,13 +26,17 @@ class kcp_session_impl final : public socket_base, public std::enable_shared_fro
     using udp = asio::ip::udp;
     using asio_timer = asio_token::as_default_on_t<asio::steady_timer>;
 
-    explicit kcp_session_impl(uint32_t socket_id, udp::endpoint remote, kcp_server_impl& server);
+    kcp_session_impl(uint32_t socket_id, udp::endpoint remote, kcp_server_impl& server, kcp_shard& shard,
+                     const kcp_connect_option& option);
 
     ~kcp_session_impl() noexcept override;
 
     SIMPLE_NON_COPYABLE(kcp_session_impl)
 
-    void start(uint32_t acceptor_id);
+    // conv 由服务器分配，用来定位连接，在分片的线程中调用
+    void start(uint32_t acceptor_id, uint32_t conv);
+
+    [[nodiscard]] uint32_t conv() const noexcept { return conv_; }
 
     void accept() override;
 
@@ -38,25 +46,48 @@ class kcp_session_impl final : public socket_base, public std::enable_shared_fro
 
     void no_delay(bool on) override;
 
-    void read(uint8_t* data, size_t len);
+    // 在读取数据的线程中设置分帧规则
+    void frame_codec(const socket_frame_codec& codec) override;
+
+    void sync_listener(const listener_settings& listener) override;
+
+    // 在分片的线程中调用，from 是包的发送方
+    void read(uint8_t* data, size_t len, const udp::endpoint& from);
 
   private:
     asio::awaitable<void> co_watchdog();
 
-    asio::awaitable<void> co_kcp_update();
-
     bool hand_read_data(const uint8_t* data, size_t len);
 
+    void hand_mtu_probe(uint8_t* data, size_t len);
+
+    // 处理和连接地址不同的包
+    void hand_migrate(const uint8_t* data, size_t len, const udp::endpoint& from);
+
+    void write_kcp_output(const char* data, size_t len);
+
     udp::endpoint remote_;
     kcp_server_impl& server_;
-
+    // 连接所在的分片，协议处理和发送都在分片的线程中
+    kcp_shard& shard_;
+
+    uint32_t conv_{0};
+    // 客户端地址变化后迁移连接时验证，nonce 为 0 表示没有等待回复的迁移
+    uint64_t token_{0};
+    uint64_t migrate_nonce_{0};
+    udp::endpoint migrate_from_;
     IKCPCB* kcp_{nullptr};
-    asio_timer kcp_update_;
-    bool force_update_{false};
+    // 协商后的包大小、允许探测的上限和 fec 参数
+    kcp_connect_option option_;
+    std::unique_ptr<kcp_fec_encoder> fec_encoder_;
+    std::unique_ptr<kcp_fec_decoder> fec_decoder_;
+    std::shared_ptr<kcp_driver> driver_;
+    kcp_driver::node update_node_;
     bool enable_{true};
 
     asio_timer::time_point last_read_;
     asio_timer::time_point last_write_;
+    asio_timer::time_point last_migrate_;
     asio_timer deadline_;
 };
 
@@ -0,0 +1,241 @@
+﻿#include "kcp_shard.h"
+
+#include <simple/log/log.h>
+
+#include <asio/post.hpp>
+
+#include "kcp_conv_table.hpp"
+#include "kcp_session_impl.h"
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <ctime>
+#endif
+
+namespace simple {
+
+// 统计 cpu 时间的间隔
+static constexpr auto kcp_shard_stat_interval = std::chrono::seconds(1);
+
+static constexpr uint32_t kcp_shard_index_mask = kcp_conv_table<kcp_session_impl>::index_mask;
+
+// 当前线程使用的 cpu 时间
+static int64_t thread_cpu_micros() {
+#if defined(_WIN32)
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+        return 0;
+    }
+    const auto to_100ns = [](const FILETIME& t) {
+        return static_cast<int64_t>(t.dwHighDateTime) << 32 | static_cast<int64_t>(t.dwLowDateTime);
+    };
+    return (to_100ns(kernel) + to_100ns(user)) / 10;
+#else
+    timespec ts{};
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+        return 0;
+    }
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+kcp_shard::kcp_shard(uint32_t index, udp::socket& socket, size_t datagram_size, asio::io_context& network,
+                     bool threaded)
+    : index_(index),
+      socket_(socket),
+      own_context_(threaded ? std::make_unique<asio::io_context>(1) : nullptr),
+      context_(threaded ? *own_context_ : network),
+      driver_(std::make_shared<kcp_driver>(context_.get_executor())),
+      batch_(kcp_server_batch_size, datagram_size),
+      flush_timer_(context_),
+      stat_timer_(context_) {}
+
+kcp_shard::~kcp_shard() noexcept {
+    if (!thread_.joinable()) return;
+
+    // 没有正常 stop 的时候
+    context_.stop();
+    if (thread_.get_id() == std::this_thread::get_id()) {
+        thread_.detach();
+    } else {
+        thread_.join();
+    }
+}
+
+void kcp_shard::start() {
+    asio::post(context_, [self = shared_from_this()]() { self->update_cpu(); });
+    if (!own_context_) return;
+
+    work_.emplace(context_.get_executor());
+    thread_ = std::thread([this]() {
+        try {
+            context_.run();
+        } catch (std::exception& e) {
+            critical("kcp shard {} thread {}", index_, e.what());
+        }
+    });
+}
+
+void kcp_shard::stop(const std::error_code& ec) {
+    if (!own_context_) {
+        return stop_sessions(ec);
+    }
+
+    if (!thread_.joinable()) return;
+
+    // 分片的线程处理完剩下的事件后退出
+    asio::post(context_, [self = shared_from_this(), ec]() { self->stop_sessions(ec); });
+    work_.reset();
+    thread_.join();
+}
+
+void kcp_shard::stop_sessions(const std::error_code& ec) {
+    for (auto* session : std::exchange(sessions_, {})) {
+        if (session) {
+            session->stop(ec);
+        }
+    }
+    driver_->stop();
+
+    try {
+        flush_timer_.cancel();
+        stat_timer_.cancel();
+    } catch (...) {
+    }
+
+    // 关闭之前把 disconnect 等控制包发出去
+    batch_.send(socket_);
+}
+
+void kcp_shard::insert(uint32_t conv, kcp_session_impl* session) {
+    const auto index = conv & kcp_shard_index_mask;
+    if (index >= sessions_.size()) {
+        sessions_.resize(index + 1, nullptr);
+    }
+    sessions_[index] = session;
+    sessions_count_.fetch_add(1, std::memory_order::relaxed);
+}
+
+void kcp_shard::erase(uint32_t conv) {
+    const auto index = conv & kcp_shard_index_mask;
+    if (index < sessions_.size() && sessions_[index] && sessions_[index]->conv() == conv) {
+        sessions_[index] = nullptr;
+        sessions_count_.fetch_sub(1, std::memory_order::relaxed);
+    }
+}
+
+void kcp_shard::write_to(const udp::endpoint& dest, const kcp_ctrl_packet& ctrl) {
+    batch_.push(dest, ctrl.data(), ctrl.size());
+    post_flush();
+}
+
+void kcp_shard::write_to(const udp::endpoint& dest, const void* data, size_t len) {
+    batch_.push(dest, data, len);
+    post_flush();
+}
+
+void kcp_shard::write_data(const udp::endpoint& dest, const char* data, size_t len) {
+    batch_.push(dest, &kcp_data_head, sizeof(kcp_data_head), data, len);
+    post_flush();
+}
+
+void kcp_shard::dispatch(uint32_t conv, uint8_t* data, size_t len, const udp::endpoint& remote) {
+    if (!own_context_) {
+        return read(conv, data, len, remote);
+    }
+
+    const auto offset = pending_.size();
+    pending_.resize(offset + sizeof(conv) + sizeof(uint16_t) + len);
+    const auto size = static_cast<uint16_t>(len);
+    memcpy(pending_.data() + offset, &conv, sizeof(conv));
+    memcpy(pending_.data() + offset + sizeof(conv), &size, sizeof(size));
+    memcpy(pending_.data() + offset + sizeof(conv) + sizeof(size), data, len);
+    pending_remotes_.emplace_back(remote);
+}
+
+void kcp_shard::commit() {
+    if (pending_.empty()) return;
+
+    // 一次接收的包合并成一次转交
+    asio::post(context_, [self = shared_from_this(), input = std::move(pending_),
+                          remotes = std::move(pending_remotes_)]() mutable { self->hand_input(input, remotes); });
+    pending_ = {};
+    pending_remotes_ = {};
+}
+
+kcp_shard_stat kcp_shard::stat() const noexcept {
+    kcp_shard_stat result;
+    result.index = index_;
+    result.sessions = sessions_count_.load(std::memory_order::relaxed);
+    result.cpu_us = cpu_us_.load(std::memory_order::relaxed);
+    return result;
+}
+
+void kcp_shard::hand_input(std::vector<uint8_t>& input, const std::vector<udp::endpoint>& remotes) {
+    size_t offset = 0;
+    for (const auto& remote : remotes) {
+        uint32_t conv;
+        uint16_t size;
+        memcpy(&conv, input.data() + offset, sizeof(conv));
+        memcpy(&size, input.data() + offset + sizeof(conv), sizeof(size));
+        offset += sizeof(conv) + sizeof(size);
+        read(conv, input.data() + offset, size, remote);
+        offset += size;
+    }
+}
+
+void kcp_shard::read(uint32_t conv, uint8_t* data, size_t len, const udp::endpoint& remote) {
+    const auto index = conv & kcp_shard_index_mask;
+    if (index >= sessions_.size()) return;
+
+    // 槽位可能已经被新的连接使用
+    if (auto* session = sessions_[index]; session && session->conv() == conv) {
+        session->read(data, len, remote);
+    }
+}
+
+void kcp_shard::post_flush() {
+    if (flushing_) return;
+
+    flushing_ = true;
+    asio::post(context_, [self = shared_from_this()]() { self->flush(); });
+}
+
+void kcp_shard::flush() {
+    if (!socket_.is_open()) return;
+
+    if (batch_.send(socket_)) {
+        flushing_ = false;
+        return;
+    }
+
+    // 发送缓冲区满了，socket 属于网络线程，分片的线程中定时重试
+    if (own_context_) {
+        flush_timer_.expires_after(std::chrono::milliseconds(1));
+        flush_timer_.async_wait([self = shared_from_this()](const std::error_code& ec) {
+            if (!ec) {
+                self->flush();
+            }
+        });
+        return;
+    }
+
+    socket_.async_wait(udp::socket::wait_write, [self = shared_from_this()](const std::error_code& ec) {
+        if (!ec) {
+            self->flush();
+        }
+    });
+}
+
+void kcp_shard::update_cpu() {
+    cpu_us_.store(thread_cpu_micros(), std::memory_order::relaxed);
+    stat_timer_.expires_after(kcp_shard_stat_interval);
+    stat_timer_.async_wait([self = shared_from_this()](const std::error_code& ec) {
+        if (!ec) {
+            self->update_cpu();
+        }
+    });
+}
+
+}  // namespace simple
@@ -0,0 +1,115 @@
+﻿#pragma once
+#include <simple/config.h>
+#include <simple/net/socket_types.h>
+
+#include <asio/executor_work_guard.hpp>
+#include <asio/io_context.hpp>
+#include <asio/ip/udp.hpp>
+#include <asio/steady_timer.hpp>
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "kcp_config.h"
+#include "kcp_driver.h"
+#include "udp_batch.h"
+
+namespace simple {
+
+class kcp_session_impl;
+
+// kcp 服务器的分片，负责一部分连接的协议处理（ikcp_input、ikcp_update）和发送
+// 不开启多线程时只有一个分片，运行在网络线程中；开启后每个分片有自己的 io_context 和线程
+// 网络线程接收所有的包，按 conv 找到分片后批量转交，分片直接用服务器的 socket 发送
+class kcp_shard : public std::enable_shared_from_this<kcp_shard> {
+  public:
+    using udp = asio::ip::udp;
+
+    using executor_type = asio::io_context::executor_type;
+
+    // threaded 为 false 时使用 network 的线程
+    kcp_shard(uint32_t index, udp::socket& socket, size_t datagram_size, asio::io_context& network, bool threaded);
+
+    SIMPLE_NON_COPYABLE(kcp_shard)
+
+    ~kcp_shard() noexcept;
+
+    void start();
+
+    // 在网络线程中调用，停止分片中所有的连接，等待分片的线程结束
+    void stop(const std::error_code& ec);
+
+    [[nodiscard]] uint32_t index() const noexcept { return index_; }
+
+    [[nodiscard]] executor_type executor() const noexcept { return context_.get_executor(); }
+
+    [[nodiscard]] bool running_in_this_thread() const noexcept { return executor().running_in_this_thread(); }
+
+    [[nodiscard]] const std::shared_ptr<kcp_driver>& driver() const noexcept { return driver_; }
+
+    // 下面的函数只能在分片的线程中调用
+    void insert(uint32_t conv, kcp_session_impl* session);
+
+    void erase(uint32_t conv);
+
+    // 发送控制包
+    void write_to(const udp::endpoint& dest, const kcp_ctrl_packet& ctrl);
+
+    void write_to(const udp::endpoint& dest, const void* data, size_t len);
+
+    // 给 kcp 输出的数据加上包头发送
+    void write_data(const udp::endpoint& dest, const char* data, size_t len);
+
+    // 在网络线程中调用，把收到的包交给分片，多线程时先缓存起来，commit 时一次转交
+    void dispatch(uint32_t conv, uint8_t* data, size_t len, const udp::endpoint& remote);
+
+    void commit();
+
+    // 统计，任何线程都可以读取
+    [[nodiscard]] int64_t sessions() const noexcept { return sessions_count_.load(std::memory_order::relaxed); }
+
+    [[nodiscard]] kcp_shard_stat stat() const noexcept;
+
+  private:
+    void hand_input(std::vector<uint8_t>& input, const std::vector<udp::endpoint>& remotes);
+
+    void read(uint32_t conv, uint8_t* data, size_t len, const udp::endpoint& remote);
+
+    void post_flush();
+
+    // 发送队列中的包，一轮事件中产生的包合并到一次发送
+    void flush();
+
+    void stop_sessions(const std::error_code& ec);
+
+    void update_cpu();
+
+    uint32_t index_;
+    udp::socket& socket_;
+    // 多线程时是自己的 io_context，否则是网络线程的
+    std::unique_ptr<asio::io_context> own_context_;
+    asio::io_context& context_;
+    std::optional<asio::executor_work_guard<asio::io_context::executor_type>> work_;
+    std::thread thread_;
+    std::shared_ptr<kcp_driver> driver_;
+    udp_batch batch_;
+    bool flushing_{false};
+    // 多线程时 socket 不可写后重试发送的定时器，不在其他线程中等待 socket 的事件
+    asio::steady_timer flush_timer_;
+    // 统计 cpu 时间的定时器
+    asio::steady_timer stat_timer_;
+
+    // 按 conv 的槽位下标保存连接
+    std::vector<kcp_session_impl*> sessions_;
+
+    // 网络线程中缓存的待转交的包，每个包前面是 conv 和 2 字节的长度，发送方的地址按顺序另外保存
+    std::vector<uint8_t> pending_;
+    std::vector<udp::endpoint> pending_remotes_;
+
+    std::atomic_int64_t sessions_count_{0};
+    std::atomic_int64_t cpu_us_{0};
+};
+
+}  // namespace simple
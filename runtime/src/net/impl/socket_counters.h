@@ -0,0 +1,55 @@
+﻿#pragma once
+#include <simple/net/socket_types.h>
+
+#include <array>
+#include <atomic>
+
+namespace simple {
+
+// socket 的统计，网络线程更新，其他线程可以随时无锁读取
+struct socket_counters {
+    using counter = std::atomic_int64_t;
+
+    counter read{0};
+    counter write{0};
+    counter read_time{0};
+    counter write_time{0};
+    counter write_queue{0};
+    counter write_count{0};
+    counter read_count{0};
+    counter accept{0};
+    counter reject{0};
+    counter handshake{0};
+    counter handshake_resumed{0};
+    std::array<counter, socket_histogram_size> write_latency{};
+    counter write_latency_sum{0};
+
+    static void add(counter& value, int64_t delta) noexcept { value.fetch_add(delta, std::memory_order::relaxed); }
+
+    static int64_t load(const counter& value) noexcept { return value.load(std::memory_order::relaxed); }
+
+    static void record(std::array<counter, socket_histogram_size>& histogram, counter& sum, int64_t micros) noexcept {
+        add(histogram[get_socket_histogram_index(micros)], 1);
+        add(sum, micros);
+    }
+
+    void snapshot(socket_trace& trace) const noexcept {
+        trace.read = load(read);
+        trace.write = load(write);
+        trace.read_time = load(read_time);
+        trace.write_time = load(write_time);
+        trace.write_queue = load(write_queue);
+        trace.write_count = load(write_count);
+        trace.read_count = load(read_count);
+        trace.accept = load(accept);
+        trace.reject = load(reject);
+        trace.handshake = load(handshake);
+        trace.handshake_resumed = load(handshake_resumed);
+        for (size_t i = 0; i < socket_histogram_size; ++i) {
+            trace.write_latency[i] = load(write_latency[i]);
+        }
+        trace.write_latency_sum = load(write_latency_sum);
+    }
+};
+
+}  // namespace simple
@@ -0,0 +1,113 @@
+﻿#pragma once
+#include <simple/config.h>
+
+#include <asio/any_io_executor.hpp>
+#include <asio/async_result.hpp>
+#include <asio/error.hpp>
+#include <asio/post.hpp>
+#include <cstddef>
+#include <new>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+namespace simple {
+
+// 网络线程中使用的轻量唤醒事件，用来唤醒发送协程
+// 不经过 io_context 的定时器队列，非线程安全，只能在所属 io_context 的线程中使用
+class socket_event {
+    class waiter {
+      public:
+        virtual void complete(const asio::any_io_executor& executor, const std::error_code& ec) = 0;
+
+        virtual void destroy() noexcept = 0;
+
+      protected:
+        ~waiter() noexcept = default;
+    };
+
+    template <typename Handler>
+    class waiter_impl final : public waiter {
+      public:
+        waiter_impl(Handler&& handler, bool heap) : handler_(std::move(handler)), heap_(heap) {}
+
+        void complete(const asio::any_io_executor& executor, const std::error_code& ec) override {
+            auto handler = std::move(handler_);
+            destroy();
+            asio::post(executor, [handler = std::move(handler), ec]() mutable { std::move(handler)(ec); });
+        }
+
+        void destroy() noexcept override {
+            if (heap_) {
+                delete this;
+            } else {
+                this->~waiter_impl();
+            }
+        }
+
+      private:
+        Handler handler_;
+        bool heap_;
+    };
+
+    // use_awaitable 的 handler 只有几个指针大小，放在内部的存储中，避免每次等待都申请内存
+    static constexpr size_t storage_size = 64;
+
+  public:
+    explicit socket_event(asio::any_io_executor executor) : executor_(std::move(executor)) {}
+
+    SIMPLE_NON_COPYABLE(socket_event)
+
+    ~socket_event() noexcept {
+        if (waiter_) {
+            waiter_->destroy();
+        }
+    }
+
+    // 唤醒等待的协程，没有等待者时记录下来，下一次 async_wait 直接完成
+    void notify() {
+        if (waiter_) {
+            std::exchange(waiter_, nullptr)->complete(executor_, {});
+        } else {
+            notified_ = true;
+        }
+    }
+
+    // 取消当前的等待，等待者收到 operation_aborted
+    void cancel() {
+        notified_ = false;
+        if (waiter_) {
+            std::exchange(waiter_, nullptr)->complete(executor_, make_error_code(asio::error::operation_aborted));
+        }
+    }
+
+    template <typename Token>
+    auto async_wait(Token&& token) {
+        return asio::async_initiate<Token, void(std::error_code)>(
+            [this](auto handler) {
+                using handler_t = decltype(handler);
+                using impl_t = waiter_impl<handler_t>;
+                if (notified_) {
+                    // 已经被通知过，直接完成
+                    notified_ = false;
+                    asio::post(executor_, [handler = std::move(handler)]() mutable { std::move(handler)(std::error_code{}); });
+                    return;
+                }
+
+                if constexpr (sizeof(impl_t) <= storage_size && alignof(impl_t) <= alignof(std::max_align_t)) {
+                    waiter_ = new (storage_) impl_t(std::move(handler), false);
+                } else {
+                    waiter_ = new impl_t(std::move(handler), true);
+                }
+            },
+            token);
+    }
+
+  private:
+    asio::any_io_executor executor_;
+    waiter* waiter_{nullptr};
+    bool notified_{false};
+    alignas(std::max_align_t) unsigned char storage_[storage_size]{};
+};
+
+}  // namespace simple
@@ -0,0 +1,96 @@
+﻿#include "socket_framer.h"
+
+#include <simple/net/socket_system.h>
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace simple {
+
+bool socket_framer::input(const uint8_t* data, size_t len) {
+    const auto& system = socket_system::instance();
+    const size_t header_size = codec_.header_size;
+    while (len > 0) {
+        if (size_ == 0) {
+            // 先收齐帧头，得到帧的长度后一次申请好整个帧的缓冲区
+            const auto need = std::min(len, header_size - frame_.readable());
+            frame_.append(data, need);
+            data += need;
+            len -= need;
+            if (frame_.readable() < header_size) {
+                return true;
+            }
+
+            size_ = frame_size(frame_.begin_read());
+            if (size_ == 0) {
+                return false;
+            }
+            frame_.reserve(size_);
+        }
+
+        const auto need = std::min(len, size_ - frame_.readable());
+        frame_.append(data, need);
+        data += need;
+        len -= need;
+        if (frame_.readable() == size_) {
+            system.hand_frame(socket_id_, std::move(frame_));
+            frame_ = memory_buffer();
+            size_ = 0;
+        }
+    }
+
+    return true;
+}
+
+bool socket_framer::input(memory_buffer&& buf) {
+    if (size_ == 0 && frame_.readable() == 0 && buf.readable() >= codec_.header_size) {
+        const auto size = frame_size(buf.begin_read());
+        if (size == 0) {
+            return false;
+        }
+
+        if (size == buf.readable()) {
+            socket_system::instance().hand_frame(socket_id_, std::move(buf));
+            return true;
+        }
+    }
+
+    return input(buf.begin_read(), buf.readable());
+}
+
+memory_buffer socket_framer::release() {
+    size_ = 0;
+    memory_buffer result = std::move(frame_);
+    frame_ = memory_buffer();
+    return result;
+}
+
+size_t socket_framer::frame_size(const uint8_t* header) const noexcept {
+    const auto* field = header + codec_.length_offset;
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < codec_.length_size; ++i) {
+        const auto index = codec_.big_endian ? i : codec_.length_size - 1 - i;
+        value = value << 8 | field[index];
+    }
+
+    if (!codec_.length_includes_header) {
+        if (value > std::numeric_limits<uint64_t>::max() - codec_.header_size) {
+            return 0;
+        }
+        value += codec_.header_size;
+    }
+
+    // 帧不能比帧头短，空帧只有帧头
+    if (value < codec_.header_size || value > std::numeric_limits<size_t>::max()) {
+        return 0;
+    }
+
+    if (codec_.max_size > 0 && value > codec_.max_size) {
+        return 0;
+    }
+
+    return static_cast<size_t>(value);
+}
+
+}  // namespace simple
@@ -0,0 +1,45 @@
+﻿#pragma once
+#include <simple/config.h>
+#include <simple/net/socket_types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <simple/containers/buffer.hpp>
+
+namespace simple {
+
+// 按长度前缀分帧，在读取数据的线程中使用，非线程安全
+// 完整的帧直接交给逻辑线程，逻辑线程每次唤醒拿到一个完整的帧，不用再分两次读取帧头和帧体
+class socket_framer {
+  public:
+    socket_framer(uint32_t socket_id, const socket_frame_codec& codec) : socket_id_(socket_id), codec_(codec) {}
+
+    SIMPLE_NON_COPYABLE(socket_framer)
+
+    ~socket_framer() noexcept = default;
+
+    // 更换分帧规则，还没有组成帧的数据保留下来按新的规则解析
+    void codec(const socket_frame_codec& codec) noexcept { codec_ = codec; }
+
+    // 输入收到的数据，帧的长度不合法时返回 false
+    bool input(const uint8_t* data, size_t len);
+
+    // 已经放在缓冲区中的数据（kcp 的消息），正好是一个完整的帧时直接转交，不再复制
+    bool input(memory_buffer&& buf);
+
+    // 取出还没有组成帧的数据
+    memory_buffer release();
+
+  private:
+    // 从帧头中读出帧的总长度，不合法时返回 0
+    [[nodiscard]] size_t frame_size(const uint8_t* header) const noexcept;
+
+    uint32_t socket_id_;
+    socket_frame_codec codec_;
+    // 正在接收的帧
+    memory_buffer frame_;
+    // 当前帧的总长度，还没收齐帧头时为 0
+    size_t size_{0};
+};
+
+}  // namespace simple
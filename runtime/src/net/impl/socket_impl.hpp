@@ -1,21 +1,39 @@
 ﻿#pragma once
 #include <fmt/format.h>
 #include <simple/config.h>
+#include <simple/net/socket_system.h>
 #include <simple/net/socket_types.h>
 #include <simple/utils/time.h>
 
 #include <asio/ip/basic_endpoint.hpp>
+#include <atomic>
+#include <memory>
 #include <simple/containers/buffer.hpp>
 
+#include "accept_limiter.h"
+#include "socket_counters.h"
+#include "socket_framer.h"
+
 namespace simple {
 
 class socket_base {
   public:
-    explicit socket_base(uint32_t socket_id) : socket_id_(socket_id) {}
+    using counters_ptr = std::shared_ptr<socket_counters>;
+
+    explicit socket_base(uint32_t socket_id) : socket_id_(socket_id), counters_(std::make_shared<socket_counters>()) {}
 
     SIMPLE_NON_COPYABLE(socket_base)
 
-    virtual ~socket_base() noexcept = default;
+    virtual ~socket_base() noexcept {
+        // 没发出去的数据也要从全局的统计中去掉
+        write_queue_bytes_.fetch_sub(write_queue(), std::memory_order::relaxed);
+        if (listener_counters_) {
+            socket_counters::add(listener_counters_->write_queue, -write_queue());
+        }
+        if (held_limiter_) {
+            held_limiter_->release(held_address_);
+        }
+    }
 
     virtual void stop(const std::error_code& ec) = 0;
 
@@ -25,25 +43,204 @@ class socket_base {
 
     virtual void no_delay(bool on) {}
 
-    void trace_write(int64_t size) {
-        trace_.write += size;
-        trace_.write_time = get_system_clock_millis();
+    // 监听端的策略会应用到之后接受的连接上，连接在其他线程中发送时要在发送的线程中设置
+    virtual void write_policy(const socket_write_policy& policy) { write_policy_ = policy; }
+
+    [[nodiscard]] const socket_write_policy& write_policy() const noexcept { return write_policy_; }
+
+    virtual void watermark(const socket_watermark& watermark) {
+        watermark_ = watermark;
+        write_max_.store(watermark.max, std::memory_order::relaxed);
+        check_watermark();
+    }
+
+    [[nodiscard]] const socket_watermark& watermark() const noexcept { return watermark_; }
+
+    // 在读取数据的线程中设置，之后收到的数据按帧转交给逻辑线程，取消分帧时没有组成帧的数据直接转交
+    virtual void frame_codec(const socket_frame_codec& codec) {
+        frame_codec_ = codec;
+        if (!framer_) return;
+
+        if (codec.length_size > 0) {
+            framer_->codec(codec);
+            return;
+        }
+
+        if (auto rest = framer_->release(); rest.readable() > 0) {
+            socket_system::instance().hand_read(socket_id_, std::move(rest));
+        }
+        framer_.reset();
+    }
+
+    [[nodiscard]] const socket_frame_codec& frame_codec() const noexcept { return frame_codec_; }
+
+    void accept_limit(const socket_accept_limit& limit) {
+        if (accept_limiter_) {
+            accept_limiter_->limit(limit);
+        } else {
+            accept_limiter_ = std::make_shared<accept_limiter>(limit);
+        }
+    }
+
+    // 接受的连接继承监听 socket 的设置，统计也会累加到监听 socket 上
+    // 监听 socket 有连接数限制时，连接销毁的时候归还占用的数量
+    void inherit(const socket_base& listener, const asio::ip::address& remote) {
+        write_policy_ = listener.write_policy_;
+        watermark_ = listener.watermark_;
+        write_max_.store(listener.watermark_.max, std::memory_order::relaxed);
+        frame_codec_ = listener.frame_codec_;
+        listener_id_ = listener.socket_id_;
+        listener_counters_ = listener.counters_;
+        if (listener.accept_limiter_) {
+            held_limiter_ = listener.accept_limiter_;
+            held_address_ = remote;
+        }
+    }
+
+    // 接受的连接从监听 socket 继承的设置
+    struct listener_settings {
+        socket_write_policy write_policy;
+        socket_watermark watermark;
+        socket_frame_codec frame_codec;
+    };
+
+    [[nodiscard]] listener_settings settings() const noexcept { return {write_policy_, watermark_, frame_codec_}; }
+
+    // 监听之后立即设置的参数可能晚于刚接受的连接，开始读写之前再从监听 socket 同步一次，连接没有设置的才使用监听的
+    // 在网络线程中调用，连接在其他线程中读写时要在读写的线程中设置
+    virtual void sync_listener(const listener_settings& listener) {
+        if (write_policy_.delay_us == 0 && write_policy_.bytes == 0) {
+            socket_base::write_policy(listener.write_policy);
+        }
+        if (watermark_.low == 0 && watermark_.high == 0 && watermark_.max == 0) {
+            socket_base::watermark(listener.watermark);
+        }
+        if (frame_codec_.length_size == 0 && listener.frame_codec.length_size > 0) {
+            socket_base::frame_codec(listener.frame_codec);
+        }
+    }
+
+    [[nodiscard]] uint32_t listener_id() const noexcept { return listener_id_; }
+
+    [[nodiscard]] const counters_ptr& counters() const noexcept { return counters_; }
+
+    // 发送队列是否还能放下 size 字节，在网络线程中调用
+    [[nodiscard]] bool write_acceptable(size_t size) const noexcept {
+        const auto max = write_max_.load(std::memory_order::relaxed);
+        return max == 0 || static_cast<size_t>(write_queue()) + size <= max;
+    }
+
+    // 所有 socket 待发送的字节数
+    static int64_t write_queue_bytes() noexcept { return write_queue_bytes_.load(std::memory_order::relaxed); }
+
+    // 把收到的数据交给逻辑线程，设置了分帧规则时只转交完整的帧，帧的长度不合法时返回 false
+    bool hand_data(const uint8_t* data, size_t len) {
+        if (frame_codec_.length_size == 0) {
+            socket_system::instance().hand_read(socket_id_, data, len);
+            return true;
+        }
+        return framer().input(data, len);
+    }
+
+    bool hand_data(memory_buffer&& buf) {
+        if (frame_codec_.length_size == 0) {
+            socket_system::instance().hand_read(socket_id_, std::move(buf));
+            return true;
+        }
+        return framer().input(std::move(buf));
+    }
+
+    void trace_write(int64_t size, int64_t micros = 0) {
+        const auto now = get_system_clock_millis();
+        for (auto* counters : {counters_.get(), listener_counters_.get()}) {
+            if (!counters) continue;
+            socket_counters::add(counters->write, size);
+            socket_counters::add(counters->write_count, 1);
+            socket_counters::record(counters->write_latency, counters->write_latency_sum, micros);
+            counters->write_time.store(now, std::memory_order::relaxed);
+        }
     }
 
     void trace_read(int64_t size) {
-        trace_.read += size;
-        trace_.read_time = get_system_clock_millis();
+        const auto now = get_system_clock_millis();
+        for (auto* counters : {counters_.get(), listener_counters_.get()}) {
+            if (!counters) continue;
+            socket_counters::add(counters->read, size);
+            socket_counters::add(counters->read_count, 1);
+            counters->read_time.store(now, std::memory_order::relaxed);
+        }
+    }
+
+    void trace_accept() { socket_counters::add(counters_->accept, 1); }
+
+    void trace_reject() { socket_counters::add(counters_->reject, 1); }
+
+    void trace_handshake(bool resumed) {
+        for (auto* counters : {counters_.get(), listener_counters_.get()}) {
+            if (!counters) continue;
+            socket_counters::add(resumed ? counters->handshake_resumed : counters->handshake, 1);
+        }
+    }
+
+    void trace_write_queue(int64_t size) {
+        socket_counters::add(counters_->write_queue, size);
+        if (listener_counters_) {
+            socket_counters::add(listener_counters_->write_queue, size);
+        }
+        write_queue_bytes_.fetch_add(size, std::memory_order::relaxed);
+        check_watermark();
     }
 
-    void trace_write_queue(int64_t size) { trace_.write_queue += size; }
+    // 是否还需要等待更多的数据再发送
+    [[nodiscard]] bool write_batching() const noexcept {
+        return write_policy_.delay_us > 0 &&
+               (write_policy_.bytes == 0 || write_queue() < static_cast<int64_t>(write_policy_.bytes));
+    }
 
   protected:
+    [[nodiscard]] int64_t write_queue() const noexcept { return socket_counters::load(counters_->write_queue); }
+
     uint32_t socket_id_;
-    socket_trace trace_;
+    counters_ptr counters_;
+    uint32_t listener_id_{0};
+    counters_ptr listener_counters_;
+    socket_write_policy write_policy_;
+    socket_watermark watermark_;
+    // 水位的上限，发送的线程设置，网络线程检查
+    std::atomic_size_t write_max_{0};
+    bool write_blocked_{false};
+    std::shared_ptr<accept_limiter> accept_limiter_;
+    std::shared_ptr<accept_limiter> held_limiter_;
+    asio::ip::address held_address_;
+    socket_frame_codec frame_codec_;
+    std::unique_ptr<socket_framer> framer_;
+
+  private:
+    socket_framer& framer() {
+        if (!framer_) {
+            framer_ = std::make_unique<socket_framer>(socket_id_, frame_codec_);
+        }
+        return *framer_;
+    }
+
+    void check_watermark() {
+        const auto size = static_cast<size_t>(write_queue());
+        if (write_blocked_) {
+            if (watermark_.high == 0 || size <= watermark_.low) {
+                write_blocked_ = false;
+                socket_system::instance().hand_writable(socket_id_, true);
+            }
+        } else if (watermark_.high > 0 && size >= watermark_.high) {
+            write_blocked_ = true;
+            socket_system::instance().hand_writable(socket_id_, false);
+        }
+    }
+
+    inline static std::atomic_int64_t write_queue_bytes_{0};
 };
 
 template <typename InternetProtocol>
-inline std::string to_string(asio::ip::basic_endpoint<InternetProtocol>& endpoint) {
+inline std::string to_string(const asio::ip::basic_endpoint<InternetProtocol>& endpoint) {
     try {
         auto address = endpoint.address();
         if (address.is_v4()) {
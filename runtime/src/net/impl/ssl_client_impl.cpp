@@ -1,5 +1,6 @@
 ﻿#include "ssl_client_impl.h"
 
+#include <simple/error.h>
 #include <simple/log/log.h>
 #include <simple/net/socket_system.h>
 
@@ -12,13 +13,16 @@
 #include <asio/experimental/awaitable_operators.hpp>
 #include <asio/ssl/host_name_verification.hpp>
 
+#include "ssl_session_cache.h"
+
 namespace simple {
 
 ssl_client_impl::ssl_client_impl(uint32_t socket_id)  // NOLINT(cppcoreguidelines-pro-type-member-init)
     : socket_base(socket_id),
       ctx_(asio::ssl::context::sslv23),
       socket_(socket_system::instance().context(), ctx_),
-      write_blocker_(socket_.get_executor()),
+      write_event_(socket_.get_executor()),
+      flush_timer_(socket_.get_executor()),
       connect_(socket_.get_executor()) {}
 
 constexpr ssl_client_impl::asio_token use_awaitable_as_tuple;
@@ -91,7 +95,12 @@ void ssl_client_impl::start(const std::string& host, const std::string& service,
     }
     if (ec) return stop(ec);
 
-    write_blocker_.expires_at(asio_timer::clock_type::time_point::max());
+    // 复用之前连接同一个地址时的会话，复用会话时不再验证证书，
+    // 所以 key 中带上证书的设置，不验证证书时得到的会话不会被验证证书的连接复用
+    session_key_ = host + ":" + service + (ignore_cert ? ":ignore:" : ":verify:") + verify;
+    ssl_session_cache::enable(ctx_.native_handle());
+    ssl_session_cache::instance().prepare(socket_.native_handle(), &session_key_);
+
     auto self = shared_from_this();
     auto& system = socket_system::instance();
     system.insert(socket_id_, self);
@@ -113,8 +122,12 @@ void ssl_client_impl::stop(const std::error_code& ec) {
     std::error_code ignore;
     socket_.shutdown(ignore);
     socket_raw.close(ignore);
+    write_event_.cancel();
+    try {
+        flush_timer_.cancel();
+    } catch (...) {
+    }
     try {
-        write_blocker_.cancel();
         connect_.cancel();
     } catch (...) {
     }
@@ -126,10 +139,14 @@ void ssl_client_impl::stop(const std::error_code& ec) {
 void ssl_client_impl::write(const memory_buffer_ptr& ptr) {
     trace_write_queue(ptr->readable());
     write_deque_.emplace_back(ptr);
-    try {
-        write_blocker_.cancel();
-    } catch (...) {
+    if (write_policy_.delay_us > 0 && !write_batching()) {
+        // 已经攒够了数据，不用再等
+        try {
+            flush_timer_.cancel();
+        } catch (...) {
+        }
     }
+    write_event_.notify();
 }
 
 void ssl_client_impl::no_delay(bool on) {
@@ -168,6 +185,7 @@ asio::awaitable<void> ssl_client_impl::co_connect(const std::string& host, const
         stop(ec);
         co_return;
     }
+    trace_handshake(SSL_session_reused(socket_.native_handle()) == 1);
 
     auto self = shared_from_this();
     std::error_code ec_ignore;
@@ -201,7 +219,6 @@ asio::awaitable<void> ssl_client_impl::co_timeout(const asio_timer::duration& ti
 }
 
 asio::awaitable<void> ssl_client_impl::co_read() {
-    const auto& system = socket_system::instance();
     uint8_t data[1024];
     for (;;) {
         auto [ec, len] = co_await socket_.async_read_some(asio::buffer(data), use_awaitable_as_tuple);
@@ -210,8 +227,11 @@ asio::awaitable<void> ssl_client_impl::co_read() {
             co_return;
         }
 
-        system.hand_read(socket_id_, data, len);
         trace_read(len);
+        if (!hand_data(data, len)) {
+            stop(socket_errors::frame_too_large);
+            co_return;
+        }
     }
 }
 
@@ -225,7 +245,15 @@ asio::awaitable<void> ssl_client_impl::co_write() {
 
     while (socket_raw.is_open()) {
         if (write_deque_.empty()) {
-            co_await write_blocker_.async_wait();
+            co_await write_event_.async_wait(use_awaitable_as_tuple);
+            if (!socket_raw.is_open()) co_return;
+            if (write_deque_.empty()) continue;
+        }
+
+        if (write_batching()) {
+            // 等待更多的数据，合并成一次发送
+            flush_timer_.expires_after(std::chrono::microseconds(write_policy_.delay_us));
+            co_await flush_timer_.async_wait();
             if (!socket_raw.is_open()) co_return;
         }
 
@@ -239,11 +267,13 @@ asio::awaitable<void> ssl_client_impl::co_write() {
         }
 
         write_deque_.erase(it_begin, it_end);
+        const auto write_begin = std::chrono::steady_clock::now();
         auto [ec, len] = co_await async_write(socket_, buffers, use_awaitable_as_tuple);
         buffers.clear();
         cache_write.clear();
         trace_write_queue(-static_cast<int64_t>(len));
-        trace_write(len);
+        const auto write_elapsed = std::chrono::steady_clock::now() - write_begin;
+        trace_write(len, std::chrono::duration_cast<std::chrono::microseconds>(write_elapsed).count());
     }
 }
 
@@ -9,6 +9,7 @@
 #include <asio/use_awaitable.hpp>
 #include <deque>
 
+#include "socket_event.hpp"
 #include "socket_impl.hpp"
 
 namespace simple {
@@ -46,7 +47,10 @@ class ssl_client_impl final : public socket_base, public std::enable_shared_from
 
     asio::ssl::context ctx_;
     ssl_socket socket_;
-    asio_timer write_blocker_;
+    // 会话缓存的 key，地址加上证书的设置
+    std::string session_key_;
+    socket_event write_event_;
+    asio_timer flush_timer_;
     asio_timer connect_;
     std::deque<memory_buffer_ptr> write_deque_;
 };
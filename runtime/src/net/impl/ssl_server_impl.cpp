@@ -7,17 +7,20 @@
 #include <asio/co_spawn.hpp>
 #include <asio/detached.hpp>
 
+#include "ssl_session_cache.h"
 #include "ssl_session_impl.h"
 
 namespace simple {
 
 ssl_server_impl::ssl_server_impl(uint32_t socket_id)  // NOLINT(cppcoreguidelines-pro-type-member-init)
-    : socket_base(socket_id), acceptor_(socket_system::instance().context()) {
+    : socket_base(socket_id),
+      acceptor_(socket_system::instance().context()),
+      throttle_(socket_system::instance().context()) {
     ctx_ = std::make_shared<asio::ssl::context>(asio::ssl::context::sslv23);
 }
 
 void ssl_server_impl::start(const tcp::endpoint& endpoint, bool reuse, const std::string& cert, const std::string& key,
-                            const std::string& dh, const std::string& password) {
+                            const std::string& dh, const std::string& password, uint32_t workers) {
     info("ssl server {} start", socket_id_);
     std::error_code ec;
     ctx_->set_options(
@@ -31,6 +34,8 @@ void ssl_server_impl::start(const tcp::endpoint& endpoint, bool reuse, const std
     if (ec) return stop(ec);
     ctx_->use_tmp_dh_file(dh, ec);
     if (ec) return stop(ec);
+    // 断线重连时复用会话，省掉完整握手的开销
+    ssl_enable_server_resumption(ctx_->native_handle());
     acceptor_.open(endpoint.protocol(), ec);
     if (ec) return stop(ec);
     acceptor_.set_option(tcp::acceptor::reuse_address(reuse), ec);
@@ -40,6 +45,11 @@ void ssl_server_impl::start(const tcp::endpoint& endpoint, bool reuse, const std
     acceptor_.listen(asio::socket_base::max_listen_connections, ec);
     if (ec) return stop(ec);
 
+    if (workers > 0) {
+        info("ssl server {} workers {}", socket_id_, workers);
+        workers_ = std::make_shared<ssl_worker_pool>(workers);
+    }
+
     auto self = shared_from_this();
     auto& system = socket_system::instance();
     system.insert(socket_id_, self);
@@ -60,6 +70,10 @@ void ssl_server_impl::stop(const std::error_code& ec) {
     info("ssl server {} stop", socket_id_);
     std::error_code ignore;
     acceptor_.close(ignore);
+    try {
+        throttle_.cancel();
+    } catch (...) {
+    }
     auto& system = socket_system::instance();
     system.hand_stop(socket_id_, ec);
     system.erase(socket_id_);
@@ -68,16 +82,39 @@ void ssl_server_impl::stop(const std::error_code& ec) {
 asio::awaitable<void> ssl_server_impl::co_accept() {
     auto& system = socket_system::instance();
     while (acceptor_.is_open()) {
-        if (auto [ec, socket] = co_await acceptor_.async_accept(); socket.is_open()) {
+        if (accept_limiter_) {
+            // 超过接受的速率时先不 accept，新连接留在系统的 backlog 里
+            if (const auto wait = accept_limiter_->throttle(); wait > asio_timer::duration::zero()) {
+                throttle_.expires_after(wait);
+                co_await throttle_.async_wait();
+                continue;
+            }
+        }
+
+        // 使用线程池时 socket 直接创建在分到的线程上
+        auto& context = workers_ ? workers_->next() : system.context();
+        if (auto [ec, socket] = co_await acceptor_.async_accept(asio::any_io_executor(context.get_executor()));
+            socket.is_open()) {
+            std::error_code ignore;
+            const auto remote = socket.remote_endpoint(ignore);
+            if (accept_limiter_ && !accept_limiter_->acquire(remote.address())) {
+                trace_reject();
+                socket.close(ignore);
+                continue;
+            }
+
             const auto id = system.new_socket_id(socket_type::ssl_session);
             if (id == 0) {
                 warn("kcp server {} accept fail, no new socket id", socket_id_);
-                std::error_code ignore;
+                if (accept_limiter_) {
+                    accept_limiter_->release(remote.address());
+                }
                 socket.close(ignore);
                 continue;
             }
-            trace_read(1);
-            const auto session = std::make_shared<ssl_session_impl>(id, std::move(socket), ctx_);
+            trace_accept();
+            const auto session = std::make_shared<ssl_session_impl>(id, std::move(socket), ctx_, context, workers_);
+            session->inherit(*this, remote.address());
             session->start(socket_id_);
         } else {
             warn("tcp server {} accept fail, {}", socket_id_, ERROR_CODE_MESSAGE(ec.message()));
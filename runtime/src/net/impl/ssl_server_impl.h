@@ -3,10 +3,12 @@
 #include <asio/as_tuple.hpp>
 #include <asio/awaitable.hpp>
 #include <asio/ip/tcp.hpp>
+#include <asio/steady_timer.hpp>
 #include <asio/ssl/context.hpp>
 #include <asio/use_awaitable.hpp>
 
 #include "socket_impl.hpp"
+#include "ssl_worker_pool.h"
 
 namespace simple {
 
@@ -15,6 +17,7 @@ class ssl_server_impl final : public socket_base, public std::enable_shared_from
     using asio_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
     using tcp = asio::ip::tcp;
     using tcp_acceptor = asio_token::as_default_on_t<tcp::acceptor>;
+    using asio_timer = asio_token::as_default_on_t<asio::steady_timer>;
 
     explicit ssl_server_impl(uint32_t socket_id);
 
@@ -22,8 +25,9 @@ class ssl_server_impl final : public socket_base, public std::enable_shared_from
 
     SIMPLE_NON_COPYABLE(ssl_server_impl)
 
+    // workers 大于 0 时接受的连接分到 workers 个线程中处理，加解密不占用网络线程
     void start(const tcp::endpoint& endpoint, bool reuse, const std::string& cert, const std::string& key,
-               const std::string& dh, const std::string& password);
+               const std::string& dh, const std::string& password, uint32_t workers);
 
     void stop(const std::error_code& ec) override;
 
@@ -31,7 +35,9 @@ class ssl_server_impl final : public socket_base, public std::enable_shared_from
     asio::awaitable<void> co_accept();
 
     tcp_acceptor acceptor_;
+    asio_timer throttle_;
     std::shared_ptr<asio::ssl::context> ctx_;
+    std::shared_ptr<ssl_worker_pool> workers_;
 };
 
 }  // namespace simple
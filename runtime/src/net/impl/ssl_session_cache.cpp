@@ -0,0 +1,215 @@
+﻿#include "ssl_session_cache.h"
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#if (OPENSSL_VERSION_NUMBER >= 0x30000000L)
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+
+namespace simple {
+
+// ticket 密钥的轮换间隔，会话的有效期是两个间隔
+static constexpr auto ssl_ticket_rotate_interval = std::chrono::hours(1);
+// 服务器 session id 缓存的数量
+static constexpr long ssl_server_cache_size = 20480;
+// 客户端最多缓存的 host:service 数量
+static constexpr size_t ssl_client_cache_size = 1024;
+
+static constexpr unsigned char ssl_session_id_context[] = "simple";
+
+// 服务器 ticket 的加密和校验密钥，连接使用 ssl 线程池时会在多个线程中握手，需要加锁
+class ssl_ticket_keys {
+  public:
+    struct key {
+        std::array<unsigned char, 16> name{};
+        std::array<unsigned char, 32> aes{};
+        std::array<unsigned char, 32> hmac{};
+    };
+
+    ssl_ticket_keys() { rotate(); }
+
+    // 加密时返回当前的密钥，到时间了先轮换
+    key current() {
+        std::scoped_lock lock(mutex_);
+        if (std::chrono::steady_clock::now() - created_ >= ssl_ticket_rotate_interval) {
+            rotate();
+        }
+        return current_;
+    }
+
+    // 解密时按名字查找，renew 表示是上一个密钥，需要用当前的密钥重新下发 ticket
+    bool find(const unsigned char* name, key& result, bool& renew) const {
+        std::scoped_lock lock(mutex_);
+        if (memcmp(name, current_.name.data(), current_.name.size()) == 0) {
+            renew = false;
+            result = current_;
+            return true;
+        }
+        if (has_previous_ && memcmp(name, previous_.name.data(), previous_.name.size()) == 0) {
+            renew = true;
+            result = previous_;
+            return true;
+        }
+        return false;
+    }
+
+  private:
+    void rotate() {
+        previous_ = current_;
+        has_previous_ = created_ != std::chrono::steady_clock::time_point{};
+        RAND_bytes(current_.name.data(), static_cast<int>(current_.name.size()));
+        RAND_bytes(current_.aes.data(), static_cast<int>(current_.aes.size()));
+        RAND_bytes(current_.hmac.data(), static_cast<int>(current_.hmac.size()));
+        created_ = std::chrono::steady_clock::now();
+    }
+
+    mutable std::mutex mutex_;
+    key current_;
+    key previous_;
+    bool has_previous_{false};
+    std::chrono::steady_clock::time_point created_;
+};
+
+static void free_ticket_keys(void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*) {
+    delete static_cast<ssl_ticket_keys*>(ptr);
+}
+
+static int ticket_keys_index() {
+    static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, free_ticket_keys);
+    return index;
+}
+
+static int session_key_index() {
+    static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+// 选择密钥并初始化加解密，返回 openssl 要求的结果：0 找不到密钥，1 成功，2 成功并且需要更新 ticket，-1 失败
+// 结果大于 0 时 key 是选中的密钥
+static int select_ticket_key(SSL* ssl, unsigned char* key_name, unsigned char* iv, EVP_CIPHER_CTX* cipher, int enc,
+                             ssl_ticket_keys::key& key) {
+    auto* keys = static_cast<ssl_ticket_keys*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ticket_keys_index()));
+    if (!keys) return -1;
+
+    if (enc) {
+        key = keys->current();
+        if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) <= 0 ||
+            EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aes.data(), iv) <= 0) {
+            return -1;
+        }
+        memcpy(key_name, key.name.data(), key.name.size());
+        return 1;
+    }
+
+    // 密钥已经轮换掉了，重新完整握手
+    bool renew = false;
+    if (!keys->find(key_name, key, renew)) return 0;
+
+    if (EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aes.data(), iv) <= 0) {
+        return -1;
+    }
+    // tls1.3 的客户端每个 ticket 只用一次，复用之后也要下发新的 ticket
+    return renew || SSL_version(ssl) >= TLS1_3_VERSION ? 2 : 1;
+}
+
+#if (OPENSSL_VERSION_NUMBER >= 0x30000000L)
+
+static int hand_ticket_key(SSL* ssl, unsigned char* key_name, unsigned char* iv, EVP_CIPHER_CTX* cipher,
+                           EVP_MAC_CTX* mac, int enc) {
+    ssl_ticket_keys::key key;
+    const auto result = select_ticket_key(ssl, key_name, iv, cipher, enc, key);
+    if (result <= 0) return result;
+
+    char digest[] = "SHA256";
+    const OSSL_PARAM params[]{
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac.data(), key.hmac.size()),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0), OSSL_PARAM_construct_end()};
+    return EVP_MAC_CTX_set_params(mac, params) > 0 ? result : -1;
+}
+
+#else
+
+static int hand_ticket_key(SSL* ssl, unsigned char* key_name, unsigned char* iv, EVP_CIPHER_CTX* cipher,
+                           HMAC_CTX* hmac, int enc) {
+    ssl_ticket_keys::key key;
+    const auto result = select_ticket_key(ssl, key_name, iv, cipher, enc, key);
+    if (result <= 0) return result;
+
+    const auto ok = HMAC_Init_ex(hmac, key.hmac.data(), static_cast<int>(key.hmac.size()), EVP_sha256(), nullptr);
+    return ok > 0 ? result : -1;
+}
+
+#endif
+
+void ssl_enable_server_resumption(SSL_CTX* ctx) {
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(ctx, ssl_session_id_context, sizeof(ssl_session_id_context) - 1);
+    SSL_CTX_sess_set_cache_size(ctx, ssl_server_cache_size);
+    SSL_CTX_set_timeout(ctx, static_cast<long>(std::chrono::seconds(2 * ssl_ticket_rotate_interval).count()));
+
+    SSL_CTX_set_ex_data(ctx, ticket_keys_index(), new ssl_ticket_keys());
+#if (OPENSSL_VERSION_NUMBER >= 0x30000000L)
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, hand_ticket_key);
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb(ctx, hand_ticket_key);
+#endif
+}
+
+ssl_session_cache& ssl_session_cache::instance() {
+    static ssl_session_cache cache;
+    return cache;
+}
+
+ssl_session_cache::~ssl_session_cache() noexcept {
+    for (const auto& [_, session] : sessions_) {
+        SSL_SESSION_free(session);
+    }
+}
+
+void ssl_session_cache::enable(SSL_CTX* ctx) {
+    // 不使用 openssl 内部的缓存，只通过回调拿到新的会话
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, hand_new_session);
+}
+
+void ssl_session_cache::prepare(SSL* ssl, const std::string* key) {
+    SSL_set_ex_data(ssl, session_key_index(), const_cast<std::string*>(key));
+    if (const auto it = sessions_.find(*key); it != sessions_.end()) {
+        if (SSL_SESSION_is_resumable(it->second)) {
+            SSL_set_session(ssl, it->second);
+        } else {
+            SSL_SESSION_free(it->second);
+            sessions_.erase(it);
+        }
+    }
+}
+
+int ssl_session_cache::hand_new_session(SSL* ssl, SSL_SESSION* session) {
+    const auto* key = static_cast<const std::string*>(SSL_get_ex_data(ssl, session_key_index()));
+    if (!key) return 0;
+
+    auto& sessions = instance().sessions_;
+    if (const auto it = sessions.find(*key); it != sessions.end()) {
+        SSL_SESSION_free(it->second);
+        it->second = session;
+        return 1;
+    }
+
+    if (sessions.size() >= ssl_client_cache_size) {
+        SSL_SESSION_free(sessions.begin()->second);
+        sessions.erase(sessions.begin());
+    }
+    sessions.emplace(*key, session);
+    // 返回 1 表示接管了 session 的引用
+    return 1;
+}
+
+}  // namespace simple
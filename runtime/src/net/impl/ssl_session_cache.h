@@ -0,0 +1,38 @@
+﻿#pragma once
+#include <openssl/ssl.h>
+#include <simple/config.h>
+
+#include <string>
+#include <unordered_map>
+
+namespace simple {
+
+// 服务器开启 tls 会话复用，同时支持 session id 缓存和 session ticket
+// ticket 的密钥定期轮换，上一个密钥解开的 ticket 仍然可以复用，密钥跟随 SSL_CTX 释放
+void ssl_enable_server_resumption(SSL_CTX* ctx);
+
+// 客户端的会话缓存，每个 host:service 保存最新的一个会话，下次连接时复用
+// 所有的客户端都在网络线程中握手，不需要加锁
+class ssl_session_cache {
+  public:
+    static ssl_session_cache& instance();
+
+    SIMPLE_NON_COPYABLE(ssl_session_cache)
+
+    ~ssl_session_cache() noexcept;
+
+    // 开启 ctx 的客户端会话缓存，收到服务器下发的会话时保存起来
+    static void enable(SSL_CTX* ctx);
+
+    // 握手之前调用，key 要在 ssl 释放之前一直有效，有可以复用的会话时设置到 ssl 上
+    void prepare(SSL* ssl, const std::string* key);
+
+  private:
+    ssl_session_cache() = default;
+
+    static int hand_new_session(SSL* ssl, SSL_SESSION* session);
+
+    std::unordered_map<std::string, SSL_SESSION*> sessions_;
+};
+
+}  // namespace simple
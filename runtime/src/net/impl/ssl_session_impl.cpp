@@ -1,24 +1,43 @@
 ﻿#include "ssl_session_impl.h"
 
+#include <simple/error.h>
 #include <simple/log/log.h>
 #include <simple/net/socket_system.h>
 
 #include <asio/co_spawn.hpp>
 #include <asio/detached.hpp>
+#include <asio/post.hpp>
 
 namespace simple {
 
-ssl_session_impl::ssl_session_impl(uint32_t socket_id, tcp::socket socket, std::shared_ptr<asio::ssl::context> ctx)  // NOLINT
-    : socket_base(socket_id), ctx_(std::move(ctx)), socket_(std::move(socket), *ctx_), write_blocker_(socket_.get_executor()) {}
+ssl_session_impl::ssl_session_impl(uint32_t socket_id, tcp::socket socket,  // NOLINT
+                                   std::shared_ptr<asio::ssl::context> ctx, asio::io_context& context,
+                                   std::shared_ptr<ssl_worker_pool> workers)
+    : socket_base(socket_id),
+      ctx_(std::move(ctx)),
+      context_(context),
+      workers_(std::move(workers)),
+      socket_(std::move(socket), *ctx_),
+      write_event_(socket_.get_executor()),
+      flush_timer_(socket_.get_executor()) {}
+
+ssl_session_impl::~ssl_session_impl() noexcept {
+    if (!workers_) return;
+
+    // 连接可能在线程池的线程中释放，线程池要到网络线程中释放
+    try {
+        asio::post(socket_system::instance().context(), [workers = std::move(workers_)]() {});
+    } catch (...) {
+    }
+}
 
 constexpr ssl_session_impl::asio_token use_awaitable_as_tuple;
 
 void ssl_session_impl::start(uint32_t acceptor_id) {
     info("ssl session {} acceptor:{} start", socket_id_, acceptor_id);
     auto self = shared_from_this();
-    auto& system = socket_system::instance();
     co_spawn(
-        system.context(),
+        context_,
         [self, acceptor_id, this]() -> asio::awaitable<void> {
             std::ignore = self;
             co_await co_handshake(acceptor_id);
@@ -28,11 +47,14 @@ void ssl_session_impl::start(uint32_t acceptor_id) {
 
 void ssl_session_impl::accept() {
     auto self = shared_from_this();
-    auto& system = socket_system::instance();
-    auto& context = system.context();
+    if (!context_.get_executor().running_in_this_thread()) {
+        asio::post(context_, [self]() { self->accept(); });
+        return;
+    }
+
     // 发送协程
     co_spawn(
-        context,
+        context_,
         [self, this]() {
             std::ignore = self;
             return co_write();
@@ -41,7 +63,7 @@ void ssl_session_impl::accept() {
 
     // 接收协程
     co_spawn(
-        context,
+        context_,
         [self, this]() {
             std::ignore = self;
             return co_read();
@@ -50,6 +72,11 @@ void ssl_session_impl::accept() {
 }
 
 void ssl_session_impl::stop(const std::error_code& ec) {
+    if (!context_.get_executor().running_in_this_thread()) {
+        asio::post(context_, [self = shared_from_this(), ec]() { self->stop(ec); });
+        return;
+    }
+
     auto& socket_raw = socket_.next_layer();
     if (!socket_raw.is_open()) return;
 
@@ -57,8 +84,9 @@ void ssl_session_impl::stop(const std::error_code& ec) {
     std::error_code ignore;
     socket_.shutdown(ignore);
     socket_raw.close(ignore);
+    write_event_.cancel();
     try {
-        write_blocker_.cancel();
+        flush_timer_.cancel();
     } catch (...) {
     }
     auto& system = socket_system::instance();
@@ -67,27 +95,77 @@ void ssl_session_impl::stop(const std::error_code& ec) {
 }
 
 void ssl_session_impl::write(const memory_buffer_ptr& ptr) {
+    if (!context_.get_executor().running_in_this_thread()) {
+        asio::post(context_, [self = shared_from_this(), ptr]() { self->write(ptr); });
+        return;
+    }
+
     trace_write_queue(ptr->readable());
     write_deque_.emplace_back(ptr);
-    try {
-        write_blocker_.cancel();
-    } catch (...) {
+    if (write_policy_.delay_us > 0 && !write_batching()) {
+        // 已经攒够了数据，不用再等
+        try {
+            flush_timer_.cancel();
+        } catch (...) {
+        }
     }
+    write_event_.notify();
 }
 
 void ssl_session_impl::no_delay(bool on) {
+    if (!context_.get_executor().running_in_this_thread()) {
+        asio::post(context_, [self = shared_from_this(), on]() { self->no_delay(on); });
+        return;
+    }
+
     std::error_code ec;
     socket_.next_layer().set_option(tcp::no_delay{on}, ec);
 }
 
+void ssl_session_impl::write_policy(const socket_write_policy& policy) {
+    if (!context_.get_executor().running_in_this_thread()) {
+        asio::post(context_, [self = shared_from_this(), policy]() { self->write_policy(policy); });
+        return;
+    }
+
+    socket_base::write_policy(policy);
+}
+
+void ssl_session_impl::watermark(const socket_watermark& watermark) {
+    if (!context_.get_executor().running_in_this_thread()) {
+        asio::post(context_, [self = shared_from_this(), watermark]() { self->watermark(watermark); });
+        return;
+    }
+
+    socket_base::watermark(watermark);
+}
+
+void ssl_session_impl::sync_listener(const listener_settings& listener) {
+    if (!context_.get_executor().running_in_this_thread()) {
+        asio::post(context_, [self = shared_from_this(), listener]() { self->sync_listener(listener); });
+        return;
+    }
+
+    socket_base::sync_listener(listener);
+}
+
+void ssl_session_impl::frame_codec(const socket_frame_codec& codec) {
+    if (!context_.get_executor().running_in_this_thread()) {
+        asio::post(context_, [self = shared_from_this(), codec]() { self->frame_codec(codec); });
+        return;
+    }
+
+    socket_base::frame_codec(codec);
+}
+
 asio::awaitable<void> ssl_session_impl::co_handshake(uint32_t acceptor_id) {
     // ssl握手
     if (auto [ec] = co_await socket_.async_handshake(ssl_socket::server, use_awaitable_as_tuple); ec) {
         stop(ec);
         co_return;
     }
+    trace_handshake(SSL_session_reused(socket_.native_handle()) == 1);
 
-    write_blocker_.expires_at(asio_timer::clock_type::time_point::max());
     auto& system = socket_system::instance();
     auto self = shared_from_this();
     system.insert(socket_id_, self);
@@ -100,7 +178,6 @@ asio::awaitable<void> ssl_session_impl::co_handshake(uint32_t acceptor_id) {
 }
 
 asio::awaitable<void> ssl_session_impl::co_read() {
-    const auto& system = socket_system::instance();
     uint8_t data[1024];
     for (;;) {
         auto [ec, len] = co_await socket_.async_read_some(asio::buffer(data), use_awaitable_as_tuple);
@@ -109,8 +186,11 @@ asio::awaitable<void> ssl_session_impl::co_read() {
             co_return;
         }
 
-        system.hand_read(socket_id_, data, len);
         trace_read(len);
+        if (!hand_data(data, len)) {
+            stop(socket_errors::frame_too_large);
+            co_return;
+        }
     }
 }
 
@@ -124,7 +204,15 @@ asio::awaitable<void> ssl_session_impl::co_write() {
 
     while (socket_raw.is_open()) {
         if (write_deque_.empty()) {
-            co_await write_blocker_.async_wait();
+            co_await write_event_.async_wait(use_awaitable_as_tuple);
+            if (!socket_raw.is_open()) co_return;
+            if (write_deque_.empty()) continue;
+        }
+
+        if (write_batching()) {
+            // 等待更多的数据，合并成一次发送
+            flush_timer_.expires_after(std::chrono::microseconds(write_policy_.delay_us));
+            co_await flush_timer_.async_wait();
             if (!socket_raw.is_open()) co_return;
         }
 
@@ -138,11 +226,13 @@ asio::awaitable<void> ssl_session_impl::co_write() {
         }
 
         write_deque_.erase(it_begin, it_end);
+        const auto write_begin = std::chrono::steady_clock::now();
         auto [ec, len] = co_await async_write(socket_, buffers, use_awaitable_as_tuple);
         buffers.clear();
         cache_write.clear();
         trace_write_queue(-static_cast<int64_t>(len));
-        trace_write(len);
+        const auto write_elapsed = std::chrono::steady_clock::now() - write_begin;
+        trace_write(len, std::chrono::duration_cast<std::chrono::microseconds>(write_elapsed).count());
     }
 }
 
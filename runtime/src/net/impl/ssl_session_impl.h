@@ -9,7 +9,9 @@
 #include <asio/use_awaitable.hpp>
 #include <deque>
 
+#include "socket_event.hpp"
 #include "socket_impl.hpp"
+#include "ssl_worker_pool.h"
 
 namespace simple {
 
@@ -20,9 +22,11 @@ class ssl_session_impl final : public socket_base, public std::enable_shared_fro
     using ssl_socket = asio::ssl::stream<tcp::socket>;
     using asio_timer = asio_token::as_default_on_t<asio::steady_timer>;
 
-    ssl_session_impl(uint32_t socket_id, tcp::socket socket, std::shared_ptr<asio::ssl::context> ctx);
+    // socket 绑定在 context 上，使用线程池时 context 是分到的线程，workers 保证线程池在连接释放之前不会停止
+    ssl_session_impl(uint32_t socket_id, tcp::socket socket, std::shared_ptr<asio::ssl::context> ctx,
+                     asio::io_context& context, std::shared_ptr<ssl_worker_pool> workers);
 
-    ~ssl_session_impl() noexcept override = default;
+    ~ssl_session_impl() noexcept override;
 
     SIMPLE_NON_COPYABLE(ssl_session_impl)
 
@@ -36,6 +40,18 @@ class ssl_session_impl final : public socket_base, public std::enable_shared_fro
 
     void no_delay(bool on) override;
 
+    // 发送策略和水位在发送的线程中使用，也要在这个线程中设置
+    using socket_base::write_policy;
+    void write_policy(const socket_write_policy& policy) override;
+
+    using socket_base::watermark;
+    void watermark(const socket_watermark& watermark) override;
+
+    // 在读取数据的线程中设置分帧规则
+    void frame_codec(const socket_frame_codec& codec) override;
+
+    void sync_listener(const listener_settings& listener) override;
+
   private:
     asio::awaitable<void> co_handshake(uint32_t acceptor_id);
 
@@ -44,8 +60,11 @@ class ssl_session_impl final : public socket_base, public std::enable_shared_fro
     asio::awaitable<void> co_write();
 
     std::shared_ptr<asio::ssl::context> ctx_;
+    asio::io_context& context_;
+    std::shared_ptr<ssl_worker_pool> workers_;
     ssl_socket socket_;
-    asio_timer write_blocker_;
+    socket_event write_event_;
+    asio_timer flush_timer_;
     std::deque<memory_buffer_ptr> write_deque_;
 };
 
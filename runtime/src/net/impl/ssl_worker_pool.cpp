@@ -0,0 +1,34 @@
+﻿#include "ssl_worker_pool.h"
+
+#include <simple/log/log.h>
+
+namespace simple {
+
+ssl_worker_pool::ssl_worker_pool(uint32_t count) {
+    contexts_.reserve(count);
+    works_.reserve(count);
+    threads_.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        auto& context = *contexts_.emplace_back(std::make_unique<asio::io_context>(1));
+        works_.emplace_back(context.get_executor());
+        threads_.emplace_back([&context, i]() {
+            try {
+                context.run();
+            } catch (std::exception& e) {
+                critical("ssl worker {} thread {}", i, e.what());
+            }
+        });
+    }
+}
+
+ssl_worker_pool::~ssl_worker_pool() noexcept {
+    works_.clear();
+    for (size_t i = 0; i < threads_.size(); ++i) {
+        contexts_[i]->stop();
+        threads_[i].join();
+    }
+}
+
+asio::io_context& ssl_worker_pool::next() { return *contexts_[next_++ % contexts_.size()]; }
+
+}  // namespace simple
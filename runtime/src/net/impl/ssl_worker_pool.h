@@ -0,0 +1,34 @@
+﻿#pragma once
+#include <simple/config.h>
+
+#include <asio/executor_work_guard.hpp>
+#include <asio/io_context.hpp>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace simple {
+
+// ssl 连接的线程池，每个线程一个 io_context，连接的 socket 和加解密都在分到的线程中
+// 接受连接的监听和所有的连接共享，最后一个连接释放后才停止线程，不能在线程池自己的线程中释放
+class ssl_worker_pool {
+  public:
+    explicit ssl_worker_pool(uint32_t count);
+
+    SIMPLE_NON_COPYABLE(ssl_worker_pool)
+
+    ~ssl_worker_pool() noexcept;
+
+    // 轮流分配线程，在网络线程中调用
+    asio::io_context& next();
+
+  private:
+    using work_guard = asio::executor_work_guard<asio::io_context::executor_type>;
+
+    std::vector<std::unique_ptr<asio::io_context>> contexts_;
+    std::vector<work_guard> works_;
+    std::vector<std::thread> threads_;
+    size_t next_{0};
+};
+
+}  // namespace simple
@@ -1,5 +1,6 @@
 ﻿#include "tcp_client_impl.h"
 
+#include <simple/error.h>
 #include <simple/log/log.h>
 #include <simple/net/socket_system.h>
 
@@ -13,13 +14,15 @@ namespace simple {
 tcp_client_impl::tcp_client_impl(uint32_t socket_id)  // NOLINT
     : socket_base(socket_id),
       socket_(socket_system::instance().context()),
-      write_blocker_(socket_.get_executor()),
+      write_event_(socket_.get_executor()),
+      flush_timer_(socket_.get_executor()),
       connect_(socket_.get_executor()) {}
 
+constexpr tcp_client_impl::asio_token use_awaitable_as_tuple;
+
 void tcp_client_impl::start(const std::string& host, const std::string& service, const asio_timer::duration& timeout) {
     using namespace asio::experimental::awaitable_operators;
     info("tcp client {} start", socket_id_);
-    write_blocker_.expires_at(asio_timer::clock_type::time_point::max());
     auto self = shared_from_this();
     auto& system = socket_system::instance();
     system.insert(socket_id_, self);
@@ -40,8 +43,12 @@ void tcp_client_impl::stop(const std::error_code& ec) {
     std::error_code ignore;
     socket_.shutdown(tcp::socket::shutdown_both, ignore);
     socket_.close(ignore);
+    write_event_.cancel();
+    try {
+        flush_timer_.cancel();
+    } catch (...) {
+    }
     try {
-        write_blocker_.cancel();
         connect_.cancel();
     } catch (...) {
     }
@@ -54,10 +61,14 @@ void tcp_client_impl::stop(const std::error_code& ec) {
 void tcp_client_impl::write(const memory_buffer_ptr& ptr) {
     trace_write_queue(ptr->readable());
     write_deque_.emplace_back(ptr);
-    try {
-        write_blocker_.cancel();
-    } catch (...) {
+    if (write_policy_.delay_us > 0 && !write_batching()) {
+        // 已经攒够了数据，不用再等
+        try {
+            flush_timer_.cancel();
+        } catch (...) {
+        }
     }
+    write_event_.notify();
 }
 
 void tcp_client_impl::no_delay(bool on) {
@@ -115,7 +126,6 @@ asio::awaitable<void> tcp_client_impl::co_timeout(const asio_timer::duration& ti
 }
 
 asio::awaitable<void> tcp_client_impl::co_read() {
-    const auto& system = socket_system::instance();
     uint8_t data[1024];
     for (;;) {
         auto [ec, len] = co_await socket_.async_read_some(asio::buffer(data));
@@ -124,8 +134,11 @@ asio::awaitable<void> tcp_client_impl::co_read() {
             co_return;
         }
 
-        system.hand_read(socket_id_, data, len);
         trace_read(len);
+        if (!hand_data(data, len)) {
+            stop(socket_errors::frame_too_large);
+            co_return;
+        }
     }
 }
 
@@ -138,7 +151,15 @@ asio::awaitable<void> tcp_client_impl::co_write() {
 
     while (socket_.is_open()) {
         if (write_deque_.empty()) {
-            co_await write_blocker_.async_wait();
+            co_await write_event_.async_wait(use_awaitable_as_tuple);
+            if (!socket_.is_open()) co_return;
+            if (write_deque_.empty()) continue;
+        }
+
+        if (write_batching()) {
+            // 等待更多的数据，合并成一次发送
+            flush_timer_.expires_after(std::chrono::microseconds(write_policy_.delay_us));
+            co_await flush_timer_.async_wait();
             if (!socket_.is_open()) co_return;
         }
 
@@ -152,11 +173,13 @@ asio::awaitable<void> tcp_client_impl::co_write() {
         }
 
         write_deque_.erase(it_begin, it_end);
+        const auto write_begin = std::chrono::steady_clock::now();
         auto [ec, len] = co_await async_write(socket_, buffers);
         buffers.clear();
         cache_write.clear();
         trace_write_queue(-static_cast<int64_t>(len));
-        trace_write(len);
+        const auto write_elapsed = std::chrono::steady_clock::now() - write_begin;
+        trace_write(len, std::chrono::duration_cast<std::chrono::microseconds>(write_elapsed).count());
     }
 }
 
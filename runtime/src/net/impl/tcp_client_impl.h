@@ -7,6 +7,7 @@
 #include <asio/use_awaitable.hpp>
 #include <deque>
 
+#include "socket_event.hpp"
 #include "socket_impl.hpp"
 
 namespace simple {
@@ -42,7 +43,8 @@ class tcp_client_impl final : public socket_base, public std::enable_shared_from
     asio::awaitable<void> co_write();
 
     tcp_socket socket_;
-    asio_timer write_blocker_;
+    socket_event write_event_;
+    asio_timer flush_timer_;
     asio_timer connect_;
     std::deque<memory_buffer_ptr> write_deque_;
 };
@@ -12,7 +12,9 @@
 namespace simple {
 
 tcp_server_impl::tcp_server_impl(uint32_t socket_id)  // NOLINT(cppcoreguidelines-pro-type-member-init)
-    : socket_base(socket_id), acceptor_(socket_system::instance().context()) {}
+    : socket_base(socket_id),
+      acceptor_(socket_system::instance().context()),
+      throttle_(socket_system::instance().context()) {}
 
 void tcp_server_impl::start(const tcp::endpoint& endpoint, bool reuse) {
     info("tcp server {} start", socket_id_);
@@ -46,6 +48,10 @@ void tcp_server_impl::stop(const std::error_code& ec) {
     info("tcp server {} stop", socket_id_);
     std::error_code ignore;
     acceptor_.close(ignore);
+    try {
+        throttle_.cancel();
+    } catch (...) {
+    }
     auto& system = socket_system::instance();
     system.hand_stop(socket_id_, ec);
     system.erase(socket_id_);
@@ -54,16 +60,36 @@ void tcp_server_impl::stop(const std::error_code& ec) {
 asio::awaitable<void> tcp_server_impl::co_accept() {
     auto& system = socket_system::instance();
     while (acceptor_.is_open()) {
+        if (accept_limiter_) {
+            // 超过接受的速率时先不 accept，新连接留在系统的 backlog 里
+            if (const auto wait = accept_limiter_->throttle(); wait > asio_timer::duration::zero()) {
+                throttle_.expires_after(wait);
+                co_await throttle_.async_wait();
+                continue;
+            }
+        }
+
         if (auto [ec, socket] = co_await acceptor_.async_accept(); socket.is_open()) {
+            std::error_code ignore;
+            const auto remote = socket.remote_endpoint(ignore);
+            if (accept_limiter_ && !accept_limiter_->acquire(remote.address())) {
+                trace_reject();
+                socket.close(ignore);
+                continue;
+            }
+
             const auto id = system.new_socket_id(socket_type::tcp_session);
             if (id == 0) {
                 warn("tcp server {} accept fail, no new socket id", socket_id_);
-                std::error_code ignore;
+                if (accept_limiter_) {
+                    accept_limiter_->release(remote.address());
+                }
                 socket.close(ignore);
                 continue;
             }
-            trace_read(1);
+            trace_accept();
             const auto session = std::make_shared<tcp_session_impl>(id, std::move(socket));
+            session->inherit(*this, remote.address());
             session->start(socket_id_);
         } else {
             warn("tcp server {} accept fail, {}", socket_id_, ERROR_CODE_MESSAGE(ec.message()));
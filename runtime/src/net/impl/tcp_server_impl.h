@@ -3,6 +3,7 @@
 #include <asio/as_tuple.hpp>
 #include <asio/awaitable.hpp>
 #include <asio/ip/tcp.hpp>
+#include <asio/steady_timer.hpp>
 #include <asio/use_awaitable.hpp>
 
 #include "socket_impl.hpp"
@@ -14,6 +15,7 @@ class tcp_server_impl final : public socket_base, public std::enable_shared_from
     using asio_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
     using tcp = asio::ip::tcp;
     using tcp_acceptor = asio_token::as_default_on_t<tcp::acceptor>;
+    using asio_timer = asio_token::as_default_on_t<asio::steady_timer>;
 
     explicit tcp_server_impl(uint32_t socket_id);
 
@@ -29,6 +31,7 @@ class tcp_server_impl final : public socket_base, public std::enable_shared_from
     asio::awaitable<void> co_accept();
 
     tcp_acceptor acceptor_;
+    asio_timer throttle_;
 };
 
 }  // namespace simple
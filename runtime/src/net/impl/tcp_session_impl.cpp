@@ -1,5 +1,6 @@
 ﻿#include "tcp_session_impl.h"
 
+#include <simple/error.h>
 #include <simple/log/log.h>
 #include <simple/net/socket_system.h>
 
@@ -10,11 +11,15 @@
 namespace simple {
 
 tcp_session_impl::tcp_session_impl(uint32_t socket_id, tcp_socket socket)  // NOLINT
-    : socket_base(socket_id), socket_(std::move(socket)), write_blocker_(socket_.get_executor()) {}
+    : socket_base(socket_id),
+      socket_(std::move(socket)),
+      write_event_(socket_.get_executor()),
+      flush_timer_(socket_.get_executor()) {}
+
+constexpr tcp_session_impl::asio_token use_awaitable_as_tuple;
 
 void tcp_session_impl::start(uint32_t acceptor_id) {
     info("tcp session {} acceptor:{} start", socket_id_, acceptor_id);
-    write_blocker_.expires_at(asio_timer::clock_type::time_point::max());
     auto& system = socket_system::instance();
     const auto self = shared_from_this();
     system.insert(socket_id_, self);
@@ -55,11 +60,11 @@ void tcp_session_impl::stop(const std::error_code& ec) {
     std::error_code ignore;
     socket_.shutdown(tcp::socket::shutdown_both, ignore);
     socket_.close(ignore);
+    write_event_.cancel();
     try {
-        write_blocker_.cancel();
+        flush_timer_.cancel();
     } catch (...) {
     }
-    write_blocker_.cancel();
     auto& system = socket_system::instance();
     system.hand_stop(socket_id_, ec);
     system.erase(socket_id_);
@@ -68,10 +73,14 @@ void tcp_session_impl::stop(const std::error_code& ec) {
 void tcp_session_impl::write(const memory_buffer_ptr& ptr) {
     trace_write_queue(ptr->readable());
     write_deque_.emplace_back(ptr);
-    try {
-        write_blocker_.cancel();
-    } catch (...) {
+    if (write_policy_.delay_us > 0 && !write_batching()) {
+        // 已经攒够了数据，不用再等
+        try {
+            flush_timer_.cancel();
+        } catch (...) {
+        }
     }
+    write_event_.notify();
 }
 
 void tcp_session_impl::no_delay(bool on) {
@@ -80,7 +89,6 @@ void tcp_session_impl::no_delay(bool on) {
 }
 
 asio::awaitable<void> tcp_session_impl::co_read() {
-    const auto& system = socket_system::instance();
     uint8_t data[1024];
     for (;;) {
         auto [ec, len] = co_await socket_.async_read_some(asio::buffer(data));
@@ -89,8 +97,11 @@ asio::awaitable<void> tcp_session_impl::co_read() {
             co_return;
         }
 
-        system.hand_read(socket_id_, data, len);
         trace_read(len);
+        if (!hand_data(data, len)) {
+            stop(socket_errors::frame_too_large);
+            co_return;
+        }
     }
 }
 
@@ -103,7 +114,15 @@ asio::awaitable<void> tcp_session_impl::co_write() {
 
     while (socket_.is_open()) {
         if (write_deque_.empty()) {
-            co_await write_blocker_.async_wait();
+            co_await write_event_.async_wait(use_awaitable_as_tuple);
+            if (!socket_.is_open()) co_return;
+            if (write_deque_.empty()) continue;
+        }
+
+        if (write_batching()) {
+            // 等待更多的数据，合并成一次发送
+            flush_timer_.expires_after(std::chrono::microseconds(write_policy_.delay_us));
+            co_await flush_timer_.async_wait();
             if (!socket_.is_open()) co_return;
         }
 
@@ -117,11 +136,13 @@ asio::awaitable<void> tcp_session_impl::co_write() {
         }
 
         write_deque_.erase(it_begin, it_end);
+        const auto write_begin = std::chrono::steady_clock::now();
         auto [ec, len] = co_await async_write(socket_, buffers);
         buffers.clear();
         cache_write.clear();
         trace_write_queue(-static_cast<int64_t>(len));
-        trace_write(len);
+        const auto write_elapsed = std::chrono::steady_clock::now() - write_begin;
+        trace_write(len, std::chrono::duration_cast<std::chrono::microseconds>(write_elapsed).count());
     }
 }
 
@@ -7,6 +7,7 @@
 #include <asio/use_awaitable.hpp>
 #include <deque>
 
+#include "socket_event.hpp"
 #include "socket_impl.hpp"
 
 namespace simple {
@@ -40,7 +41,8 @@ class tcp_session_impl final : public socket_base, public std::enable_shared_fro
     asio::awaitable<void> co_write();
 
     tcp_socket socket_;
-    asio_timer write_blocker_;
+    socket_event write_event_;
+    asio_timer flush_timer_;
     std::deque<memory_buffer_ptr> write_deque_;
 };
 
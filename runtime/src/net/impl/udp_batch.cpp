@@ -0,0 +1,203 @@
+﻿#include "udp_batch.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#if defined(__linux__)
+#include <netinet/in.h>
+#endif
+
+namespace simple {
+
+udp_batch::udp_batch(size_t count, size_t datagram_size)
+    : count_(count),
+      datagram_size_(datagram_size),
+      buffers_(count * datagram_size),
+      sizes_(count),
+      remotes_(count),
+      queue_(count)
+#if defined(__linux__)
+      ,
+      msgs_(count),
+      iovecs_(count)
+#endif
+{
+}
+
+#if defined(__linux__)
+
+void udp_batch::dont_fragment(udp::socket& socket) {
+    // 设置 DF 并且忽略内核缓存的路径 mtu，ipv6 的 socket 同时设置 ipv4 的选项，覆盖双栈监听时映射的地址
+    const auto fd = socket.native_handle();
+    int value = IP_PMTUDISC_PROBE;
+    ::setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &value, sizeof(value));
+    if (std::error_code ec; socket.local_endpoint(ec).protocol() == udp::v6()) {
+        value = IPV6_PMTUDISC_PROBE;
+        ::setsockopt(fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &value, sizeof(value));
+    }
+}
+
+size_t udp_batch::receive(udp::socket& socket, std::error_code& ec) {
+    ec.clear();
+    for (size_t i = 0; i < count_; ++i) {
+        iovecs_[i] = {data(i), datagram_size_};
+        auto& hdr = msgs_[i].msg_hdr;
+        hdr = {};
+        hdr.msg_name = remotes_[i].data();
+        hdr.msg_namelen = static_cast<socklen_t>(remotes_[i].capacity());
+        hdr.msg_iov = &iovecs_[i];
+        hdr.msg_iovlen = 1;
+    }
+
+    const auto ret = ::recvmmsg(socket.native_handle(), msgs_.data(), static_cast<unsigned>(count_), MSG_DONTWAIT, nullptr);
+    if (ret < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            ec = std::error_code(errno, asio::error::get_system_category());
+        }
+        return 0;
+    }
+
+    const auto count = static_cast<size_t>(ret);
+    for (size_t i = 0; i < count; ++i) {
+        const auto& hdr = msgs_[i].msg_hdr;
+        remotes_[i].resize(hdr.msg_namelen);
+        // 超过 mtu 被截断的包当作无效的包
+        sizes_[i] = (hdr.msg_flags & MSG_TRUNC) ? 0 : msgs_[i].msg_len;
+    }
+    return count;
+}
+
+bool udp_batch::send(udp::socket& socket) {
+    while (queue_size_ > 0) {
+        const auto count = std::min(count_, queue_size_);
+        for (size_t i = 0; i < count; ++i) {
+            auto& item = queue_at(i);
+            iovecs_[i] = {item.slot, item.size};
+            auto& hdr = msgs_[i].msg_hdr;
+            hdr = {};
+            if (!item.connected) {
+                hdr.msg_name = item.remote.data();
+                hdr.msg_namelen = static_cast<socklen_t>(item.remote.size());
+            }
+            hdr.msg_iov = &iovecs_[i];
+            hdr.msg_iovlen = 1;
+        }
+
+        const auto ret = ::sendmmsg(socket.native_handle(), msgs_.data(), static_cast<unsigned>(count), MSG_DONTWAIT);
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return false;
+            }
+            if (errno != EINTR) {
+                pop(1);
+            }
+            continue;
+        }
+
+        pop(static_cast<size_t>(ret));
+    }
+    return true;
+}
+
+#else
+
+void udp_batch::dont_fragment(udp::socket&) {}
+
+size_t udp_batch::receive(udp::socket& socket, std::error_code& ec) {
+    size_t count = 0;
+    while (count < count_) {
+        sizes_[count] = socket.receive_from(asio::buffer(data(count), datagram_size_), remotes_[count], 0, ec);
+        if (ec == asio::error::message_size) {
+            // 超过 mtu 被截断的包直接丢弃
+            continue;
+        }
+
+        if (ec) {
+            if (ec == asio::error::would_block) {
+                ec.clear();
+            }
+            break;
+        }
+        ++count;
+    }
+    return count;
+}
+
+bool udp_batch::send(udp::socket& socket) {
+    std::error_code ec;
+    while (queue_size_ > 0) {
+        const auto& item = queue_at(0);
+        if (item.connected) {
+            socket.send(asio::buffer(item.slot, item.size), 0, ec);
+        } else {
+            socket.send_to(asio::buffer(item.slot, item.size), item.remote, 0, ec);
+        }
+
+        if (ec == asio::error::would_block) {
+            return false;
+        }
+        pop(1);
+    }
+    return true;
+}
+
+#endif
+
+udp_batch::datagram* udp_batch::prepare(const void* head, size_t head_len, const void* data, size_t len) {
+    if (head_len + len > datagram_size_) {
+        return nullptr;
+    }
+
+    if (free_slots_.empty()) {
+        auto chunk = std::make_unique<uint8_t[]>(slab_chunk * datagram_size_);
+        for (size_t i = 0; i < slab_chunk; ++i) {
+            free_slots_.emplace_back(chunk.get() + i * datagram_size_);
+        }
+        slab_.emplace_back(std::move(chunk));
+        free_slots_.reserve(slab_.size() * slab_chunk);
+    }
+
+    if (queue_size_ == queue_.size()) {
+        // 队列满了，按顺序搬到两倍大小的新队列中
+        std::vector<datagram> temp(queue_.size() * 2);
+        for (size_t i = 0; i < queue_size_; ++i) {
+            temp[i] = queue_at(i);
+        }
+        queue_ = std::move(temp);
+        queue_head_ = 0;
+    }
+
+    auto& item = queue_at(queue_size_++);
+    item.slot = free_slots_.back();
+    free_slots_.pop_back();
+    memcpy(item.slot, head, head_len);
+    if (len > 0) {
+        memcpy(item.slot + head_len, data, len);
+    }
+    item.size = head_len + len;
+    return &item;
+}
+
+void udp_batch::push(const udp::endpoint& remote, const void* head, size_t head_len, const void* data, size_t len) {
+    if (auto* item = prepare(head, head_len, data, len)) {
+        item->remote = remote;
+        item->connected = false;
+    }
+}
+
+void udp_batch::push(const void* head, size_t head_len, const void* data, size_t len) {
+    if (auto* item = prepare(head, head_len, data, len)) {
+        item->connected = true;
+    }
+}
+
+void udp_batch::pop(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        free_slots_.emplace_back(queue_at(i).slot);
+    }
+    queue_head_ = (queue_head_ + count) % queue_.size();
+    queue_size_ -= count;
+}
+
+}  // namespace simple
@@ -0,0 +1,92 @@
+﻿#pragma once
+#include <simple/config.h>
+
+#include <asio/ip/udp.hpp>
+#include <cstdint>
+#include <memory>
+#include <system_error>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#endif
+
+namespace simple {
+
+// udp 批量收发，linux 上使用 recvmmsg/sendmmsg 一次系统调用处理多个包，其他平台逐个非阻塞收发
+// 只能在所属 io_context 的线程中使用
+class udp_batch {
+  public:
+    using udp = asio::ip::udp;
+
+    udp_batch(size_t count, size_t datagram_size);
+
+    SIMPLE_NON_COPYABLE(udp_batch)
+
+    ~udp_batch() noexcept = default;
+
+    // 发送的包设置不分片，用来探测路径 mtu，超过路径 mtu 的包会被丢弃而不是分片后送达
+    // 只在 linux 上生效，其他平台保持系统默认的行为
+    static void dont_fragment(udp::socket& socket);
+
+    [[nodiscard]] size_t datagram_size() const { return datagram_size_; }
+
+    // 非阻塞接收，返回收到的包数量，没有数据时返回 0
+    size_t receive(udp::socket& socket, std::error_code& ec);
+
+    [[nodiscard]] size_t capacity() const { return count_; }
+
+    [[nodiscard]] uint8_t* data(size_t i) { return buffers_.data() + i * datagram_size_; }
+
+    [[nodiscard]] size_t size(size_t i) const { return sizes_[i]; }
+
+    [[nodiscard]] const udp::endpoint& remote(size_t i) const { return remotes_[i]; }
+
+    // 从 slab 中取一个槽拼接 head 和 data，加入发送队列，超过槽大小的包直接丢弃
+    void push(const udp::endpoint& remote, const void* head, size_t head_len, const void* data = nullptr, size_t len = 0);
+
+    // 已经 connect 的 socket 不需要 remote
+    void push(const void* head, size_t head_len, const void* data = nullptr, size_t len = 0);
+
+    [[nodiscard]] bool empty() const { return queue_size_ == 0; }
+
+    // 非阻塞发送队列中的包，全部发送完返回 true，socket 不可写时保留剩下的包返回 false
+    // udp 的发送错误直接丢弃对应的包
+    bool send(udp::socket& socket);
+
+  private:
+    struct datagram {
+        udp::endpoint remote;
+        uint8_t* slot;
+        size_t size;
+        bool connected;
+    };
+
+    // 每次扩充 slab 的槽数量
+    static constexpr size_t slab_chunk = 64;
+
+    datagram* prepare(const void* head, size_t head_len, const void* data, size_t len);
+
+    [[nodiscard]] datagram& queue_at(size_t i) { return queue_[(queue_head_ + i) % queue_.size()]; }
+
+    void pop(size_t count);
+
+    size_t count_;
+    size_t datagram_size_;
+    std::vector<uint8_t> buffers_;
+    std::vector<size_t> sizes_;
+    std::vector<udp::endpoint> remotes_;
+    // 发送用的槽，稳定之后收发都不再申请内存
+    std::vector<std::unique_ptr<uint8_t[]>> slab_;
+    std::vector<uint8_t*> free_slots_;
+    // 发送队列，环形缓冲区
+    std::vector<datagram> queue_;
+    size_t queue_head_{0};
+    size_t queue_size_{0};
+#if defined(__linux__)
+    std::vector<mmsghdr> msgs_;
+    std::vector<iovec> iovecs_;
+#endif
+};
+
+}  // namespace simple
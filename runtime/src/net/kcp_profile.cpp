@@ -0,0 +1,64 @@
+﻿#include <simple/net/kcp_profile.h>
+
+#include <stdexcept>
+#include <string>
+
+namespace simple {
+
+static void read_profile_value(uint32_t& value, const std::string& key, const toml_table_t& table) {
+    const auto it = table.find(key);
+    if (it == table.end()) {
+        return;
+    }
+
+    if (!it->second.is_integer() || it->second.as_integer() < 0) {
+        throw std::logic_error("kcp profile " + key + " need non-negative integer");
+    }
+
+    value = static_cast<uint32_t>(it->second.as_integer());
+}
+
+static void read_profile_value(bool& value, const std::string& key, const toml_table_t& table) {
+    const auto it = table.find(key);
+    if (it == table.end()) {
+        return;
+    }
+
+    if (!it->second.is_boolean()) {
+        throw std::logic_error("kcp profile " + key + " need boolean");
+    }
+
+    value = it->second.as_boolean();
+}
+
+kcp_profile load_kcp_profile(const toml_table_t& table) {
+    kcp_profile profile;
+    if (const auto it = table.find("preset"); it != table.end()) {
+        const auto preset = it->second.is_string() ? it->second.as_string() : std::string{};
+        if (preset == "lan") {
+            profile = kcp_profile::lan();
+        } else if (preset == "mobile") {
+            profile = kcp_profile::mobile();
+        } else if (preset != "default") {
+            throw std::logic_error("kcp profile unknown preset");
+        }
+    }
+
+    read_profile_value(profile.mtu, "mtu", table);
+    read_profile_value(profile.snd_wnd, "snd_wnd", table);
+    read_profile_value(profile.rcv_wnd, "rcv_wnd", table);
+    read_profile_value(profile.nodelay, "nodelay", table);
+    read_profile_value(profile.interval, "interval", table);
+    read_profile_value(profile.resend, "resend", table);
+    read_profile_value(profile.nc, "nc", table);
+    read_profile_value(profile.min_rto, "min_rto", table);
+    read_profile_value(profile.mtu_probe, "mtu_probe", table);
+    read_profile_value(profile.max_mtu, "max_mtu", table);
+    read_profile_value(profile.fec_data, "fec_data", table);
+    read_profile_value(profile.fec_parity, "fec_parity", table);
+    read_profile_value(profile.shards, "shards", table);
+    read_profile_value(profile.legacy_connect, "legacy_connect", table);
+    return profile;
+}
+
+}  // namespace simple
@@ -6,6 +6,7 @@
 #include <asio/buffer.hpp>
 #include <asio/detail/buffer_sequence_adapter.hpp>
 #include <asio/ip/udp.hpp>
+#include <stdexcept>
 #include <vector>
 
 #include "impl/kcp_client_impl.h"
@@ -136,7 +137,8 @@ uint32_t socket_system::tcp_listen(const std::string& host, uint16_t port, bool
 }
 
 uint32_t socket_system::ssl_listen(const std::string& host, uint16_t port, bool reuse, const std::string& cert,
-                                   const std::string& key, const std::string& dh, const std::string& password) {
+                                   const std::string& key, const std::string& dh, const std::string& password,
+                                   uint32_t workers) {
     using namespace asio::ip;
     tcp::endpoint local;
     if (host.empty()) {
@@ -160,13 +162,13 @@ uint32_t socket_system::ssl_listen(const std::string& host, uint16_t port, bool
     }
 
     auto server = std::make_shared<ssl_server_impl>(socket_id);
-    post(context_, [server, address = std::move(local), reuse, cert, key, dh, password]() {
-        return server->start(address, reuse, cert, key, dh, password);
+    post(context_, [server, address = std::move(local), reuse, cert, key, dh, password, workers]() {
+        return server->start(address, reuse, cert, key, dh, password, workers);
     });
     return socket_id;
 }
 
-uint32_t socket_system::kcp_listen(const std::string& host, uint16_t port, bool reuse) {
+uint32_t socket_system::kcp_listen(const std::string& host, uint16_t port, bool reuse, const kcp_profile& profile) {
     using namespace asio::ip;
     udp::endpoint local;
     if (host.empty()) {
@@ -189,13 +191,13 @@ uint32_t socket_system::kcp_listen(const std::string& host, uint16_t port, bool
         return 0;
     }
 
-    auto server = std::make_shared<kcp_server_impl>(socket_id);
+    auto server = std::make_shared<kcp_server_impl>(socket_id, profile);
     post(context_, [server, address = std::move(local), reuse]() { return server->start(address, reuse); });
     return socket_id;
 }
 
 uint32_t socket_system::tcp_connect(const std::string& host, const std::string& service,
-                                    const std::chrono::milliseconds& timeout) {
+                                    const std::chrono::milliseconds& timeout, const socket_frame_codec& codec) {
     const auto socket_id = new_socket_id(socket_type::tcp_client);
     if (socket_id == 0) {
         warn("tcp connect {},{} fail, no new socket id", host, service);
@@ -203,12 +205,15 @@ uint32_t socket_system::tcp_connect(const std::string& host, const std::string&
     }
 
     auto client = std::make_shared<tcp_client_impl>(socket_id);
+    // 投递到网络线程之前设置，开始读取时已经生效
+    client->frame_codec(codec);
     post(context_, [client, host, service, timeout]() { return client->start(host, service, timeout); });
     return socket_id;
 }
 
 uint32_t socket_system::ssl_connect(const std::string& host, const std::string& service,
-                                    const std::chrono::milliseconds& timeout, const std::string& verify, bool ignore_cert) {
+                                    const std::chrono::milliseconds& timeout, const std::string& verify, bool ignore_cert,
+                                    const socket_frame_codec& codec) {
     const auto socket_id = new_socket_id(socket_type::ssl_client);
     if (socket_id == 0) {
         warn("ssl connect {},{} fail, no new socket id", host, service);
@@ -216,6 +221,7 @@ uint32_t socket_system::ssl_connect(const std::string& host, const std::string&
     }
 
     auto client = std::make_shared<ssl_client_impl>(socket_id);
+    client->frame_codec(codec);
     post(context_, [client, host, service, timeout, verify, ignore_cert]() {
         return client->start(host, service, timeout, verify, ignore_cert);
     });
@@ -223,14 +229,16 @@ uint32_t socket_system::ssl_connect(const std::string& host, const std::string&
 }
 
 uint32_t socket_system::kcp_connect(const std::string& host, const std::string& service,
-                                    const std::chrono::milliseconds& timeout) {
+                                    const std::chrono::milliseconds& timeout, const kcp_profile& profile,
+                                    const socket_frame_codec& codec) {
     const auto socket_id = new_socket_id(socket_type::kcp_client);
     if (socket_id == 0) {
         warn("kcp connect {},{} fail, no new socket id", host, service);
         return 0;
     }
 
-    auto client = std::make_shared<kcp_client_impl>(socket_id);
+    auto client = std::make_shared<kcp_client_impl>(socket_id, profile);
+    client->frame_codec(codec);
     post(context_, [client, host, service, timeout]() { return client->start(host, service, timeout); });
     return socket_id;
 }
@@ -242,20 +250,67 @@ void socket_system::send(uint32_t socket_id, const memory_buffer_ptr& buf) {
 
     post(context_, [socket_id, buf, this]() {
         if (const auto ptr = find(socket_id)) {
+            if (!ptr->write_acceptable(buf->readable())) {
+                // 对端收得太慢，发送队列超出上限，直接断开
+                warn("socket {} write queue overflow", socket_id);
+                return ptr->stop(socket_errors::write_queue_overflow);
+            }
             ptr->write(buf);
         }
     });
 }
 
+void socket_system::send(uint32_t socket_id, std::vector<memory_buffer_ptr> bufs) {
+    if (get_socket_class(socket_id) == socket_class::server) {
+        return;
+    }
+
+    post(context_, [socket_id, bufs = std::move(bufs), this]() { write_buffers(socket_id, bufs); });
+}
+
+void socket_system::send(std::vector<uint32_t> socket_ids, std::vector<memory_buffer_ptr> bufs) {
+    std::erase_if(socket_ids, [](uint32_t id) { return get_socket_class(id) == socket_class::server; });
+    if (socket_ids.empty()) {
+        return;
+    }
+
+    post(context_, [socket_ids = std::move(socket_ids), bufs = std::move(bufs), this]() {
+        for (const auto socket_id : socket_ids) {
+            write_buffers(socket_id, bufs);
+        }
+    });
+}
+
+void socket_system::write_buffers(uint32_t socket_id, const std::vector<memory_buffer_ptr>& bufs) {
+    const auto ptr = find(socket_id);
+    if (!ptr) return;
+
+    size_t size = 0;
+    for (const auto& buf : bufs) {
+        size += buf->readable();
+    }
+    if (!ptr->write_acceptable(size)) {
+        warn("socket {} write queue overflow", socket_id);
+        return ptr->stop(socket_errors::write_queue_overflow);
+    }
+    for (const auto& buf : bufs) {
+        ptr->write(buf);
+    }
+}
+
 void socket_system::accept(uint32_t socket_id) {
     if (get_socket_class(socket_id) != socket_class::session) {
         return;
     }
 
     post(context_, [socket_id, this]() {
-        if (const auto ptr = find(socket_id)) {
-            ptr->accept();
+        const auto ptr = find(socket_id);
+        if (!ptr) return;
+
+        if (const auto listener = find(ptr->listener_id())) {
+            ptr->sync_listener(listener->settings());
         }
+        ptr->accept();
     });
 }
 
@@ -279,25 +334,138 @@ void socket_system::no_delay(uint32_t socket_id, bool on) {
     });
 }
 
+void socket_system::write_policy(uint32_t socket_id, const socket_write_policy& policy) {
+    post(context_, [socket_id, policy, this]() {
+        if (const auto ptr = find(socket_id)) {
+            ptr->write_policy(policy);
+        }
+    });
+}
+
+void socket_system::watermark(uint32_t socket_id, const socket_watermark& watermark) {
+    post(context_, [socket_id, watermark, this]() {
+        if (const auto ptr = find(socket_id)) {
+            ptr->watermark(watermark);
+        }
+    });
+}
+
+void socket_system::accept_limit(uint32_t socket_id, const socket_accept_limit& limit) {
+    if (get_socket_class(socket_id) != socket_class::server) {
+        return;
+    }
+
+    post(context_, [socket_id, limit, this]() {
+        if (const auto ptr = find(socket_id)) {
+            ptr->accept_limit(limit);
+        }
+    });
+}
+
+void socket_system::frame_codec(uint32_t socket_id, const socket_frame_codec& codec) {
+    if (codec.length_size > 8 || static_cast<uint64_t>(codec.length_offset) + codec.length_size > codec.header_size) {
+        throw std::logic_error("socket frame codec length field out of header");
+    }
+
+    post(context_, [socket_id, codec, this]() {
+        if (const auto ptr = find(socket_id)) {
+            ptr->frame_codec(codec);
+        }
+    });
+}
+
+int64_t socket_system::write_queue_bytes() const noexcept { return socket_base::write_queue_bytes(); }
+
 void socket_system::hand_start(uint32_t socket_id, const std::string& local) const { start_(socket_id, local); }
 
 void socket_system::hand_stop(uint32_t socket_id, const std::error_code& ec) const { stop_(socket_id, ec); }
 
-void socket_system::hand_read(uint32_t socket_id, const uint8_t* data, size_t len) const { read_(socket_id, data, len); }
+void socket_system::hand_read(uint32_t socket_id, const uint8_t* data, size_t len) const {
+    read_(socket_id, memory_buffer(data, len));
+}
+
+void socket_system::hand_read(uint32_t socket_id, memory_buffer&& buf) const { read_(socket_id, std::move(buf)); }
+
+void socket_system::hand_frame(uint32_t socket_id, memory_buffer&& frame) const { frame_(socket_id, std::move(frame)); }
 
 void socket_system::hand_accept(uint32_t socket_id, uint32_t accepted, const std::string& local,
                                 const std::string& remote) const {
     accept_(socket_id, accepted, local, remote);
 }
 
+void socket_system::hand_writable(uint32_t socket_id, bool writable) const {
+    if (writable_) {
+        writable_(socket_id, writable);
+    }
+}
+
+std::vector<socket_stat> socket_system::socket_stats() {
+    std::vector<std::pair<uint32_t, counters_entry>> entries;
+    {
+        std::scoped_lock lock(mutex_counters_);
+        entries.reserve(counters_.size());
+        for (const auto& [id, entry] : counters_) {
+            entries.emplace_back(id, entry);
+        }
+    }
+
+    // 读计数器不需要加锁
+    std::vector<socket_stat> result(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        fill_socket_stat(entries[i].first, entries[i].second, result[i]);
+    }
+
+    return result;
+}
+
+bool socket_system::get_socket_stat(uint32_t socket_id, socket_stat& stat) {
+    counters_entry entry;
+    {
+        std::scoped_lock lock(mutex_counters_);
+        const auto it = counters_.find(socket_id);
+        if (it == counters_.end()) {
+            return false;
+        }
+        entry = it->second;
+    }
+
+    fill_socket_stat(socket_id, entry, stat);
+    return true;
+}
+
+std::vector<kcp_shard_stat> socket_system::kcp_shard_stats(uint32_t socket_id) {
+    if (const auto server = std::dynamic_pointer_cast<kcp_server_impl>(find(socket_id))) {
+        return server->shard_stats();
+    }
+
+    return {};
+}
+
+void socket_system::fill_socket_stat(uint32_t socket_id, const counters_entry& entry, socket_stat& stat) {
+    entry.counters->snapshot(stat);
+    stat.id = socket_id;
+    stat.listener = entry.listener;
+    stat.type = get_socket_type(socket_id);
+}
+
 void socket_system::insert(uint32_t socket_id, const socket_base_ptr& ptr) {
-    std::scoped_lock lock(mutex_sockets_);
-    sockets_.emplace(socket_id, ptr);
+    {
+        std::scoped_lock lock(mutex_sockets_);
+        sockets_.emplace(socket_id, ptr);
+    }
+
+    std::scoped_lock lock(mutex_counters_);
+    counters_.emplace(socket_id, counters_entry{ptr->listener_id(), ptr->counters()});
 }
 
 void socket_system::erase(uint32_t socket_id) {
-    std::scoped_lock lock(mutex_sockets_);
-    sockets_.erase(socket_id);
+    {
+        std::scoped_lock lock(mutex_sockets_);
+        sockets_.erase(socket_id);
+    }
+
+    std::scoped_lock lock(mutex_counters_);
+    counters_.erase(socket_id);
 }
 
 socket_system::socket_base_ptr socket_system::find(uint32_t socket_id) {
@@ -1,9 +1,18 @@
 ﻿#include <simple/coro/network.h>
 #include <simple/web/http.h>
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cctype>
 #include <charconv>
 #include <stdexcept>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMPLE_HTTP_SSE2
+#endif
 
 namespace simple::http {
 
@@ -22,6 +31,8 @@ constexpr auto bad_request = "HTTP/1.1 400 Bad Request\r\n"sv;
 constexpr auto unauthorized = "HTTP/1.1 401 Unauthorized\r\n"sv;
 constexpr auto forbidden = "HTTP/1.1 403 Forbidden\r\n"sv;
 constexpr auto not_found = "HTTP/1.1 404 Not Found\r\n"sv;
+constexpr auto method_not_allowed = "HTTP/1.1 405 Method Not Allowed\r\n"sv;
+constexpr auto payload_too_large = "HTTP/1.1 413 Payload Too Large\r\n"sv;
 constexpr auto internal_server_error = "HTTP/1.1 500 Internal Server Error\r\n"sv;
 constexpr auto not_implemented = "HTTP/1.1 501 Not Implemented\r\n"sv;
 constexpr auto bad_gateway = "HTTP/1.1 502 Bad Gateway\r\n"sv;
@@ -56,6 +67,10 @@ constexpr std::string_view to_string_view(reply::status_t status) {
             return detail::forbidden;
         case reply::status_t::not_found:
             return detail::not_found;
+        case reply::status_t::method_not_allowed:
+            return detail::method_not_allowed;
+        case reply::status_t::payload_too_large:
+            return detail::payload_too_large;
         case reply::status_t::internal_server_error:
             return detail::internal_server_error;
         case reply::status_t::not_implemented:
@@ -149,6 +164,16 @@ constexpr auto not_found =
     "<head><title>Not Found</title></head>"
     "<body><h1>404 Not Found</h1></body>"
     "</html>"sv;
+constexpr auto method_not_allowed =
+    "<html>"
+    "<head><title>Method Not Allowed</title></head>"
+    "<body><h1>405 Method Not Allowed</h1></body>"
+    "</html>"sv;
+constexpr auto payload_too_large =
+    "<html>"
+    "<head><title>Payload Too Large</title></head>"
+    "<body><h1>413 Payload Too Large</h1></body>"
+    "</html>"sv;
 constexpr auto internal_server_error =
     "<html>"
     "<head><title>Internal Server Error</title></head>"
@@ -198,6 +223,10 @@ std::string_view to_replies(reply::status_t status) {
             return forbidden;
         case reply::status_t::not_found:
             return not_found;
+        case reply::status_t::method_not_allowed:
+            return method_not_allowed;
+        case reply::status_t::payload_too_large:
+            return payload_too_large;
         case reply::status_t::internal_server_error:
             return internal_server_error;
         case reply::status_t::not_implemented:
@@ -258,402 +287,459 @@ static constexpr bool is_special(int c) {
     }
 }
 
-static simple::task<std::string_view> parser_line(uint32_t socket, memory_buffer& buf) {
-    buf.clear();
-    if (co_await simple::network::instance().read_until(socket, misc_strings::crlf, buf) == 0) {
-        throw std::logic_error("recv eof");
+// 方法和头部名字可以使用的字符
+static constexpr auto token_table = [] {
+    std::array<bool, 256> table{};
+    for (int c = 0; c < 256; ++c) {
+        table[c] = is_char(c) && !is_ctl(c) && !is_special(c);
     }
-
-    auto line = std::string_view(buf);
-    co_return line.substr(0, line.size() - misc_strings::crlf.size());
+    return table;
+}();
+
+static bool is_token(char ch) { return token_table[static_cast<uint8_t>(ch)]; }
+
+// 一个消息最多的头部数量
+static constexpr size_t max_headers = 128;
+
+// 查找第一个控制字符，头部的值中可以有 \t，uri 遇到空格和 \t 也停下，没有找到时返回 end
+static const char* find_ctl(const char* p, const char* end, bool value) {
+#if defined(SIMPLE_HTTP_SSE2)
+    // 一次检查 16 字节，大部分的 uri 和值都能在几次之内找到结尾
+    const auto limit = _mm_set1_epi8(0x1f);
+    const auto del = _mm_set1_epi8(0x7f);
+    const auto tab = _mm_set1_epi8('\t');
+    const auto space = _mm_set1_epi8(value ? 0x7f : ' ');
+    for (; end - p >= 16; p += 16) {
+        const auto val = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        auto ctl = _mm_cmpeq_epi8(_mm_min_epu8(val, limit), val);
+        if (value) {
+            ctl = _mm_andnot_si128(_mm_cmpeq_epi8(val, tab), ctl);
+        }
+        ctl = _mm_or_si128(ctl, _mm_or_si128(_mm_cmpeq_epi8(val, del), _mm_cmpeq_epi8(val, space)));
+        if (const auto mask = _mm_movemask_epi8(ctl); mask != 0) {
+            return p + std::countr_zero(static_cast<uint32_t>(mask));
+        }
+    }
+#endif
+    for (; p < end; ++p) {
+        const auto ch = static_cast<uint8_t>(*p);
+        if (ch == '\t' ? !value : (is_ctl(ch) || (!value && ch == ' '))) {
+            return p;
+        }
+    }
+    return end;
 }
 
-enum class line_state {
-    method_start,
-    method,
-    uri,
-    version_h,
-    version_t_1,
-    version_t_2,
-    version_p,
-    version_slash,
-    version_major_start,
-    version_major,
-    version_minor_start,
-    version_minor,
-    status_start,
-    status,
-    reason
-};
-
-static bool parser_request_line(request& req, std::string_view line) {
-    line_state state{line_state::method_start};
-    for (auto ch : line) {
-        switch (state) {
-            case line_state::method_start:
-                if (!is_char(ch) || is_ctl(ch) || is_special(ch)) {
-                    return false;
-                }
-
-                state = line_state::method;
-                req.method.push_back(ch);
-                break;
-
-            case line_state::method:
-                if (ch == ' ') {
-                    state = line_state::uri;
-                    break;
-                }
-
-                if (!is_char(ch) || is_ctl(ch) || is_special(ch)) {
-                    return false;
-                }
-
-                req.method.push_back(ch);
-                break;
-
-            case line_state::uri:
-                if (ch == ' ') {
-                    state = line_state::version_h;
-                    break;
-                }
-
-                if (is_ctl(ch)) {
-                    return false;
-                }
-
-                req.uri.push_back(ch);
-                break;
-
-            case line_state::version_h:
-                if (ch != 'H') {
-                    return false;
-                }
-
-                state = line_state::version_t_1;
-                break;
-
-            case line_state::version_t_1:
-                if (ch != 'T') {
-                    return false;
-                }
-
-                state = line_state::version_t_2;
-                break;
-
-            case line_state::version_t_2:
-                if (ch != 'T') {
-                    return false;
-                }
-
-                state = line_state::version_p;
-                break;
-
-            case line_state::version_p:
-                if (ch != 'P') {
-                    return false;
-                }
-
-                state = line_state::version_slash;
-                break;
-
-            case line_state::version_slash:
-                if (ch != '/') {
-                    return false;
-                }
-
-                state = line_state::version_major_start;
-                break;
-
-            case line_state::version_major_start:
-                if (!std::isdigit(ch)) {
-                    return false;
-                }
-
-                req.version_major = ch - '0';
-                state = line_state::version_major;
-                break;
-
-            case line_state::version_major:
-                if (ch == '.') {
-                    state = line_state::version_minor_start;
-                    break;
-                }
+// 解析 "HTTP/x.y"，返回解析完的位置，数据不够时返回 end，格式错误时返回空
+static const char* parse_version(const char* p, const char* end, int32_t& major, int32_t& minor) {
+    constexpr std::string_view prefix = "HTTP/";
+    constexpr auto size = prefix.size() + 3;
+    if (end - p < static_cast<ptrdiff_t>(size)) {
+        const auto len = (std::min)(static_cast<size_t>(end - p), prefix.size());
+        return std::string_view(p, len) == prefix.substr(0, len) ? end : nullptr;
+    }
+    if (std::string_view(p, prefix.size()) != prefix || !std::isdigit(static_cast<uint8_t>(p[5])) || p[6] != '.' ||
+        !std::isdigit(static_cast<uint8_t>(p[7]))) {
+        return nullptr;
+    }
+    major = p[5] - '0';
+    minor = p[7] - '0';
+    return p + size;
+}
 
-                if (!std::isdigit(ch)) {
-                    return false;
-                }
+// 解析所有的头部和结尾的空行，返回整个头的长度
+static ptrdiff_t parse_headers(const char* begin, const char* p, const char* end, std::vector<header_view>& headers) {
+    for (;;) {
+        if (p == end) return 0;
+        if (*p == '\r') {
+            if (end - p < 2) return 0;
+            return p[1] == '\n' ? p + 2 - begin : -1;
+        }
 
-                req.version_major = req.version_major * 10 + ch - '0';
-                break;
+        // 不支持旧的多行头部
+        const auto* name = p;
+        while (p < end && is_token(*p)) ++p;
+        if (p == end) return 0;
+        if (*p != ':' || p == name) return -1;
+        const std::string_view name_view(name, p - name);
+
+        ++p;
+        while (p < end && (*p == ' ' || *p == '\t')) ++p;
+        const auto* value = p;
+        p = find_ctl(p, end, true);
+        if (end - p < 2) return 0;
+        if (p[0] != '\r' || p[1] != '\n') return -1;
+
+        auto value_end = p;
+        while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) --value_end;
+        if (headers.size() >= max_headers) return -1;
+        headers.push_back({name_view, {value, static_cast<size_t>(value_end - value)}});
+        p += 2;
+    }
+}
 
-            case line_state::version_minor_start:
-                if (!std::isdigit(ch)) {
-                    return false;
-                }
+ptrdiff_t parse(std::string_view data, request_view& req) {
+    req.headers.clear();
+    const auto* begin = data.data();
+    const auto* end = begin + data.size();
+
+    // 请求行：方法 uri 版本
+    const auto* p = begin;
+    while (p < end && is_token(*p)) ++p;
+    if (p == end) return 0;
+    if (*p != ' ' || p == begin) return -1;
+    req.method = {begin, static_cast<size_t>(p - begin)};
+
+    const auto* uri = ++p;
+    p = find_ctl(p, end, false);
+    if (p == end) return 0;
+    if (*p != ' ' || p == uri) return -1;
+    req.uri = {uri, static_cast<size_t>(p - uri)};
+
+    p = parse_version(p + 1, end, req.version_major, req.version_minor);
+    if (!p) return -1;
+    if (end - p < 2) return 0;
+    if (p[0] != '\r' || p[1] != '\n') return -1;
+    return parse_headers(begin, p + 2, end, req.headers);
+}
 
-                req.version_minor = ch - '0';
-                state = line_state::version_minor;
-                break;
+ptrdiff_t parse(std::string_view data, reply_view& rep) {
+    rep.headers.clear();
+    const auto* begin = data.data();
+    const auto* end = begin + data.size();
+
+    // 回应行：版本 状态码 原因，原因可以为空
+    auto* p = parse_version(begin, end, rep.version_major, rep.version_minor);
+    if (!p) return -1;
+    if (end - p < 5) return 0;
+    if (p[0] != ' ' || !std::isdigit(static_cast<uint8_t>(p[1])) || !std::isdigit(static_cast<uint8_t>(p[2])) ||
+        !std::isdigit(static_cast<uint8_t>(p[3]))) {
+        return -1;
+    }
+    rep.status = (p[1] - '0') * 100 + (p[2] - '0') * 10 + (p[3] - '0');
+    p += 4;
+
+    if (*p == ' ') ++p;
+    const auto* reason = p;
+    p = find_ctl(p, end, true);
+    if (end - p < 2) return 0;
+    if (p[0] != '\r' || p[1] != '\n') return -1;
+    rep.reason = {reason, static_cast<size_t>(p - reason)};
+    return parse_headers(begin, p + 2, end, rep.headers);
+}
 
-            case line_state::version_minor:
-                if (!std::isdigit(ch)) {
-                    return false;
-                }
+static bool iequals(std::string_view left, std::string_view right) {
+    return left.size() == right.size() && std::equal(left.begin(), left.end(), right.begin(), [](char a, char b) {
+               return std::tolower(static_cast<uint8_t>(a)) == std::tolower(static_cast<uint8_t>(b));
+           });
+}
 
-                req.version_minor = req.version_minor * 10 + ch - '0';
-                break;
+// 逗号分隔的列表中是否有 token，不区分大小写
+static bool has_token(std::string_view list, std::string_view token) {
+    while (!list.empty()) {
+        const auto pos = list.find(',');
+        auto item = list.substr(0, pos);
+        while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1);
+        if (iequals(item, token)) return true;
+        list = pos == std::string_view::npos ? std::string_view{} : list.substr(pos + 1);
+    }
+    return false;
+}
 
-            default:
-                break;
+std::string_view find_header(const std::vector<header_view>& headers, std::string_view name) {
+    for (const auto& header : headers) {
+        if (iequals(header.name, name)) {
+            return header.value;
         }
     }
-
-    return state == line_state::version_minor;
+    return {};
 }
 
-static simple::task<> parser_request_line(request& req, uint32_t socket) {
-    memory_buffer buf;
-    auto line = co_await parser_line(socket, buf);
-    if (!parser_request_line(req, line)) {
-        throw std::logic_error("parser request line fail");
+bool keep_alive(int32_t version_major, int32_t version_minor, const std::vector<header_view>& headers) {
+    const auto connection = find_header(headers, "Connection");
+    if (version_major > 1 || (version_major == 1 && version_minor >= 1)) {
+        return !has_token(connection, "close");
     }
+    return has_token(connection, "keep-alive");
 }
 
-static bool parser_reply_line(reply& rep, std::string_view line) {
-    line_state state{line_state::version_h};
-    for (auto ch : line) {
-        switch (state) {
-            case line_state::version_h:
-                if (ch != 'H') {
-                    return false;
-                }
+static int hex_value(char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
 
-                state = line_state::version_t_1;
+ptrdiff_t chunked_decoder::decode(std::string_view data, memory_buffer& out) {
+    size_t i = 0;
+    while (i < data.size() && state_ != state::done) {
+        const auto ch = data[i];
+        switch (state_) {
+            case state::size:
+                if (const auto val = hex_value(ch); val >= 0) {
+                    // 长度最多 15 个十六进制数字，不会溢出
+                    if (++digits_ > 15) return -1;
+                    remain_ = remain_ * 16 + static_cast<size_t>(val);
+                } else if (digits_ == 0) {
+                    return -1;
+                } else if (ch == '\r') {
+                    state_ = state::size_lf;
+                } else if (ch == ';' || ch == ' ' || ch == '\t') {
+                    state_ = state::extension;
+                } else {
+                    return -1;
+                }
+                ++i;
                 break;
 
-            case line_state::version_t_1:
-                if (ch != 'T') {
-                    return false;
+            case state::extension:
+                if (ch == '\r') {
+                    state_ = state::size_lf;
                 }
-
-                state = line_state::version_t_2;
+                ++i;
                 break;
 
-            case line_state::version_t_2:
-                if (ch != 'T') {
-                    return false;
-                }
-
-                state = line_state::version_p;
+            case state::size_lf:
+                if (ch != '\n') return -1;
+                state_ = remain_ == 0 ? state::trailer : state::data;
+                ++i;
                 break;
 
-            case line_state::version_p:
-                if (ch != 'P') {
-                    return false;
+            case state::data: {
+                const auto len = (std::min)(remain_, data.size() - i);
+                out.append(data.data() + i, len);
+                remain_ -= len;
+                i += len;
+                if (remain_ == 0) {
+                    state_ = state::data_cr;
                 }
-
-                state = line_state::version_slash;
                 break;
+            }
 
-            case line_state::version_slash:
-                if (ch != '/') {
-                    return false;
-                }
-
-                state = line_state::version_major_start;
+            case state::data_cr:
+                if (ch != '\r') return -1;
+                state_ = state::data_lf;
+                ++i;
                 break;
 
-            case line_state::version_major_start:
-                if (!std::isdigit(ch)) {
-                    return false;
-                }
-
-                state = line_state::version_major;
+            case state::data_lf:
+                if (ch != '\n') return -1;
+                state_ = state::size;
+                digits_ = 0;
+                ++i;
                 break;
 
-            case line_state::version_major:
-                if (ch == '.') {
-                    state = line_state::version_minor_start;
-                    break;
-                }
-
-                if (!std::isdigit(ch)) {
-                    return false;
-                }
-
+            case state::trailer:
+                // 忽略 trailer 中的头部
+                state_ = ch == '\r' ? state::trailer_lf : state::trailer_line;
+                ++i;
                 break;
 
-            case line_state::version_minor_start:
-                if (!std::isdigit(ch)) {
-                    return false;
+            case state::trailer_line:
+                if (ch == '\n') {
+                    state_ = state::trailer;
                 }
-
-                state = line_state::version_minor;
+                ++i;
                 break;
 
-            case line_state::version_minor:
-                if (ch == ' ') {
-                    state = line_state::status_start;
-                    break;
-                }
-
-                if (!std::isdigit(ch)) {
-                    return false;
-                }
-
+            case state::trailer_lf:
+                if (ch != '\n') return -1;
+                state_ = state::done;
+                ++i;
                 break;
 
-            case line_state::status_start:
-                if (!std::isdigit(ch)) {
-                    return false;
-                }
-
-                rep.status = static_cast<reply::status_t>(ch - '0');
-                state = line_state::status;
+            default:
                 break;
+        }
+    }
+    return static_cast<ptrdiff_t>(i);
+}
 
-            case line_state::status:
-                if (ch == ' ') {
-                    state = line_state::reason;
-                    break;
-                }
-
-                if (!std::isdigit(ch)) {
-                    return false;
-                }
-
-                rep.status = static_cast<reply::status_t>(static_cast<int32_t>(rep.status) * 10 + ch - '0');
-                break;
+enum class body_type { none, length, chunked, close };
 
-            default:
-                break;
+static body_type get_body_type(const std::vector<header_view>& headers, size_t& length) {
+    // Transfer-Encoding 优先于 Content-Length
+    if (const auto encoding = find_header(headers, "Transfer-Encoding"); !encoding.empty()) {
+        if (!has_token(encoding, "chunked")) {
+            throw std::logic_error("http transfer encoding not supported");
         }
+        return body_type::chunked;
     }
 
-    return state == line_state::reason;
+    if (const auto value = find_header(headers, "Content-Length"); !value.empty()) {
+        const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), length, 10);
+        if (ec != std::errc() || ptr != value.data() + value.size()) {
+            throw std::logic_error("http content length is invalid");
+        }
+        return length > 0 ? body_type::length : body_type::none;
+    }
+    return body_type::none;
 }
 
-static simple::task<> parser_reply_line(reply& rep, uint32_t socket) {
-    memory_buffer buf;
-    auto line = co_await parser_line(socket, buf);
-    if (!parser_reply_line(rep, line)) {
-        throw std::logic_error("parser reply line fail");
+// 把指向接收缓冲区的 string_view 移到保存的数据中
+static void rebase(std::string_view& str, const char* from, const char* to) {
+    if (!str.empty()) {
+        str = {to + (str.data() - from), str.size()};
     }
 }
 
-enum class header_state { start, lws, name, space_before_value, value };
-
-static bool parser_header(std::vector<header>& headers, std::string_view line) {
-    header_state state{header_state::start};
-    header* current;
-    for (auto ch : line) {
-        switch (state) {
-            case header_state::start:
-                if (!headers.empty() && (ch == ' ' || ch == '\t')) {
-                    state = header_state::lws;
-                    break;
-                }
-
-                if (!is_char(ch) || is_ctl(ch) || is_special(ch)) {
-                    return false;
-                }
-
-                current = &headers.emplace_back();
-                current->name.push_back(ch);
-                state = header_state::name;
-                break;
-
-            case header_state::lws:
-                if (ch == ' ' || ch == '\t') {
-                    break;
-                }
-
-                if (is_ctl(ch)) {
-                    return false;
-                }
-
-                state = header_state::value;
-                current = &headers.back();
-                current->value.push_back(ch);
-                break;
-
-            case header_state::name:
-                if (ch == ':') {
-                    state = header_state::space_before_value;
-                    break;
-                }
-
-                if (!is_char(ch) || is_ctl(ch) || is_special(ch)) {
-                    return false;
-                }
-
-                current->name.push_back(ch);
-                break;
+static void rebase(request_view& req, const char* from, const char* to) {
+    rebase(req.method, from, to);
+    rebase(req.uri, from, to);
+    for (auto& header : req.headers) {
+        rebase(header.name, from, to);
+        rebase(header.value, from, to);
+    }
+}
 
-            case header_state::space_before_value:
-                if (ch != ' ') {
-                    return false;
-                }
+static void rebase(reply_view& rep, const char* from, const char* to) {
+    rebase(rep.reason, from, to);
+    for (auto& header : rep.headers) {
+        rebase(header.name, from, to);
+        rebase(header.value, from, to);
+    }
+}
 
-                state = header_state::value;
-                break;
+template <typename Message>
+static simple::task<bool> read_message(uint32_t socket, Message& msg, size_t max_size, bool no_body) {
+    msg.reset();
+    auto stream = simple::network::instance().reader(socket);
 
-            case header_state::value:
-                if (is_ctl(ch)) {
-                    return false;
-                }
-                current->value.push_back(ch);
-                break;
+    // 头部在接收缓冲区中原地解析，不完整时等待更多的数据后重新解析
+    ptrdiff_t head_size;
+    for (;;) {
+        const auto view = stream.peek();
+        head_size = parse(view, msg);
+        if (head_size > 0) break;
+        if (head_size < 0) {
+            throw std::logic_error("http parse fail");
+        }
+        if (view.size() >= max_size) {
+            throw std::length_error("http message too large");
+        }
+        if (co_await stream.wait(view.size() + 1) == 0) {
+            if (view.empty()) co_return false;
+            throw std::logic_error("recv eof");
+        }
+    }
 
-            default:
-                break;
+    size_t length = 0;
+    auto type = get_body_type(msg.headers, length);
+    if constexpr (std::is_same_v<Message, reply_view>) {
+        // 1xx、204、304 和 HEAD 请求的回应没有回应体，其他没有长度的回应读到连接断开
+        if (no_body || msg.status / 100 == 1 || msg.status == 204 || msg.status == 304) {
+            type = body_type::none;
+        } else if (type == body_type::none && msg.find("Content-Length").empty()) {
+            type = body_type::close;
         }
     }
 
-    return state == header_state::value;
-}
+    const auto head = static_cast<size_t>(head_size);
+    if (type == body_type::length && length > max_size - head) {
+        throw std::length_error("http message too large");
+    }
 
-static simple::task<> parser_header_body(std::vector<header>& headers, std::string& body, uint32_t socket) {
-    auto& network = simple::network::instance();
-    memory_buffer buf;
-    size_t body_size = 0;
-    for (;;) {
-        auto line = co_await parser_line(socket, buf);
-        if (line.empty()) {
-            // headers 接收完了
-            break;
+    // 请求的数据只复制一次到 buffer 中，接收缓冲区中剩下的数据属于下一个请求
+    msg.buffer = std::make_shared<memory_buffer>();
+    auto& buffer = *msg.buffer;
+    if (type == body_type::none || type == body_type::length) {
+        // 长度已知，预留好空间后追加请求体时 buffer 不会重新分配
+        buffer.reserve(head + length);
+        const auto* from = stream.peek().data();
+        buffer.append(from, head);
+        rebase(msg, from, reinterpret_cast<const char*>(buffer.begin_read()));
+        stream.consume(head);
+
+        if (type == body_type::length) {
+            if (co_await stream.wait(length) == 0) {
+                throw std::logic_error("recv eof");
+            }
+            buffer.append(stream.peek().data(), length);
+            stream.consume(length);
         }
+        msg.content = std::string_view(buffer).substr(head);
+        co_return true;
+    }
 
-        if (!parser_header(headers, line)) {
-            throw std::logic_error("parser header fail");
+    buffer.append(stream.peek().data(), head);
+    stream.consume(head);
+    if (type == body_type::chunked) {
+        chunked_decoder decoder;
+        for (;;) {
+            const auto view = stream.peek();
+            const auto used = decoder.decode(view, buffer);
+            if (used < 0) {
+                throw std::logic_error("http chunked body is invalid");
+            }
+            stream.consume(static_cast<size_t>(used));
+            if (buffer.readable() > max_size) {
+                throw std::length_error("http message too large");
+            }
+            if (decoder.done()) break;
+            if (co_await stream.wait(view.size() - static_cast<size_t>(used) + 1) == 0) {
+                throw std::logic_error("recv eof");
+            }
         }
-
-        if (const auto& header = headers.back(); header.name == "Content-Length") {
-            std::from_chars(header.value.data(), header.value.data() + header.value.size(), body_size, 10);
+    } else {
+        for (;;) {
+            const auto view = stream.peek();
+            buffer.append(view.data(), view.size());
+            stream.consume(view.size());
+            if (buffer.readable() > max_size) {
+                throw std::length_error("http message too large");
+            }
+            if (co_await stream.wait(1) == 0) break;
         }
     }
 
-    if (body_size > 0) {
-        body.resize(body_size);
-        if (co_await network.read_size(socket, body.data(), body_size) == 0) {
-            throw std::logic_error("recv eof");
-        }
+    // 追加数据时 buffer 可能重新分配，重新解析一次头部
+    const auto data = std::string_view(buffer);
+    parse(data.substr(0, head), msg);
+    msg.content = data.substr(head);
+    co_return true;
+}
+
+simple::task<bool> read(uint32_t socket, request_view& req, size_t max_size) {
+    return read_message(socket, req, max_size, false);
+}
+
+simple::task<bool> read(uint32_t socket, reply_view& rep, size_t max_size, bool no_body) {
+    return read_message(socket, rep, max_size, no_body);
+}
+
+static void copy_headers(std::vector<header>& headers, const std::vector<header_view>& views) {
+    headers.reserve(views.size());
+    for (const auto& view : views) {
+        auto& header = headers.emplace_back();
+        header.name = view.name;
+        header.value = view.value;
     }
 }
 
 simple::task<> parser(request& req, uint32_t socket) {
-    // 先读请求行
-    co_await parser_request_line(req, socket);
-    // 接着读 请求头 和 请求体
-    co_await parser_header_body(req.headers, req.content, socket);
+    request_view view;
+    if (!co_await read(socket, view)) {
+        throw std::logic_error("recv eof");
+    }
+
+    req.method = view.method;
+    req.uri = view.uri;
+    req.version_major = view.version_major;
+    req.version_minor = view.version_minor;
+    copy_headers(req.headers, view.headers);
+    req.content = view.content;
 }
 
 simple::task<> parser(reply& rep, uint32_t socket) {
-    // 先读回应行
-    co_await parser_reply_line(rep, socket);
-    // 接着读 回应头 和 回应体
-    co_await parser_header_body(rep.headers, rep.content, socket);
+    reply_view view;
+    if (!co_await read(socket, view)) {
+        throw std::logic_error("recv eof");
+    }
+
+    rep.status = static_cast<reply::status_t>(view.status);
+    copy_headers(rep.headers, view.headers);
+    rep.content = view.content;
 }
 
 }  // namespace simple::http
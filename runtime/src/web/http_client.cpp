@@ -0,0 +1,308 @@
+﻿#include <simple/coro/condition_variable.h>
+#include <simple/coro/network.h>
+#include <simple/coro/timed_awaiter.h>
+#include <simple/web/http_client.h>
+
+#include <algorithm>
+#include <cctype>
+#include <simple/coro/task_operators.hpp>
+#include <system_error>
+#include <unordered_map>
+
+namespace simple::http {
+
+struct client_connection {
+    uint32_t socket{0};
+    // 已经发出还没有读完回应的请求数
+    size_t pending{0};
+    // 连接上发过的请求数
+    size_t requests{0};
+    // 发送的顺序和当前可以读取回应的顺序，pipeline 的请求按顺序读取
+    uint64_t next_ticket{0};
+    uint64_t read_ticket{0};
+    // 对端不再保持连接时不再发送新的请求
+    bool reusable{true};
+    // 出错后连接已经断开，等待中的请求都会失败
+    bool failed{false};
+    std::chrono::steady_clock::time_point idle_since;
+    condition_variable turn;
+};
+
+using connection_ptr = std::shared_ptr<client_connection>;
+
+struct client_pool {
+    std::string host;
+    std::string service;
+    std::vector<connection_ptr> connections;
+    size_t connecting{0};
+    // 有连接可以发送请求，或者可以建立新的连接
+    condition_variable available;
+};
+
+struct client_state {
+    client_options options;
+    std::unordered_map<std::string, std::shared_ptr<client_pool>> pools;
+};
+
+static bool iequals(std::string_view left, std::string_view right) {
+    return left.size() == right.size() && std::equal(left.begin(), left.end(), right.begin(), [](char a, char b) {
+               return std::tolower(static_cast<uint8_t>(a)) == std::tolower(static_cast<uint8_t>(b));
+           });
+}
+
+static bool idempotent(std::string_view method) {
+    return method == "GET" || method == "HEAD" || method == "PUT" || method == "DELETE" || method == "OPTIONS";
+}
+
+static void append(memory_buffer& buf, std::string_view data) { buf.append(data.data(), data.size()); }
+
+static memory_buffer_ptr make_request(const client_options& options, const client_pool& pool, std::string_view method,
+                                      std::string_view target, const std::vector<header>& headers,
+                                      std::string_view body) {
+    auto buf = std::make_shared<memory_buffer>();
+    buf->reserve(256 + target.size() + body.size());
+    append(*buf, method);
+    append(*buf, " ");
+    append(*buf, target.empty() ? "/" : target);
+    append(*buf, " HTTP/1.1\r\nHost: ");
+    append(*buf, pool.host);
+    // 默认端口不需要写在 Host 中
+    if (pool.service != (options.ssl ? "443" : "80")) {
+        append(*buf, ":");
+        append(*buf, pool.service);
+    }
+    append(*buf, "\r\n");
+
+    for (const auto& h : headers) {
+        if (iequals(h.name, "Host") || iequals(h.name, "Content-Length") || iequals(h.name, "Connection") ||
+            iequals(h.name, "Transfer-Encoding")) {
+            continue;
+        }
+        append(*buf, h.name);
+        append(*buf, ": ");
+        append(*buf, h.value);
+        append(*buf, "\r\n");
+    }
+
+    if (!body.empty() || method == "POST" || method == "PUT" || method == "PATCH") {
+        append(*buf, "Content-Length: ");
+        append(*buf, std::to_string(body.size()));
+        append(*buf, "\r\n");
+    }
+    append(*buf, "\r\n");
+    append(*buf, body);
+    return buf;
+}
+
+// 对端断开后 socket 会从 network 中移除
+static bool alive(uint32_t socket) {
+    try {
+        network::instance().reader(socket);
+        return true;
+    } catch (std::system_error&) {
+        return false;
+    }
+}
+
+// 断开连接并从连接池中移除
+static void drop(client_pool& pool, const connection_ptr& conn) {
+    if (!conn->failed) {
+        conn->failed = true;
+        conn->reusable = false;
+        network::instance().close(conn->socket);
+        conn->turn.notify_all();
+    }
+    std::erase(pool.connections, conn);
+    pool.available.notify_all();
+}
+
+// 取得一个可以发送请求的连接，优先使用空闲的连接，其次建立新的连接，都不行时 pipeline 到请求最少的连接上
+static simple::task<connection_ptr> acquire(const client_options& options, client_pool& pool) {
+    auto& network = network::instance();
+    for (;;) {
+        // 移除已经被对端断开和空闲太久的连接，避免用到服务器正要断开的连接
+        const auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < pool.connections.size();) {
+            const auto conn = pool.connections[i];
+            if (conn->pending == 0 &&
+                (!conn->reusable || now - conn->idle_since >= options.idle_timeout || !alive(conn->socket))) {
+                drop(pool, conn);
+            } else {
+                ++i;
+            }
+        }
+
+        connection_ptr best;
+        for (const auto& conn : pool.connections) {
+            if (conn->reusable && conn->pending < options.max_pipeline && (!best || conn->pending < best->pending)) {
+                best = conn;
+            }
+        }
+        if (best && best->pending == 0) co_return best;
+
+        if (pool.connections.size() + pool.connecting < options.max_connections) {
+            ++pool.connecting;
+            uint32_t socket = 0;
+            try {
+                socket = options.ssl ? co_await network.ssl_connect(pool.host, pool.service, options.connect_timeout,
+                                                                    options.verify, options.ignore_cert)
+                                     : co_await network.tcp_connect(pool.host, pool.service, options.connect_timeout);
+            } catch (...) {
+                --pool.connecting;
+                pool.available.notify_all();
+                throw;
+            }
+            --pool.connecting;
+
+            auto conn = std::make_shared<client_connection>();
+            conn->socket = socket;
+            pool.connections.emplace_back(conn);
+            // 等待中的请求可以 pipeline 到新的连接上
+            pool.available.notify_all();
+            co_return conn;
+        }
+
+        if (best) co_return best;
+        co_await pool.available.wait();
+    }
+}
+
+// 在连接上发送请求并读取回应，连接在收到任何数据之前断开时返回 false，超时、取消或者出错时断开连接并抛出异常
+static simple::task<bool> exchange(const client_options& options, client_pool& pool, const connection_ptr& conn,
+                                   const memory_buffer_ptr& buf, bool head, reply_view& rep) {
+    const auto ticket = conn->next_ticket++;
+    ++conn->pending;
+    ++conn->requests;
+    // 重试时会再次发送同一个缓冲区，使用不修改缓冲区的发送
+    network::instance().write(conn->socket, std::vector<memory_buffer_ptr>{buf});
+
+    // 读取时不抛出异常，否则 || 会一直等到超时
+    std::exception_ptr error;
+    auto receive = [&]() -> simple::task<bool> {
+        try {
+            while (conn->read_ticket != ticket) {
+                if (conn->failed) co_return false;
+                co_await conn->turn.wait();
+            }
+            if (conn->failed) co_return false;
+            co_return co_await read(conn->socket, rep, options.max_reply_size, head);
+        } catch (...) {
+            error = std::current_exception();
+            co_return false;
+        }
+    };
+    auto timeout = [&options]() -> simple::task<> { co_await sleep_for(options.request_timeout); };
+
+    bool timed_out = false;
+    bool received = false;
+    try {
+        const auto result = co_await (receive() || timeout());
+        timed_out = result.index() != 0;
+        received = !timed_out && std::get<0>(result);
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    --conn->pending;
+    if (timed_out || error || !received) {
+        drop(pool, conn);
+    } else {
+        ++conn->read_ticket;
+        conn->turn.notify_all();
+        // 回应不保持连接或者读到连接断开为止时，连接不能再用
+        const bool until_close = rep.find("Content-Length").empty() && rep.find("Transfer-Encoding").empty() &&
+                                 !head && rep.status / 100 != 1 && rep.status != 204 && rep.status != 304;
+        if (!rep.keep_alive() || until_close) {
+            conn->reusable = false;
+        }
+        if (conn->pending == 0) {
+            conn->idle_since = std::chrono::steady_clock::now();
+            if (!conn->reusable) {
+                drop(pool, conn);
+            }
+        }
+        pool.available.notify_all();
+    }
+
+    if (timed_out) {
+        throw std::system_error(std::make_error_code(std::errc::timed_out), "http request");
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    co_return received;
+}
+
+client::client(const client_options& options) : state_(std::make_shared<client_state>()) {
+    state_->options = options;
+    if (state_->options.max_connections == 0) state_->options.max_connections = 1;
+    if (state_->options.max_pipeline == 0) state_->options.max_pipeline = 1;
+}
+
+client::~client() noexcept {
+    for (const auto& [_, pool] : state_->pools) {
+        for (const auto& conn : std::vector(pool->connections)) {
+            drop(*pool, conn);
+        }
+    }
+}
+
+simple::task<reply_view> client::request(const std::string& host, const std::string& service, std::string_view method,
+                                         std::string_view target, const std::vector<header>& headers,
+                                         std::string_view body) {
+    // 请求的过程中 client 可能被释放，协程持有共享的状态
+    const auto state = state_;
+    auto& pool = state->pools[host + ':' + service];
+    if (!pool) {
+        pool = std::make_shared<client_pool>();
+        pool->host = host;
+        pool->service = service;
+    }
+    const auto current = pool;
+
+    const auto buf = make_request(state->options, *current, method, target, headers, body);
+    const bool head = method == "HEAD";
+    for (bool retried = false;; retried = true) {
+        const auto conn = co_await acquire(state->options, *current);
+        const bool reused = conn->requests > 0;
+        reply_view rep;
+        if (co_await exchange(state->options, *current, conn, buf, head, rep)) {
+            co_return rep;
+        }
+
+        // 复用的连接被对端断开了，可能是服务器关闭了空闲的连接
+        if (retried || !reused || !idempotent(method)) {
+            throw std::system_error(std::make_error_code(std::errc::connection_reset), "http request");
+        }
+    }
+}
+
+simple::task<reply_view> client::get(const std::string& host, const std::string& service, std::string_view target) {
+    co_return co_await request(host, service, "GET", target);
+}
+
+simple::task<reply_view> client::post(const std::string& host, const std::string& service, std::string_view target,
+                                      std::string_view content_type, std::string_view body) {
+    const std::vector<header> headers{{"Content-Type", std::string(content_type)}};
+    co_return co_await request(host, service, "POST", target, headers, body);
+}
+
+void client::close_idle() {
+    for (const auto& [_, pool] : state_->pools) {
+        for (const auto& conn : std::vector(pool->connections)) {
+            if (conn->pending == 0) {
+                drop(*pool, conn);
+            }
+        }
+    }
+}
+
+size_t client::connections() const noexcept {
+    size_t count = 0;
+    for (const auto& [_, pool] : state_->pools) {
+        count += pool->connections.size();
+    }
+    return count;
+}
+
+}  // namespace simple::http
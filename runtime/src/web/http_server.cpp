@@ -0,0 +1,354 @@
+﻿#include <simple/coro/co_start.hpp>
+#include <simple/coro/network.h>
+#include <simple/coro/timed_awaiter.h>
+#include <simple/log/log.h>
+#include <simple/web/http_server.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <simple/coro/task_operators.hpp>
+#include <unordered_map>
+
+namespace simple::http {
+
+// 要断开连接时等待对端先断开的最长时间
+static constexpr auto linger_timeout = std::chrono::seconds(3);
+
+static bool iequals(std::string_view left, std::string_view right) {
+    return left.size() == right.size() && std::equal(left.begin(), left.end(), right.begin(), [](char a, char b) {
+               return std::tolower(static_cast<uint8_t>(a)) == std::tolower(static_cast<uint8_t>(b));
+           });
+}
+
+static memory_buffer_ptr make_buffer(std::string_view data) {
+    return std::make_shared<memory_buffer>(data.data(), data.size());
+}
+
+// chunked 的块长度行，十六进制的长度加上 \r\n
+static std::string_view format_chunk_size(std::array<char, 24>& out, size_t size) {
+    auto* p = std::to_chars(out.data(), out.data() + out.size() - 2, size, 16).ptr;
+    *p++ = '\r';
+    *p++ = '\n';
+    return {out.data(), static_cast<size_t>(p - out.data())};
+}
+
+response::response(uint32_t socket, const request_view& req)
+    : socket_(socket),
+      http10_(req.version_major == 1 && req.version_minor == 0),
+      head_(req.method == "HEAD"),
+      keep_alive_(req.keep_alive()) {}
+
+void response::prepare(std::vector<header>& headers) {
+    std::erase_if(headers, [this](const header& h) {
+        if (iequals(h.name, "Connection")) {
+            if (iequals(h.value, "close")) keep_alive_ = false;
+            return true;
+        }
+        return iequals(h.name, "Content-Length") || iequals(h.name, "Transfer-Encoding");
+    });
+
+    if (!keep_alive_) {
+        headers.push_back({"Connection", "close"});
+    } else if (http10_) {
+        headers.push_back({"Connection", "keep-alive"});
+    }
+}
+
+void response::send(reply rep) {
+    if (started()) {
+        throw std::logic_error("http response already started");
+    }
+
+    state_ = state::finished;
+    prepare(rep.headers);
+    rep.headers.push_back({"Content-Length", std::to_string(rep.content.size())});
+    if (head_) {
+        rep.content.clear();
+    }
+    network::instance().write(socket_, rep.to_buffer());
+}
+
+void response::send(reply::status_t status, std::string_view content_type, std::string_view content) {
+    reply rep;
+    rep.status = status;
+    rep.headers.push_back({"Content-Type", std::string(content_type)});
+    rep.content = content;
+    send(std::move(rep));
+}
+
+void response::begin(reply::status_t status, std::vector<header> headers) {
+    if (started()) {
+        throw std::logic_error("http response already started");
+    }
+
+    state_ = state::streaming;
+    // HTTP/1.0 不支持 chunked，用断开连接表示结束
+    chunked_ = !http10_;
+    if (!chunked_) {
+        keep_alive_ = false;
+    }
+
+    reply rep;
+    rep.status = status;
+    rep.headers = std::move(headers);
+    prepare(rep.headers);
+    if (chunked_) {
+        rep.headers.push_back({"Transfer-Encoding", "chunked"});
+    }
+    network::instance().write(socket_, rep.to_buffer());
+}
+
+void response::write(std::string_view data) {
+    if (state_ != state::streaming) {
+        throw std::logic_error("http response is not streaming");
+    }
+    if (data.empty() || head_) return;
+
+    if (!chunked_) {
+        return network::instance().write(socket_, make_buffer(data));
+    }
+
+    // 块的长度、数据和结尾合并到一个缓冲区
+    std::array<char, 24> temp;
+    const auto size = format_chunk_size(temp, data.size());
+    auto buf = std::make_shared<memory_buffer>();
+    buf->reserve(size.size() + data.size() + 2);
+    buf->append(size.data(), size.size());
+    buf->append(data.data(), data.size());
+    buf->append("\r\n", 2);
+    network::instance().write(socket_, buf);
+}
+
+void response::write(const memory_buffer_ptr& data) {
+    if (state_ != state::streaming) {
+        throw std::logic_error("http response is not streaming");
+    }
+    if (!data || data->readable() == 0 || head_) return;
+
+    if (!chunked_) {
+        return network::instance().write(socket_, std::vector<memory_buffer_ptr>{data});
+    }
+
+    // 数据本身不复制，和块的长度、结尾一起发送
+    static const auto crlf = make_buffer("\r\n");
+    std::array<char, 24> temp;
+    network::instance().write(socket_, {make_buffer(format_chunk_size(temp, data->readable())), data, crlf});
+}
+
+void response::end() {
+    if (state_ != state::streaming) {
+        throw std::logic_error("http response is not streaming");
+    }
+
+    state_ = state::finished;
+    if (chunked_ && !head_) {
+        network::instance().write(socket_, make_buffer("0\r\n\r\n"));
+    }
+}
+
+simple::task<bool> response::drain() const { return network::instance().wait_writable(socket_); }
+
+struct route_entry {
+    std::string method;
+    handler h;
+};
+
+using route_list = std::vector<route_entry>;
+
+struct path_hash {
+    using is_transparent [[maybe_unused]] = int;
+
+    [[nodiscard]] size_t operator()(std::string_view path) const noexcept { return std::hash<std::string_view>()(path); }
+    [[nodiscard]] size_t operator()(const std::string& path) const noexcept {
+        return std::hash<std::string_view>()(path);
+    }
+};
+
+struct server_state {
+    server_options options;
+    std::unordered_map<std::string, route_list, path_hash, std::equal_to<>> exact;
+    // 前缀匹配的路由，按前缀从长到短排列
+    std::vector<std::pair<std::string, route_list>> prefixes;
+
+    // 找不到路由时返回空，allowed 表示路径存在但是方法不匹配
+    [[nodiscard]] const handler* find(std::string_view method, std::string_view path, bool& allowed) const;
+};
+
+static const handler* find_method(const route_list& routes, std::string_view method) {
+    const handler* get = nullptr;
+    for (const auto& entry : routes) {
+        if (entry.method.empty() || entry.method == method) {
+            return &entry.h;
+        }
+        if (entry.method == "GET") {
+            get = &entry.h;
+        }
+    }
+    return method == "HEAD" ? get : nullptr;
+}
+
+const handler* server_state::find(std::string_view method, std::string_view path, bool& allowed) const {
+    allowed = false;
+    if (const auto it = exact.find(path); it != exact.end()) {
+        allowed = true;
+        if (const auto* h = find_method(it->second, method)) return h;
+    }
+
+    for (const auto& [prefix, routes] : prefixes) {
+        if (path.starts_with(prefix)) {
+            allowed = true;
+            if (const auto* h = find_method(routes, method)) return h;
+        }
+    }
+    return nullptr;
+}
+
+server::server(const server_options& options) : state_(std::make_shared<server_state>()) { state_->options = options; }
+
+server::~server() noexcept = default;
+
+void server::route(std::string method, std::string path, handler h) {
+    if (path.ends_with('*')) {
+        path.pop_back();
+        auto& prefixes = state_->prefixes;
+        auto it = std::find_if(prefixes.begin(), prefixes.end(), [&path](const auto& item) { return item.first == path; });
+        if (it == prefixes.end()) {
+            // 按长度从长到短排列，匹配时先命中最长的前缀
+            it = std::find_if(prefixes.begin(), prefixes.end(),
+                              [&path](const auto& item) { return item.first.size() < path.size(); });
+            it = prefixes.emplace(it, std::move(path), route_list{});
+        }
+        it->second.push_back({std::move(method), std::move(h)});
+        return;
+    }
+
+    state_->exact[std::move(path)].push_back({std::move(method), std::move(h)});
+}
+
+enum class read_status : uint8_t { ok, closed, bad_request, too_large };
+
+// 读取请求时不抛出异常，否则 || 会一直等到超时
+static simple::task<read_status> read_request(uint32_t socket, request_view& req, size_t max_size) {
+    try {
+        co_return co_await read(socket, req, max_size) ? read_status::ok : read_status::closed;
+    } catch (std::length_error&) {
+        co_return read_status::too_large;
+    } catch (std::logic_error&) {
+        co_return read_status::bad_request;
+    } catch (...) {
+        co_return read_status::closed;
+    }
+}
+
+// 回应发完之后等对端先断开，超时后再主动断开，避免直接断开丢掉还没有发出去的数据
+static simple::task<> linger(uint32_t socket) {
+    auto wait_peer = [socket]() -> simple::task<> {
+        try {
+            char temp;
+            while (co_await network::instance().read(socket, &temp, 1) > 0) {
+            }
+        } catch (...) {
+        }
+    };
+    auto timeout = []() -> simple::task<> { co_await sleep_for(linger_timeout); };
+    co_await (wait_peer() || timeout());
+    network::instance().close(socket);
+}
+
+static simple::task<> dispatch(const server_state& state, const request_view& req, response& res) {
+    bool allowed = false;
+    const auto* h = state.find(req.method, uri_path(req.uri), allowed);
+    if (!h) {
+        res.send(reply::stock(allowed ? reply::status_t::method_not_allowed : reply::status_t::not_found));
+        co_return;
+    }
+
+    try {
+        co_await (*h)(req, res);
+    } catch (std::exception& e) {
+        warn("http socket:{} {} {} {}", res.socket(), req.method, req.uri, e.what());
+        if (res.started()) {
+            // 流式回应发了一部分，断开连接让对端知道回应不完整
+            res.close();
+            co_return;
+        }
+    } catch (...) {
+        warn("http socket:{} {} {} unknown exception", res.socket(), req.method, req.uri);
+        if (res.started()) {
+            res.close();
+            co_return;
+        }
+    }
+
+    if (!res.started()) {
+        res.send(reply::stock(reply::status_t::internal_server_error));
+    } else if (!res.finished()) {
+        res.end();
+    }
+}
+
+static simple::task<> serve_connection(std::shared_ptr<const server_state> state, uint32_t socket) {
+    auto& network = network::instance();
+    const auto& options = state->options;
+    auto idle = [&options]() -> simple::task<> { co_await sleep_for(options.idle_timeout); };
+
+    request_view req;
+    for (;;) {
+        const auto result = co_await (read_request(socket, req, options.max_request_size) || idle());
+        if (result.index() != 0 || std::get<0>(result) == read_status::closed) {
+            // 超时的时候读取已经被取消
+            network.close(socket);
+            co_return;
+        }
+
+        if (const auto status = std::get<0>(result); status != read_status::ok) {
+            // 请求无法继续解析，回应之后断开
+            req.reset();
+            response res(socket, req);
+            res.send(reply::stock(status == read_status::too_large ? reply::status_t::payload_too_large
+                                                                   : reply::status_t::bad_request));
+            co_await linger(socket);
+            co_return;
+        }
+
+        response res(socket, req);
+        if (!options.keep_alive) {
+            res.close();
+        }
+        co_await dispatch(*state, req, res);
+        if (!res.keep_alive()) {
+            co_await linger(socket);
+            co_return;
+        }
+    }
+}
+
+simple::task<> server::serve(const std::string& host, uint16_t port) {
+    auto& network = network::instance();
+    const auto listen_id = co_await network.tcp_listen(host, port, true);
+    if (state_->options.watermark.high > 0) {
+        network.watermark(listen_id, state_->options.watermark);
+    }
+    co_await serve(listen_id);
+}
+
+simple::task<> server::serve(uint32_t listen_id) {
+    auto& network = network::instance();
+    for (;;) {
+        uint32_t socket;
+        try {
+            socket = co_await network.accept(listen_id);
+        } catch (std::system_error&) {
+            // 监听的 socket 已经关闭
+            co_return;
+        }
+
+        co_start([state = state_, socket]() { return serve_connection(state, socket); });
+    }
+}
+
+simple::task<> server::serve_socket(uint32_t socket) const { return serve_connection(state_, socket); }
+
+}  // namespace simple::http
@@ -0,0 +1,97 @@
+﻿#include <fmt/format.h>
+#include <simple/coro/network.h>
+#include <simple/web/http_server.h>
+#include <simple/web/metrics.h>
+
+#include <iterator>
+#include <string_view>
+
+namespace simple::metrics {
+
+using counter_getter = int64_t (*)(const socket_stat&);
+
+static void format_counter(std::string& out, const std::vector<socket_stat>& stats, std::string_view name,
+                           std::string_view type, std::string_view help, counter_getter getter) {
+    auto it = std::back_inserter(out);
+    fmt::format_to(it, "# HELP simple_socket_{} {}\n# TYPE simple_socket_{} {}\n", name, help, name, type);
+    for (const auto& stat : stats) {
+        fmt::format_to(it, "simple_socket_{}{{id=\"{}\",type=\"{}\",listener=\"{}\"}} {}\n", name, stat.id,
+                       get_socket_type_strv(stat.type), stat.listener, getter(stat));
+    }
+}
+
+static void format_histogram(std::string& out, const std::vector<socket_stat>& stats, std::string_view name,
+                             std::string_view help, const socket_histogram socket_trace::*histogram,
+                             const int64_t socket_trace::*sum) {
+    auto it = std::back_inserter(out);
+    fmt::format_to(it, "# HELP simple_socket_{} {}\n# TYPE simple_socket_{} histogram\n", name, help, name);
+    for (const auto& stat : stats) {
+        const auto& buckets = stat.*histogram;
+        int64_t count = 0;
+        for (size_t i = 0; i < socket_histogram_size; ++i) {
+            count += buckets[i];
+            if (i + 1 < socket_histogram_size) {
+                fmt::format_to(it, "simple_socket_{}_bucket{{id=\"{}\",type=\"{}\",listener=\"{}\",le=\"{}\"}} {}\n",
+                               name, stat.id, get_socket_type_strv(stat.type), stat.listener,
+                               get_socket_histogram_bound(i), count);
+            } else {
+                fmt::format_to(it, "simple_socket_{}_bucket{{id=\"{}\",type=\"{}\",listener=\"{}\",le=\"+Inf\"}} {}\n",
+                               name, stat.id, get_socket_type_strv(stat.type), stat.listener, count);
+            }
+        }
+        fmt::format_to(it, "simple_socket_{}_sum{{id=\"{}\",type=\"{}\",listener=\"{}\"}} {}\n", name, stat.id,
+                       get_socket_type_strv(stat.type), stat.listener, stat.*sum);
+        fmt::format_to(it, "simple_socket_{}_count{{id=\"{}\",type=\"{}\",listener=\"{}\"}} {}\n", name, stat.id,
+                       get_socket_type_strv(stat.type), stat.listener, count);
+    }
+}
+
+std::string format_socket_stats(const std::vector<socket_stat>& stats, int64_t write_queue_bytes) {
+    std::string out;
+    out.reserve(stats.size() * 2048 + 256);
+    fmt::format_to(std::back_inserter(out),
+                   "# HELP simple_write_queue_bytes Bytes waiting to be sent on all sockets.\n"
+                   "# TYPE simple_write_queue_bytes gauge\n"
+                   "simple_write_queue_bytes {}\n",
+                   write_queue_bytes);
+
+    format_counter(out, stats, "read_bytes_total", "counter", "Bytes received.",
+                   [](const socket_stat& stat) { return stat.read; });
+    format_counter(out, stats, "write_bytes_total", "counter", "Bytes sent.",
+                   [](const socket_stat& stat) { return stat.write; });
+    format_counter(out, stats, "read_packets_total", "counter", "Number of receives.",
+                   [](const socket_stat& stat) { return stat.read_count; });
+    format_counter(out, stats, "write_packets_total", "counter", "Number of sends.",
+                   [](const socket_stat& stat) { return stat.write_count; });
+    format_counter(out, stats, "accept_total", "counter", "Connections accepted by a listener.",
+                   [](const socket_stat& stat) { return stat.accept; });
+    format_counter(out, stats, "accept_rejected_total", "counter", "Connections rejected by accept limits.",
+                   [](const socket_stat& stat) { return stat.reject; });
+    format_counter(out, stats, "ssl_handshakes_total", "counter", "Full TLS handshakes.",
+                   [](const socket_stat& stat) { return stat.handshake; });
+    format_counter(out, stats, "ssl_resumed_handshakes_total", "counter", "TLS handshakes that resumed a session.",
+                   [](const socket_stat& stat) { return stat.handshake_resumed; });
+    format_counter(out, stats, "read_moved_bytes_total", "counter", "Bytes moved while compacting or growing receive buffers.",
+                   [](const socket_stat& stat) { return stat.read_moved; });
+    format_counter(out, stats, "write_queue_bytes", "gauge", "Bytes waiting to be sent.",
+                   [](const socket_stat& stat) { return stat.write_queue; });
+    format_histogram(out, stats, "read_latency_microseconds", "Delay before received data reaches the logic thread.",
+                     &socket_trace::read_latency, &socket_trace::read_latency_sum);
+    format_histogram(out, stats, "write_latency_microseconds", "Time taken by each send.", &socket_trace::write_latency,
+                     &socket_trace::write_latency_sum);
+    return out;
+}
+
+simple::task<> serve(const std::string& host, uint16_t port) {
+    // 采集端保持连接时由 http::server 的空闲超时断开
+    http::server server;
+    server.route("GET", "/metrics", [](const http::request_view&, http::response& res) -> simple::task<> {
+        auto& network = network::instance();
+        res.send(http::reply::status_t::ok, "text/plain; version=0.0.4",
+                 format_socket_stats(network.socket_stats(), network.write_queue_bytes()));
+        co_return;
+    });
+    co_await server.serve(host, port);
+}
+
+}  // namespace simple::metrics
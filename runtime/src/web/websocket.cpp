@@ -1,6 +1,8 @@
 ﻿#include <fmt/format.h>
 #include <simple/web/websocket.h>
 
+#include <cstring>
+#include <limits>
 #include <random>
 #include <stdexcept>
 
@@ -10,14 +12,33 @@
 #include <arpa/inet.h>
 #endif
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMPLE_WEBSOCKET_AVX2
+#define SIMPLE_WEBSOCKET_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMPLE_WEBSOCKET_SSE2
+#endif
+
 #include "simple/coro/network.h"
 #include "simple/utils/crypt.h"
 #include "simple/web/http.h"
+#include "websocket_deflate.h"
 
 namespace simple {
 
 websocket::websocket(websocket_type tp, uint32_t socket) : tp_(tp), socket_(socket) {}
 
+websocket::websocket(websocket_type tp, uint32_t socket, const websocket_deflate_options& deflate)
+    : tp_(tp), socket_(socket) {
+    if (deflate.enable) {
+        deflate_ = std::make_shared<websocket_deflate>(tp, deflate);
+    }
+}
+
+bool websocket::compressed() const noexcept { return deflate_ && deflate_->active(); }
+
 template <size_t Size>
 void rand_key(char (&key)[Size]) {
     thread_local std::default_random_engine en(std::random_device{}());
@@ -29,6 +50,7 @@ void rand_key(char (&key)[Size]) {
 
 constexpr std::string_view websocket_key_name = "Sec-WebSocket-Key";
 constexpr std::string_view websocket_accept_name = "Sec-WebSocket-Accept";
+constexpr std::string_view websocket_extensions_name = "Sec-WebSocket-Extensions";
 constexpr std::string_view connection_name = "Connection";
 constexpr std::string_view upgrade_name = "Upgrade";
 constexpr std::string_view upgrade_value_right = "websocket";
@@ -52,21 +74,31 @@ simple::task<> websocket::handshake(std::string_view host, std::string_view uri)
                        "Connection: Upgrade\r\n"
                        "Upgrade: websocket\r\n"
                        "Sec-WebSocket-Version: 13\r\n"
-                       "Sec-WebSocket-Key: {}\r\n\r\n",
+                       "Sec-WebSocket-Key: {}\r\n",
                        uri, host, key_base64);
+        if (deflate_) {
+            fmt::format_to(std::back_inserter(*req), "{}: {}\r\n", websocket_extensions_name, deflate_->offer());
+        }
+        req->append("\r\n", 2);
 
         simple::network::instance().write(socket_, req);
     }
 
-    http::reply rep;
-    co_await parser(rep, socket_);
+    // 头部直接指向 rep.buffer，不复制
+    http::reply_view rep;
+    if (!co_await http::read(socket_, rep)) {
+        throw std::logic_error("recv eof");
+    }
 
     std::string_view websocket_accept_value;
     std::string_view connection_value;
     std::string_view upgrade_value;
+    std::string_view extensions_value;
     for (auto& header : rep.headers) {
         if (websocket_accept_value.empty() && header.name == websocket_accept_name) {
             websocket_accept_value = header.value;
+        } else if (extensions_value.empty() && header.name == websocket_extensions_name) {
+            extensions_value = header.value;
         } else if (connection_value.empty() && header.name == connection_name) {
             connection_value = header.value;
         } else if (upgrade_value.empty() && header.name == upgrade_name) {
@@ -98,6 +130,11 @@ simple::task<> websocket::handshake(std::string_view host, std::string_view uri)
     if (right_accept != websocket_accept_value) {
         throw std::logic_error("handshake websocket_accept_value is invalid");
     }
+
+    // 服务器不同意时没有这个头，同意时只能是请求过的扩展
+    if (!extensions_value.empty() && (!deflate_ || !deflate_->confirm(extensions_value))) {
+        throw std::logic_error("handshake websocket_extensions_value is invalid");
+    }
 }
 
 simple::task<> websocket::handshake() const {
@@ -105,15 +142,20 @@ simple::task<> websocket::handshake() const {
         throw std::logic_error("tp_ must be websocket_type::server");
     }
 
-    http::request req;
-    co_await parser(req, socket_);
+    http::request_view req;
+    if (!co_await http::read(socket_, req)) {
+        throw std::logic_error("recv eof");
+    }
 
     std::string_view websocket_key_value;
     std::string_view connection_value;
     std::string_view upgrade_value;
+    std::string_view extensions_value;
     for (auto& header : req.headers) {
         if (websocket_key_value.empty() && header.name == websocket_key_name) {
             websocket_key_value = header.value;
+        } else if (extensions_value.empty() && header.name == websocket_extensions_name) {
+            extensions_value = header.value;
         } else if (connection_value.empty() && header.name == connection_name) {
             connection_value = header.value;
         } else if (upgrade_value.empty() && header.name == upgrade_name) {
@@ -156,6 +198,13 @@ simple::task<> websocket::handshake() const {
     reply.headers[1].value = upgrade_value_right;
     reply.headers[2].name = websocket_accept_name;
     base64_encode(reply.headers[2].value, {reinterpret_cast<char*>(digest.data()), digest.size()});
+    if (deflate_ && !extensions_value.empty()) {
+        if (auto value = deflate_->accept(extensions_value); !value.empty()) {
+            auto& header = reply.headers.emplace_back();
+            header.name = websocket_extensions_name;
+            header.value = std::move(value);
+        }
+    }
     network.write(socket_, reply.to_buffer());
 }
 
@@ -197,79 +246,151 @@ static uint64_t ws_ntohll(uint64_t val) {
     return h.v;
 }
 
-static void umask(uint8_t* data, std::size_t len, const char (&mask)[4]) {
-    for (std::size_t i = 0; i < len; ++i) {
-        *(data + i) ^= *(mask + (i % 4));
+void websocket_mask_copy(void* dst, const void* src, size_t size, const char (&mask)[4]) {
+    auto* out = static_cast<uint8_t*>(dst);
+    const auto* in = static_cast<const uint8_t*>(src);
+    // 掩码按内存顺序展开成 32 位，每段处理的长度都是 4 的倍数，不需要调整掩码的位置
+    uint32_t key;
+    memcpy(&key, mask, sizeof(key));
+    size_t i = 0;
+#if defined(SIMPLE_WEBSOCKET_AVX2)
+    const auto key_256 = _mm256_set1_epi32(static_cast<int>(key));
+    for (; i + 32 <= size; i += 32) {
+        const auto val = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_xor_si256(val, key_256));
+    }
+#endif
+#if defined(SIMPLE_WEBSOCKET_SSE2)
+    const auto key_128 = _mm_set1_epi32(static_cast<int>(key));
+    for (; i + 16 <= size; i += 16) {
+        const auto val = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_xor_si128(val, key_128));
+    }
+#endif
+    const auto key_64 = static_cast<uint64_t>(key) << 32 | key;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t val;
+        memcpy(&val, in + i, sizeof(val));
+        val ^= key_64;
+        memcpy(out + i, &val, sizeof(val));
+    }
+    for (; i < size; ++i) {
+        out[i] = in[i] ^ static_cast<uint8_t>(mask[i % 4]);
+    }
+}
+
+struct websocket_frame_header {
+    bool fin{false};
+    // RSV1、RSV2、RSV3，RSV1 表示压缩的消息
+    uint8_t rsv{0};
+    websocket_opcode op{websocket_opcode::none};
+    bool mask{false};
+    char masking_key[4]{};
+    uint64_t payload_len{0};
+};
+
+// 从连续的数据中解析帧头，返回完整帧头的长度，比 len 大时需要等待更多的数据
+static size_t parse_frame_header(const uint8_t* data, size_t len, websocket_frame_header& header) {
+    if (len < 2) {
+        return 2;
     }
+
+    const auto payload = data[1] & 0x7F;
+    const size_t len_size = payload < 0x7E ? 0 : (payload == 0x7E ? sizeof(uint16_t) : sizeof(uint64_t));
+    header.fin = (data[0] & 0x80) != 0;
+    header.rsv = data[0] & 0x70;
+    header.op = static_cast<websocket_opcode>(data[0] & 0x0F);
+    header.mask = (data[1] & 0x80) != 0;
+    const auto size = 2 + len_size + (header.mask ? sizeof(header.masking_key) : 0);
+    if (len < size) {
+        return size;
+    }
+
+    header.payload_len = payload;
+    if (len_size == sizeof(uint16_t)) {
+        uint16_t len_16;
+        memcpy(&len_16, data + 2, sizeof(len_16));
+        header.payload_len = ntohs(len_16);
+    } else if (len_size == sizeof(uint64_t)) {
+        uint64_t len_64;
+        memcpy(&len_64, data + 2, sizeof(len_64));
+        header.payload_len = ws_ntohll(len_64);
+    }
+
+    if (header.mask) {
+        memcpy(header.masking_key, data + 2 + len_size, sizeof(header.masking_key));
+    }
+    return size;
 }
 
 simple::task<websocket_opcode> websocket::read(memory_buffer& buf) const {
     buf.clear();
-    auto& network = simple::network::instance();
+    // 整个消息只查找一次 socket，帧头在接收缓冲区中原地解析
+    auto stream = simple::network::instance().reader(socket_);
     websocket_opcode last = websocket_opcode::none;
+    bool deflated = false;
     for (;;) {
-        uint8_t val;
-        if (co_await network.read_size(socket_, &val, 1) == 0) {
-            throw std::logic_error("recv eof");
+        websocket_frame_header header;
+        size_t header_size = 2;
+        for (;;) {
+            const auto view = stream.peek();
+            const auto* data = reinterpret_cast<const uint8_t*>(view.data());
+            if (view.size() >= header_size && (header_size = parse_frame_header(data, view.size(), header)) <= view.size()) {
+                break;
+            }
+
+            if (co_await stream.wait(header_size) == 0) {
+                throw std::logic_error("recv eof");
+            }
         }
 
-        const auto fin = ((val & 0x80) != 0);
-        auto op = static_cast<websocket_opcode>(val & 0x0F);
+        const auto op = header.op;
         if (is_websocket_control(op)) {
-            if (!fin) {
+            if (!header.fin) {
                 throw std::logic_error("websocket read fail");
             }
         } else if ((op == websocket_opcode::continuation) == (last == websocket_opcode::none)) {
             throw std::logic_error("websocket read fail");
         }
 
-        if (co_await network.read_size(socket_, &val, 1) == 0) {
-            throw std::logic_error("recv eof");
+        if (header.mask != (tp_ == websocket_type::server)) {
+            throw std::logic_error("websocket read fail");
         }
 
-        const auto mask = ((val & 0x80) != 0);
-        if (mask != (tp_ == websocket_type::server)) {
+        // 只有协商了压缩时，数据消息的第一帧可以设置 RSV1
+        if (header.rsv == 0x40) {
+            if (!compressed() || is_websocket_control(op) || op == websocket_opcode::continuation) {
+                throw std::logic_error("websocket read fail");
+            }
+            deflated = true;
+        } else if (header.rsv != 0) {
             throw std::logic_error("websocket read fail");
         }
+        stream.consume(header_size);
 
-        uint64_t payload_len;
-        if (const auto len = (val & 0x7F); len < 0x7E) {
-            payload_len = len;
-        } else if (len == 0x7E) {
-            uint16_t len_16;
-            if (co_await network.read_size(socket_, &len_16, sizeof(len_16)) == 0) {
+        // 分片的消息每一片都直接接在 buf 后面，解掩码和复制一次完成，压缩的消息先放在解压的输入中
+        const bool inflate = deflated && !is_websocket_control(op);
+        if (const auto payload_len = header.payload_len; payload_len > 0) {
+            if (co_await stream.wait(payload_len) == 0) {
                 throw std::logic_error("recv eof");
             }
 
-            payload_len = ntohs(len_16);
-        } else {
-            uint64_t len_64;
-            if (co_await network.read_size(socket_, &len_64, sizeof(len_64)) == 0) {
-                throw std::logic_error("recv eof");
+            auto& target = inflate ? deflate_->input() : buf;
+            target.make_sure_writable(payload_len);
+            if (header.mask) {
+                websocket_mask_copy(target.begin_write(), stream.peek().data(), payload_len, header.masking_key);
+            } else {
+                memcpy(target.begin_write(), stream.peek().data(), payload_len);
             }
-
-            payload_len = ws_ntohll(len_64);
-        }
-
-        char masking_key[4];
-        if (mask && co_await network.read_size(socket_, masking_key, sizeof(masking_key)) == 0) {
-            throw std::logic_error("recv eof");
+            stream.consume(payload_len);
+            target.written(payload_len);
         }
 
-        if (payload_len > 0) {
-            buf.make_sure_writable(payload_len);
-            auto* write_pos = buf.begin_write();
-            if (co_await network.read_size(socket_, write_pos, payload_len) == 0) {
-                throw std::logic_error("recv eof");
+        if (header.fin) {
+            if (inflate && !deflate_->decompress(buf)) {
+                throw std::logic_error("websocket inflate fail");
             }
 
-            if (mask) {
-                umask(write_pos, payload_len, masking_key);
-            }
-            buf.written(payload_len);
-        }
-
-        if (fin) {
             if (op == websocket_opcode::continuation) {
                 co_return last;
             }
@@ -284,45 +405,74 @@ simple::task<websocket_opcode> websocket::read(memory_buffer& buf) const {
 }
 
 void websocket::write(websocket_opcode op, const void* data, size_t size) const {
-    auto buf = std::make_shared<memory_buffer>();
-    encode_header(*buf, op, size, true);
-    encode_body(*buf, data, size);
-    simple::network::instance().write(socket_, buf);
+    write(op, data, size, std::numeric_limits<size_t>::max());
 }
 
 void websocket::write(websocket_opcode op, const void* data, size_t size, size_t payload_max) const {
+    // 压缩整个消息后再拆分，只有第一帧设置 RSV1
+    bool deflated = false;
+    if (!is_websocket_control(op) && deflate_ && deflate_->should_compress(size)) {
+        const auto output = deflate_->compress(data, size);
+        data = output.begin_read();
+        size = output.readable();
+        deflated = true;
+    }
+
+    auto buf = std::make_shared<memory_buffer>();
     if (size <= payload_max || is_websocket_control(op)) {
-        return write(op, data, size);
+        encode_header(*buf, tp_, op, size, true, deflated);
+        encode_body(*buf, data, size);
+        simple::network::instance().write(socket_, buf);
+        return;
     }
 
     const char* temp = static_cast<const char*>(data);
-    auto buf = std::make_shared<memory_buffer>();
-    encode_header(*buf, op, payload_max, false);
+    encode_header(*buf, tp_, op, payload_max, false, deflated);
     encode_body(*buf, temp, payload_max);
     size -= payload_max;
     temp += payload_max;
     while (size > payload_max) {
-        encode_header(*buf, websocket_opcode::continuation, payload_max, false);
+        encode_header(*buf, tp_, websocket_opcode::continuation, payload_max, false, false);
         encode_body(*buf, temp, payload_max);
         size -= payload_max;
         temp += payload_max;
     }
 
-    encode_header(*buf, websocket_opcode::continuation, size, true);
+    encode_header(*buf, tp_, websocket_opcode::continuation, size, true, false);
     encode_body(*buf, temp, size);
 
     simple::network::instance().write(socket_, buf);
 }
 
-void websocket::encode_header(memory_buffer& buf, websocket_opcode op, size_t size, bool fin) const {
+void websocket::write(websocket_opcode op, const memory_buffer_ptr& payload) const {
+    // 客户端的帧每次的掩码不同，压缩的消息也和连接的上下文有关，都不能共享
+    const auto size = payload->readable();
+    if (tp_ == websocket_type::client || (!is_websocket_control(op) && deflate_ && deflate_->should_compress(size))) {
+        return write(op, payload->begin_read(), size);
+    }
+
+    auto header = std::make_shared<memory_buffer>();
+    encode_header(*header, tp_, op, size, true, false);
+    simple::network::instance().write(socket_, {std::move(header), payload});
+}
+
+void websocket::broadcast(std::vector<uint32_t> sockets, websocket_opcode op, const memory_buffer_ptr& payload) {
+    auto header = std::make_shared<memory_buffer>();
+    encode_header(*header, websocket_type::server, op, payload->readable(), true, false);
+    simple::network::instance().broadcast(std::move(sockets), {std::move(header), payload});
+}
+
+void websocket::encode_header(memory_buffer& buf, websocket_type tp, websocket_opcode op, size_t size, bool fin,
+                              bool compressed) {
     // FIN RSV1, RSV2, RSV3 Opcode
     uint8_t val = 0;
     if (fin) val = 0x80;
+    if (compressed) val |= 0x40;
     val |= static_cast<uint8_t>(op);
     buf.append(&val, sizeof(val));
 
     // Mask Payload length
-    if (tp_ == websocket_type::client) {
+    if (tp == websocket_type::client) {
         val = 0x80;
     } else {
         val = 0;
@@ -350,9 +500,9 @@ void websocket::encode_body(memory_buffer& buf, const void* data, size_t size) c
         char mask[4];
         rand_key(mask);
         buf.append(mask, sizeof(mask));
-        auto readable = buf.readable();
-        buf.append(data, size);
-        umask(buf.begin_read() + readable, size, mask);
+        buf.make_sure_writable(size);
+        websocket_mask_copy(buf.begin_write(), data, size, mask);
+        buf.written(size);
     } else {
         buf.append(data, size);
     }
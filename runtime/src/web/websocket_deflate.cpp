@@ -0,0 +1,305 @@
+﻿#include "websocket_deflate.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace simple {
+
+constexpr std::string_view deflate_extension_name = "permessage-deflate";
+constexpr std::string_view server_no_context_takeover_name = "server_no_context_takeover";
+constexpr std::string_view client_no_context_takeover_name = "client_no_context_takeover";
+constexpr std::string_view server_max_window_bits_name = "server_max_window_bits";
+constexpr std::string_view client_max_window_bits_name = "client_max_window_bits";
+
+// 压缩的消息去掉了同步刷新产生的结尾，解压时补上
+static constexpr uint8_t deflate_tail[] = {0x00, 0x00, 0xff, 0xff};
+
+// zlib 的原始 deflate 不支持 8
+static constexpr uint8_t min_window_bits = 9;
+static constexpr uint8_t max_window_bits = 15;
+
+// zlib 一次处理的最大长度
+static constexpr size_t zlib_chunk_max = std::numeric_limits<uInt>::max();
+
+// 一个 permessage-deflate 请求或者响应中的参数，窗口大小为 0 表示没有这个参数
+struct deflate_params {
+    bool server_no_context_takeover{false};
+    bool client_no_context_takeover{false};
+    uint8_t server_max_window_bits{0};
+    bool has_client_max_window_bits{false};
+    uint8_t client_max_window_bits{0};
+};
+
+static std::string_view trim(std::string_view str) {
+    while (!str.empty() && (str.front() == ' ' || str.front() == '\t')) str.remove_prefix(1);
+    while (!str.empty() && (str.back() == ' ' || str.back() == '\t')) str.remove_suffix(1);
+    return str;
+}
+
+static bool parse_window_bits(std::string_view value, uint8_t& bits) {
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+        value = value.substr(1, value.size() - 2);
+    }
+
+    unsigned int result = 0;
+    const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (value.empty() || ec != std::errc() || ptr != value.data() + value.size() || result < 8 || result > 15) {
+        return false;
+    }
+    bits = static_cast<uint8_t>(result);
+    return true;
+}
+
+// 解析一个请求或者响应，不认识、重复或者值不合法的参数都返回 false
+static bool parse_params(std::string_view extension, deflate_params& params) {
+    auto pos = extension.find(';');
+    if (trim(extension.substr(0, pos)) != deflate_extension_name) {
+        return false;
+    }
+
+    bool server_bits = false;
+    while (pos != std::string_view::npos) {
+        extension.remove_prefix(pos + 1);
+        pos = extension.find(';');
+        const auto param = trim(extension.substr(0, pos));
+        const auto eq = param.find('=');
+        const auto key = trim(param.substr(0, eq));
+        const auto value = eq == std::string_view::npos ? std::string_view{} : trim(param.substr(eq + 1));
+        if (key == server_no_context_takeover_name) {
+            if (params.server_no_context_takeover || eq != std::string_view::npos) return false;
+            params.server_no_context_takeover = true;
+        } else if (key == client_no_context_takeover_name) {
+            if (params.client_no_context_takeover || eq != std::string_view::npos) return false;
+            params.client_no_context_takeover = true;
+        } else if (key == server_max_window_bits_name) {
+            if (server_bits || !parse_window_bits(value, params.server_max_window_bits)) return false;
+            server_bits = true;
+        } else if (key == client_max_window_bits_name) {
+            if (params.has_client_max_window_bits) return false;
+            if (eq != std::string_view::npos && !parse_window_bits(value, params.client_max_window_bits)) return false;
+            params.has_client_max_window_bits = true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void check_window_bits(uint8_t bits) {
+    if (bits < min_window_bits || bits > max_window_bits) {
+        throw std::logic_error("websocket deflate window bits must be in [9, 15]");
+    }
+}
+
+websocket_deflate::websocket_deflate(websocket_type tp, const websocket_deflate_options& options)
+    : tp_(tp), options_(options) {
+    check_window_bits(options_.server_max_window_bits);
+    check_window_bits(options_.client_max_window_bits);
+    if (options_.level < 1 || options_.level > 9) {
+        throw std::logic_error("websocket deflate level must be in [1, 9]");
+    }
+}
+
+websocket_deflate::~websocket_deflate() noexcept {
+    if (active_) {
+        deflateEnd(&deflate_);
+        inflateEnd(&inflate_);
+    }
+}
+
+std::string websocket_deflate::offer() const {
+    std::string result(deflate_extension_name);
+    result += "; ";
+    result += client_max_window_bits_name;
+    if (options_.client_max_window_bits < max_window_bits) {
+        result += "=" + std::to_string(options_.client_max_window_bits);
+    }
+    if (options_.server_max_window_bits < max_window_bits) {
+        result += "; ";
+        result += server_max_window_bits_name;
+        result += "=" + std::to_string(options_.server_max_window_bits);
+    }
+    if (options_.server_no_context_takeover) {
+        result += "; ";
+        result += server_no_context_takeover_name;
+    }
+    if (options_.client_no_context_takeover) {
+        result += "; ";
+        result += client_no_context_takeover_name;
+    }
+    return result;
+}
+
+std::string websocket_deflate::accept(std::string_view extensions) {
+    while (!extensions.empty()) {
+        const auto pos = extensions.find(',');
+        const auto extension = extensions.substr(0, pos);
+        extensions = pos == std::string_view::npos ? std::string_view{} : extensions.substr(pos + 1);
+
+        deflate_params params;
+        if (!parse_params(extension, params)) continue;
+        // 要求的窗口比支持的小
+        if (params.server_max_window_bits != 0 && params.server_max_window_bits < min_window_bits) continue;
+
+        auto server_bits = options_.server_max_window_bits;
+        if (params.server_max_window_bits != 0) {
+            server_bits = (std::min)(server_bits, params.server_max_window_bits);
+        }
+        const auto server_no_context_takeover = options_.server_no_context_takeover || params.server_no_context_takeover;
+        const auto client_no_context_takeover = options_.client_no_context_takeover || params.client_no_context_takeover;
+
+        std::string result(deflate_extension_name);
+        if (server_no_context_takeover) {
+            result += "; ";
+            result += server_no_context_takeover_name;
+        }
+        if (client_no_context_takeover) {
+            result += "; ";
+            result += client_no_context_takeover_name;
+        }
+        if (params.server_max_window_bits != 0 || server_bits < max_window_bits) {
+            result += "; ";
+            result += server_max_window_bits_name;
+            result += "=" + std::to_string(server_bits);
+        }
+        // 客户端声明了支持才能限制客户端的窗口
+        if (params.has_client_max_window_bits) {
+            auto client_bits = options_.client_max_window_bits;
+            if (params.client_max_window_bits != 0) {
+                client_bits = (std::min)(client_bits, params.client_max_window_bits);
+            }
+            if (client_bits < max_window_bits) {
+                result += "; ";
+                result += client_max_window_bits_name;
+                result += "=" + std::to_string(client_bits);
+            }
+        }
+
+        start(server_bits, server_no_context_takeover);
+        return result;
+    }
+    return {};
+}
+
+bool websocket_deflate::confirm(std::string_view extensions) {
+    deflate_params params;
+    if (extensions.find(',') != std::string_view::npos || !parse_params(extensions, params)) {
+        return false;
+    }
+
+    // 请求的参数服务器必须接受
+    if (options_.server_no_context_takeover && !params.server_no_context_takeover) return false;
+    if (options_.server_max_window_bits < max_window_bits &&
+        (params.server_max_window_bits == 0 || params.server_max_window_bits > options_.server_max_window_bits)) {
+        return false;
+    }
+
+    // 响应中的客户端窗口必须有值
+    auto client_bits = options_.client_max_window_bits;
+    if (params.has_client_max_window_bits) {
+        if (params.client_max_window_bits < min_window_bits) return false;
+        client_bits = (std::min)(client_bits, params.client_max_window_bits);
+    }
+
+    start(client_bits, options_.client_no_context_takeover || params.client_no_context_takeover);
+    return true;
+}
+
+void websocket_deflate::start(uint8_t window_bits, bool no_context_takeover) {
+    if (active_) {
+        throw std::logic_error("websocket deflate already started");
+    }
+
+    // 负数的窗口大小表示原始的 deflate 数据，没有 zlib 的头和校验
+    if (deflateInit2(&deflate_, options_.level, Z_DEFLATED, -window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::logic_error("websocket deflateInit2 fail");
+    }
+    if (inflateInit2(&inflate_, -max_window_bits) != Z_OK) {
+        deflateEnd(&deflate_);
+        throw std::logic_error("websocket inflateInit2 fail");
+    }
+    reset_ = no_context_takeover;
+    active_ = true;
+}
+
+read_buffer websocket_deflate::compress(const void* data, size_t size) {
+    output_.clear();
+    auto* in = static_cast<Bytef*>(const_cast<void*>(data));
+    do {
+        const auto input = (std::min)(size, zlib_chunk_max);
+        deflate_.next_in = in;
+        deflate_.avail_in = static_cast<uInt>(input);
+        in += input;
+        size -= input;
+        const auto flush = size == 0 ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+        output_.make_sure_writable(deflateBound(&deflate_, static_cast<uLong>(input)) + sizeof(deflate_tail));
+        do {
+            if (output_.writable() == 0) {
+                output_.make_sure_writable(output_.capacity());
+            }
+            deflate_.next_out = output_.begin_write();
+            deflate_.avail_out = static_cast<uInt>((std::min)(output_.writable(), zlib_chunk_max));
+            const auto avail = deflate_.avail_out;
+            if (::deflate(&deflate_, flush) == Z_STREAM_ERROR) {
+                throw std::logic_error("websocket deflate fail");
+            }
+            output_.written(avail - deflate_.avail_out);
+        } while (deflate_.avail_out == 0);
+    } while (size > 0);
+
+    if (reset_) {
+        deflateReset(&deflate_);
+    }
+
+    // 同步刷新的结尾一定是 00 00 ff ff
+    auto len = output_.readable();
+    if (len >= sizeof(deflate_tail) &&
+        memcmp(output_.end_read() - sizeof(deflate_tail), deflate_tail, sizeof(deflate_tail)) == 0) {
+        len -= sizeof(deflate_tail);
+    }
+    return {output_.begin_read(), len};
+}
+
+bool websocket_deflate::decompress(memory_buffer& out) {
+    input_.append(deflate_tail, sizeof(deflate_tail));
+    inflate_.next_in = input_.begin_read();
+    auto remain = input_.readable();
+    bool result = false;
+    for (;;) {
+        if (inflate_.avail_in == 0) {
+            const auto input = (std::min)(remain, zlib_chunk_max);
+            inflate_.avail_in = static_cast<uInt>(input);
+            remain -= input;
+        }
+
+        out.make_sure_writable((std::min)(input_.readable() * 4, options_.max_message_size + 1));
+        inflate_.next_out = out.begin_write();
+        inflate_.avail_out = static_cast<uInt>((std::min)(out.writable(), zlib_chunk_max));
+        const auto avail = inflate_.avail_out;
+        const auto ret = ::inflate(&inflate_, Z_SYNC_FLUSH);
+        out.written(avail - inflate_.avail_out);
+        if (ret == Z_STREAM_END) {
+            // 对方结束了压缩流，后面的消息是新的流
+            inflateReset(&inflate_);
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            break;
+        }
+
+        if (out.readable() > options_.max_message_size) {
+            break;
+        }
+
+        if (inflate_.avail_in == 0 && remain == 0 && inflate_.avail_out != 0) {
+            result = true;
+            break;
+        }
+    }
+
+    input_.clear();
+    return result;
+}
+
+}  // namespace simple
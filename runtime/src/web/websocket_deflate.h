@@ -0,0 +1,59 @@
+﻿#pragma once
+#include <simple/config.h>
+#include <zlib.h>
+
+#include <simple/containers/buffer.hpp>
+#include <simple/web/websocket.h>
+#include <string>
+#include <string_view>
+
+namespace simple {
+
+// 一个连接的 permessage-deflate 状态，握手协商成功后才会初始化 zlib
+// 压缩使用协商的窗口大小，解压总是使用最大的窗口，可以解开任何窗口大小的数据
+class websocket_deflate {
+  public:
+    // 配置不合法时抛出 std::logic_error
+    websocket_deflate(websocket_type tp, const websocket_deflate_options& options);
+
+    SIMPLE_NON_COPYABLE(websocket_deflate)
+
+    ~websocket_deflate() noexcept;
+
+    // 客户端握手请求中的 Sec-WebSocket-Extensions
+    [[nodiscard]] std::string offer() const;
+
+    // 服务器从客户端的请求中选择第一个可以接受的参数，返回响应的 Sec-WebSocket-Extensions，都不接受时返回空
+    std::string accept(std::string_view extensions);
+
+    // 客户端检查服务器的响应，响应不合法时返回 false
+    bool confirm(std::string_view extensions);
+
+    [[nodiscard]] bool active() const noexcept { return active_; }
+
+    [[nodiscard]] bool should_compress(size_t size) const noexcept { return active_ && size >= options_.threshold; }
+
+    // 压缩一个完整的消息，返回的数据在下一次压缩之前有效
+    read_buffer compress(const void* data, size_t size);
+
+    // 收到的压缩的消息先放在这里
+    memory_buffer& input() noexcept { return input_; }
+
+    // 解压 input 中的消息追加到 out，数据不合法或者超过最大长度时返回 false
+    bool decompress(memory_buffer& out);
+
+  private:
+    void start(uint8_t window_bits, bool no_context_takeover);
+
+    websocket_type tp_;
+    websocket_deflate_options options_;
+    bool active_{false};
+    // 自己每个消息压缩完后是否重置
+    bool reset_{false};
+    z_stream deflate_{};
+    z_stream inflate_{};
+    memory_buffer output_;
+    memory_buffer input_;
+};
+
+}  // namespace simple